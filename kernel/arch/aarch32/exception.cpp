@@ -1,6 +1,9 @@
 #include "exception.hpp"
+#include "../../demand_paging.hpp"
 #include "../../device/interrupts.hpp"
+#include "../../smp.hpp"
 #include "../../syscall.hpp"
+#include "../../tasks.hpp"
 #include "../../arch/panic.hpp"
 #include "mmu.hpp"
 #include "processor.hpp"
@@ -14,16 +17,26 @@ void reset_handler(void)
     panic("Resetting. Goodbye.");
 }
 
-void undefined_instruction_handler(PtrData old_cpsr_as_u32, PtrData old_pc, PtrData old_lr)
+void undefined_instruction_handler(PtrData old_cpsr_as_u32, PtrData old_pc)
 {
+    // VFP/NEON instructions are undefined while disabled, which is how the
+    // first use since the task was switched to is caught; it is retried once
+    // its registers are loaded. See fp.hpp
     auto old_cpsr = CPSR::from_data(old_cpsr_as_u32);
+    if (!old_cpsr.in_privileged_mode()) {
+        KernelLocker locker;
+        if (task_manager().handle_fp_trap(InterruptsDisabledTag::promise()))
+            return;
+    }
+
     panic("\033[31mUndefined instruction! halting.\033[0m\n\n"
-          "old cpsr:", old_cpsr, "\told pc:", reinterpret_cast<void*>(old_pc), "\told lr: ", reinterpret_cast<void*>(old_lr));
+          "old cpsr:", old_cpsr, "\told pc:", reinterpret_cast<void*>(old_pc));
 }
 
-PtrData software_interrupt_handler(PtrData call, PtrData arg1, PtrData arg2, PtrData arg3)
+PtrData software_interrupt_handler(PtrData call, PtrData arg1, PtrData arg2, PtrData arg3, const SyscallFrame& frame)
 {
-    return handle_syscall(call, arg1, arg2, arg3);
+    KernelLocker locker;
+    return handle_syscall(call, arg1, arg2, arg3, frame);
 }
 
 void prefetch_abort_handler(void)
@@ -31,8 +44,26 @@ void prefetch_abort_handler(void)
     panic("interrupt:\t\033[31mPrefetch abort! halting.\033[0m");
 }
 
-void data_abort_handler(PtrData old_cpsr_as_u32, PtrData old_pc, PtrData addr)
+void data_abort_handler(PtrData old_cpsr_as_u32, PtrData old_pc, PtrData addr, PtrData status)
 {
+    // Translation faults (section or page) may be on task memory that is not
+    // backed yet, and permission faults on writes to memory shared since a
+    // fork. The status is split and WnR is bit 11; see B4.1.52 in the ARMv7
+    // Reference Manual
+    auto fault_status = ((status >> 6) & 0b10000) | (status & 0b1111);
+    bool is_write = status & (1u << 11u);
+    pine::Maybe<PageFault> fault;
+    if (fault_status == 0b00101 || fault_status == 0b00111)
+        fault = PageFault::NotMapped;
+    else if ((fault_status == 0b01101 || fault_status == 0b01111) && is_write)
+        fault = PageFault::Write;
+
+    if (fault) {
+        KernelLocker locker;
+        if (handle_page_fault(addr, *fault))
+            return;
+    }
+
     auto old_cpsr = CPSR::from_data(old_cpsr_as_u32);
     panic("interrupt:\t\033[31mData abort! halting.\033[0m\n\n"
           "old cpsr:", old_cpsr, "\told pc:", reinterpret_cast<void*>(old_pc), "\taddr:", reinterpret_cast<void*>(addr), "\n",
@@ -47,6 +78,7 @@ void fast_irq_handler(void)
 void irq_handler(void)
 {
     // Interrupts are disabled in the IRQ handler, and enabled on exit; see vector.S
+    KernelLocker locker;
     interrupts_handle_irq(InterruptsDisabledTag::promise());
 }
 }
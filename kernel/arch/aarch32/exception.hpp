@@ -1,4 +1,6 @@
 #pragma once
+#include "processor.hpp"
+
 #include <pine/types.hpp>
 #include <pine/syscall.hpp>
 
@@ -13,13 +15,13 @@
 extern "C" {
 void reset_handler(void) __attribute__((interrupt("ABORT")));
 
-void undefined_instruction_handler(PtrData old_cpsr, PtrData old_pc, PtrData old_lr);
+void undefined_instruction_handler(PtrData old_cpsr, PtrData old_pc);
 
-PtrData software_interrupt_handler(PtrData call, PtrData arg1, PtrData arg2, PtrData arg3);
+PtrData software_interrupt_handler(PtrData call, PtrData arg1, PtrData arg2, PtrData arg3, const SyscallFrame& frame);
 
 void prefetch_abort_handler(void) __attribute__((interrupt("ABORT")));
 
-void data_abort_handler(PtrData old_cpsr, PtrData old_pc, PtrData addr);
+void data_abort_handler(PtrData old_cpsr, PtrData old_pc, PtrData addr, PtrData status);
 
 void fast_irq_handler(void) __attribute__((interrupt("FIQ")));
 
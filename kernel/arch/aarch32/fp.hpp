@@ -0,0 +1,26 @@
+#pragma once
+#include <pine/types.hpp>
+
+/*
+ * What a task has in the VFP/NEON registers, for the tasks that use them;
+ * see kernel/fp.hpp.
+ */
+struct FPRegisters {
+    u64 dn[32];  // the Q registers are pairs of these
+    u32 fpscr;
+};
+
+// Used by fp.S
+static_assert(offsetof(FPRegisters, fpscr) == 256);
+
+extern "C" {
+// In fp.S; the kernel itself is built without VFP/NEON, so only these touch them
+// Gives the calling core access to VFP/NEON, but with them disabled
+void fp_init_core();
+// Whether they can be used at all (FPEXC.EN); the kernel also has to enable
+// them to save or restore them, and undefined instructions trap otherwise
+void fp_enable();
+void fp_disable();
+void fp_save(FPRegisters*);
+void fp_restore(const FPRegisters*);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <pine/types.hpp>
+
+/*
+ * The virtual timer of the calling core's ARM generic timer. The counter
+ * counts up at frequency() and never wraps in practice; the timer fires (and
+ * keeps firing) once the counter reaches the compare value.
+ *
+ * See B8.5 in the ARMv7 reference manual for these registers.
+ */
+struct GenericTimer {
+    // CNTV_CTL bits
+    static constexpr u32 enable = 1 << 0;
+    static constexpr u32 interrupt_masked = 1 << 1;
+
+    static u32 frequency() __attribute__((always_inline))
+    {
+        // CNTFRQ
+        u32 frequency;
+        asm volatile("mrc p15, 0, %0, c14, c0, 0" : "=r"(frequency));
+        return frequency;
+    }
+
+    static u64 count() __attribute__((always_inline))
+    {
+        // CNTVCT; without the isb, the read may happen out of order with
+        // earlier instructions
+        u32 lower, upper;
+        asm volatile("isb; mrrc p15, 1, %0, %1, c14" : "=r"(lower), "=r"(upper)::"memory");
+        return (static_cast<u64>(upper) << 32) | lower;
+    }
+
+    static void set_compare(u64 count) __attribute__((always_inline))
+    {
+        // CNTV_CVAL
+        auto lower = static_cast<u32>(count);
+        auto upper = static_cast<u32>(count >> 32);
+        asm volatile("mcrr p15, 3, %0, %1, c14; isb" ::"r"(lower), "r"(upper) : "memory");
+    }
+
+    static void set_control(u32 control) __attribute__((always_inline))
+    {
+        // CNTV_CTL
+        asm volatile("mcr p15, 0, %0, c14, c3, 1; isb" ::"r"(control) : "memory");
+    }
+};
@@ -1,6 +1,7 @@
 #include "mmu.hpp"
 #include "../../arch/panic.hpp"
 #include "../../arch/barrier.hpp"
+#include "processor.hpp"
 
 #include <pine/c_builtins.hpp>
 #include <pine/twomath.hpp>
@@ -9,6 +10,14 @@
 static_assert(PageSize == mmu::L2Entry::vm_size);
 static_assert(SectionSize == mmu::L1Entry::vm_size);
 
+// The L1Table is 16KiB aligned; below that are the walk attributes
+constexpr u32 c_ttbr0_attribute_mask = (1u << 14u) - 1;
+// See B4.1.153 in the ARMv7 reference manual; TTBR1 translates from
+// 2^(32 - N), which is DEMAND_PAGED_START
+constexpr u32 c_ttbcr_split = 1;
+constexpr u32 c_ttbcr_pd1 = 1u << 5u;
+static_assert(DEMAND_PAGED_START == 1ull << (32 - c_ttbcr_split));
+
 namespace mmu {
 
 static PhysicalPageAllocator g_physical_page_allocator;  // dummy; ctor not called
@@ -29,7 +38,8 @@ void init_page_tables(PtrData code_end)
     //        especially for 16KiB L1Table
     auto code_region = SectionRegion::from_range(0, code_section_end);
 
-    PageRegion vm_region         { 0, MEMORY_END_PAGES };
+    // Past the window is for the tasks' own tables; see set_l1_table()
+    auto vm_region = PageRegion::from_range(0, DEMAND_PAGED_START);
     PageRegion phys_region       { 0, PHYSICAL_MEMORY_END_PAGES };
 
     SectionRegion l1_region      { code_region.end_offset(), 1 };
@@ -39,9 +49,13 @@ void init_page_tables(PtrData code_end)
     auto [pv_scratch_region, page_scratch_region] = as_page_region(scratch_region).halve();
     auto [phys_scratch_region, virt_scratch_region] = pv_scratch_region.halve();
     auto device_region = SectionRegion::from_range(DEVICES_START, DEVICES_END);
+    auto gpu_region = SectionRegion::from_range(DEVICES_START, PERIPHERALS_START);
+    auto peripheral_region = SectionRegion::from_range(PERIPHERALS_START, DEVICES_END);
+    auto local_peripheral_region = SectionRegion::from_range(LOCAL_PERIPHERALS_START, LOCAL_PERIPHERALS_END);
 
     g_physical_page_allocator.init(phys_region, phys_scratch_region);
     g_physical_page_allocator.add(as_page_region(device_region));
+    g_physical_page_allocator.add(as_page_region(local_peripheral_region));
     g_virtual_page_allocator.init(vm_region, virt_scratch_region);
 
     // Map into L1 table
@@ -53,11 +67,21 @@ void init_page_tables(PtrData code_end)
 
     g_page_allocator.reserve_section_region(scratch_region);
 
-    // Map devices in upper address space to themselves
-    g_page_allocator.reserve_section_region(device_region, PageAllocator::Backing::Identity);
+    // Map devices in upper address space to themselves; the framebuffer lives
+    // in the memory given to the GPU
+    g_page_allocator.reserve_section_region(gpu_region, PageAllocator::Backing::Identity, MemoryType::WriteCombining);
+    g_page_allocator.reserve_section_region(peripheral_region, PageAllocator::Backing::Identity, MemoryType::Device);
+    g_page_allocator.reserve_section_region(local_peripheral_region, PageAllocator::Backing::Identity, MemoryType::Device);
 
     set_l1_table(l1);
 }
+
+void init_secondary_page_tables(PtrData code_end)
+{
+    // The L1Table comes right after the code; see init_page_tables()
+    auto code_section_end = pine::align_up_two(code_end, SectionSize);
+    set_l1_table(*reinterpret_cast<L1Table*>(code_section_end));
+}
 }
 
 void print_with(pine::Printer& printer, const L2Ptr& l2_ptr)
@@ -197,9 +221,36 @@ void set_l1_table(L1Table& l1_addr)
 {
     // See B4-1721 in ARMv7 reference manual
     // FIXME: See l1_table() for 14 constant problem; should we issue a dsb here?
-    u32 ttbr0 = PhysicalAddress(&l1_addr).ptr_data() & ~(1u << 14u);
+    u32 ttbr0 = PhysicalAddress(&l1_addr).ptr_data() & ~c_ttbr0_attribute_mask;
+    // Table walks go through the (write-back, write-allocate) cache, like the
+    // writes to the tables themselves
+    ttbr0 |= (1u << 6u)  // IRGN: Inner write-back write-allocate
+        | (1u << 3u)     // RGN: Outer write-back write-allocate
+        | (1u << 1u);    // S: Shareable
     asm volatile("MCR p15, 0, %0, c2, c0, 0" ::"r"(ttbr0));
+    // TTBR0 only covers the lower half (TTBCR.N = 1); walks of the upper half
+    // fault until a task's tables are switched to (PD1)
+    asm volatile("MCR p15, 0, %0, c2, c0, 2" ::"r"(c_ttbcr_split | c_ttbcr_pd1));
+    pine::DataBarrier::sync();
+}
+
+static void set_task_l1_table(L1Table* l1_table)
+{
+    // See B4.1.155 in the ARMv7 reference manual; the same walk attributes as
+    // TTBR0, see set_l1_table()
+    if (l1_table) {
+        u32 ttbr1 = PhysicalAddress(l1_table).ptr_data() | (1u << 6u) | (1u << 3u) | (1u << 1u);
+        asm volatile("MCR p15, 0, %0, c2, c0, 1" ::"r"(ttbr1));
+    }
+    asm volatile("MCR p15, 0, %0, c2, c0, 2" ::"r"(l1_table ? c_ttbcr_split : c_ttbcr_split | c_ttbcr_pd1));
+    asm volatile("isb" ::: "memory");
+
+    // Task pages are global (we don't use ASIDs), so whatever the last task
+    // left in the TLB has to go; only this core's (TLBIALL), since no other
+    // core can be running either task
+    asm volatile("mcr p15, 0, %0, c8, c7, 0" ::"r"(0) : "memory");
     pine::DataBarrier::sync();
+    asm volatile("isb" ::: "memory");
 }
 
 L1Table& l1_table()
@@ -212,7 +263,66 @@ L1Table& l1_table()
     //        alignment requirements for the L1 translation table. See B4-1722
     //        in the ARMv7 reference manual for technical details, 9.7.2 in the
     //        Cortex-A programmer's guide for background
-    return *reinterpret_cast<L1Table*>( (ttbr0 & ~(1u << 14u)) );
+    return *reinterpret_cast<L1Table*>(ttbr0 & ~c_ttbr0_attribute_mask);
+}
+
+static void invalidate_tlb_entry(void* virt_ptr)
+{
+    // TLBIMVAIS, so that every core drops it; the ASID (low bits) is always 0
+    asm volatile("mcr p15, 0, %0, c8, c3, 1" ::"r"(virt_ptr) : "memory");
+}
+
+static void finish_tlb_invalidation()
+{
+    asm volatile("mcr p15, 0, %0, c7, c1, 6" ::"r"(0) : "memory");  // BPIALLIS
+    pine::DataBarrier::sync();
+    asm volatile("isb" ::: "memory");
+}
+
+static void invalidate_tlb(PageRegion virt_region)
+{
+    // Past this many pages, dropping everything is cheaper than going page by
+    // page (and the TLB is not much bigger anyways)
+    constexpr size_t max_pages_to_invalidate = 64;
+
+    // See B4.2.2 in the ARMv7 reference manual; the table writes must be
+    // complete before we invalidate
+    pine::DataBarrier::sync();
+    if (virt_region.length > max_pages_to_invalidate) {
+        asm volatile("mcr p15, 0, %0, c8, c3, 0" ::"r"(0) : "memory");  // TLBIALLIS
+    }
+    else {
+        for (size_t offset = 0; offset < virt_region.length; offset++)
+            invalidate_tlb_entry(virt_region.ptr(offset));
+    }
+    finish_tlb_invalidation();
+}
+
+template <typename OnUnmapped>
+void PageAllocator::unmap_pages(PageRegion virt_region, OnUnmapped on_unmapped)
+{
+    for (size_t offset = 0; offset < virt_region.length; offset++) {
+        auto* virt_ptr = virt_region.ptr(offset);
+        auto& l1_entry = m_l1_table->retrieve_entry(virt_ptr);
+        if (l1_entry.type() != L1Type::L2Ptr)
+            panic("Tried to free memory not given by the PageAllocator:", virt_ptr, "\n", *m_l1_table);
+
+        auto* l2_table = l1_entry.as_ptr.l2_table();
+        auto& l2_entry = l2_table->retrieve_entry(virt_ptr);
+        if (l2_entry.type() != L2Type::Page)
+            panic("Tried to free memory not given by the PageAllocator:", virt_ptr, "\n", *m_l1_table);
+
+        on_unmapped(l2_entry.as_page.physical_address().ptr_data() / PageSize);
+        l2_entry = L2Entry();
+
+        // Check once we are done with each table whether it is still in use
+        bool is_last_in_table = offset + 1 == virt_region.length
+            || VirtualAddress(virt_region.ptr(offset + 1)).l1_index() != VirtualAddress(virt_ptr).l1_index();
+        if (is_last_in_table && l2_table->is_empty()) {
+            l1_entry = L1Entry();
+            m_l2_table_allocator.free({ l2_table, sizeof(L2Table) });
+        }
+    }
 }
 
 void PageAllocator::init(L1Table& l1_table, PhysicalPageAllocator& physical_page_allocator, VirtualPageAllocator& virtual_page_allocator, PageRegion scratch_pages)
@@ -222,23 +332,321 @@ void PageAllocator::init(L1Table& l1_table, PhysicalPageAllocator& physical_page
     m_virtual_page_allocator = &virtual_page_allocator;
     m_l2_table_allocator.add(scratch_pages.ptr(), scratch_pages.size());
     m_spare_free_l2_page = nullptr;
+    m_num_zeroed_pages = 0;
 }
 
 pine::Allocation PageAllocator::allocate(size_t size)
 {
     auto num_pages = pine::align_up_two(size, PageSize) / PageSize;
+    if (m_num_zeroed_pages > 0) {
+        if (auto alloc = try_allocate_zeroed(num_pages))
+            return alloc;
+
+        // Short on memory, so the pool is better spent on what is asked for
+        drain_zeroed_pages();
+    }
+
     auto [_, virt_region] = allocate_pages(num_pages);
     bzero(virt_region.ptr(), virt_region.size());
     return { virt_region.ptr(), virt_region.size() };
 }
 
+pine::Allocation PageAllocator::try_allocate_zeroed(size_t num_pages)
+{
+    auto virt_alloc = m_virtual_page_allocator->allocate(num_pages);
+    if (!virt_alloc)
+        return {};
+
+    auto virt_region = PageRegion::from_ptr(virt_alloc.ptr, virt_alloc.size);
+    auto [zeroed_virt_region, fresh_virt_region] = virt_region.split_left(pine::min(num_pages, m_num_zeroed_pages));
+
+    // Whatever the pool cannot cover is allocated and zeroed as usual
+    if (fresh_virt_region) {
+        auto phys_alloc = m_physical_page_allocator->allocate(fresh_virt_region.length);
+        if (!phys_alloc) {
+            m_virtual_page_allocator->free(virt_alloc);
+            return {};
+        }
+
+        auto phys_region = PageRegion::from_ptr(phys_alloc.ptr, phys_alloc.size);
+        if (!try_record_page_in_l1(phys_region, fresh_virt_region, MemoryType::Normal)) {
+            m_physical_page_allocator->free(phys_alloc);
+            m_virtual_page_allocator->free(virt_alloc);
+            return {};
+        }
+        bzero(fresh_virt_region.ptr(), fresh_virt_region.size());
+    }
+
+    // Move the zeroed pages from where they were mapped while pooled
+    m_num_zeroed_pages -= zeroed_virt_region.length;
+    auto pooled_virt_page = [&](size_t offset) {
+        return PageRegion { m_zeroed_pages[m_num_zeroed_pages + offset], 1 };
+    };
+    for (size_t offset = 0; offset < zeroed_virt_region.length; offset++) {
+        PageRegion phys_page { 0, 1 };
+        unmap_pages(pooled_virt_page(offset), [&](size_t phys_offset) { phys_page.offset = phys_offset; });
+
+        PageRegion virt_page { zeroed_virt_region.offset + offset, 1 };
+        PANIC_MESSAGE_IF(!try_record_page_in_l1(phys_page, virt_page, MemoryType::Normal), "Out of memory for L2 tables!");
+    }
+
+    // The old mappings must be gone from every TLB before their virtual
+    // pages can be handed out again; see invalidate_tlb()
+    pine::DataBarrier::sync();
+    for (size_t offset = 0; offset < zeroed_virt_region.length; offset++)
+        invalidate_tlb_entry(pooled_virt_page(offset).ptr());
+    finish_tlb_invalidation();
+
+    for (size_t offset = 0; offset < zeroed_virt_region.length; offset++)
+        m_virtual_page_allocator->free({ pooled_virt_page(offset).ptr(), PageSize });
+
+    return { virt_region.ptr(), virt_region.size() };
+}
+
+void PageAllocator::drain_zeroed_pages()
+{
+    while (m_num_zeroed_pages > 0)
+        unmap_and_free_pages({ m_zeroed_pages[--m_num_zeroed_pages], 1 });
+
+    reclaim_l2_table_pages();
+}
+
+bool PageAllocator::try_zero_free_page()
+{
+    PageRegion virt_page;
+    {
+        InterruptDisabler disabler;
+        if (m_num_zeroed_pages == m_zeroed_pages.length())
+            return false;
+
+        auto [_, virt_region] = allocate_pages(1);
+        if (!virt_region)
+            return false;
+
+        virt_page = virt_region;
+    }
+
+    // This is the slow part, so let others run meanwhile; nobody else knows
+    // about the page yet
+    bzero(virt_page.ptr(), virt_page.size());
+
+    InterruptDisabler disabler;
+    m_zeroed_pages[m_num_zeroed_pages++] = virt_page.offset;
+    return true;
+}
+
 void PageAllocator::free(pine::Allocation alloc)
 {
-    // FIXME: Todo!
-    panic("Tried to free memory given by the PageAllocator!");
+    unmap_and_free_pages(PageRegion::from_ptr(alloc.ptr, alloc.size));
+    reclaim_l2_table_pages();
 }
 
-Pair<PageRegion, PageRegion> PageAllocator::reserve_region(PageRegion region, PageAllocator::Backing backing)
+void PageAllocator::reclaim_l2_table_pages()
+{
+    // Give back the pages of unused L2 tables, keeping one around so that
+    // alternating allocations and frees do not keep mapping it in and out
+    while (m_l2_table_allocator.num_empty_pages() > 1) {
+        auto l2_page = m_l2_table_allocator.reclaim();
+        unmap_and_free_pages(PageRegion::from_ptr(l2_page.ptr, l2_page.size));
+    }
+}
+
+// Tasks share pages after a fork; a page is freed with the last reference
+static u16 g_page_ref_counts[PHYSICAL_MEMORY_END_PAGES];
+
+static u16& ref_count_of(PtrData phys_addr)
+{
+    auto page = phys_addr / PageSize;
+    PANIC_MESSAGE_IF(page >= PHYSICAL_MEMORY_END_PAGES, "Task page is not in RAM!");
+    return g_page_ref_counts[page];
+}
+
+L1Table* PageAllocator::try_create_task_tables()
+{
+    // TTBR1 always points to a full (16KiB aligned) table, though only the
+    // upper half is used; identity backed, since the walker needs its
+    // physical address
+    auto [phys_region, _] = allocate_pages(4, pine::PageAlignmentLevel::Page, Backing::Identity);
+    if (!phys_region)
+        return nullptr;
+
+    PANIC_IF(!pine::is_aligned_two(reinterpret_cast<PtrData>(phys_region.ptr()), alignof(L1Table)));
+    return new (static_cast<L1Table*>(phys_region.ptr())) L1Table();
+}
+
+void PageAllocator::destroy_task_tables(L1Table& l1_table)
+{
+    PtrData ttbr1;
+    asm volatile("MRC p15, 0, %0, c2, c0, 1"
+                 : "=r"(ttbr1));
+    if ((ttbr1 & ~c_ttbr0_attribute_mask) == PhysicalAddress(&l1_table).ptr_data())
+        set_task_l1_table(nullptr);
+
+    for (PtrData l1_addr = DEMAND_PAGED_START; l1_addr < DEMAND_PAGED_END; l1_addr += L1Entry::vm_size) {
+        auto& l1_entry = l1_table.retrieve_entry(l1_addr);
+        if (l1_entry.type() != L1Type::L2Ptr)
+            continue;
+
+        auto* l2_table = l1_entry.as_ptr.l2_table();
+        for (PtrData l2_addr = l1_addr; l2_addr < l1_addr + L1Entry::vm_size; l2_addr += L2Entry::vm_size) {
+            auto& l2_entry = l2_table->retrieve_entry(l2_addr);
+            if (l2_entry.type() != L2Type::Page)
+                continue;
+
+            auto phys_addr = l2_entry.as_page.physical_address().ptr_data();
+            if (--ref_count_of(phys_addr) == 0)
+                m_physical_page_allocator->free({ reinterpret_cast<void*>(phys_addr), PageSize });
+        }
+        m_l2_table_allocator.free({ l2_table, sizeof(L2Table) });
+    }
+
+    // Stale entries may be left in the TLBs of the cores that ran the task
+    pine::DataBarrier::sync();
+    asm volatile("mcr p15, 0, %0, c8, c3, 0" ::"r"(0) : "memory");  // TLBIALLIS
+    finish_tlb_invalidation();
+
+    free({ &l1_table, sizeof(L1Table) });
+}
+
+L2Entry* PageAllocator::find_task_page_entry(L1Table& l1_table, PtrData virt_addr)
+{
+    auto& l1_entry = l1_table.retrieve_entry(virt_addr);
+    if (l1_entry.type() != L1Type::L2Ptr)
+        return nullptr;
+
+    auto& l2_entry = l1_entry.as_ptr.l2_table()->retrieve_entry(virt_addr);
+    if (l2_entry.type() != L2Type::Page)
+        return nullptr;
+
+    return &l2_entry;
+}
+
+bool PageAllocator::try_map_task_page(L1Table& l1_table, PtrData virt_addr, PtrData phys_addr, Permissions permissions)
+{
+    auto& l1_entry = l1_table.retrieve_entry(virt_addr);
+    if (l1_entry.type() == L1Type::Fault) {
+        auto l2_table_alloc = try_reserve_l2_table_entry();
+        if (!l2_table_alloc)
+            return false;
+
+        l1_entry = L2Ptr(PhysicalAddress(new (l2_table_alloc.ptr) L2Table()));
+    }
+    PANIC_IF(l1_entry.type() != L1Type::L2Ptr);
+
+    // Replaces whatever was there; see try_copy_on_write()
+    l1_entry.as_ptr.l2_table()->retrieve_entry(virt_addr) = Page(PhysicalAddress(phys_addr), MemoryType::Normal, permissions);
+    pine::DataBarrier::sync();
+    return true;
+}
+
+bool PageAllocator::try_back_page(L1Table& l1_table, PtrData virt_addr)
+{
+    auto phys_alloc = m_physical_page_allocator->allocate(1);
+    if (!phys_alloc && m_num_zeroed_pages > 0) {
+        drain_zeroed_pages();
+        phys_alloc = m_physical_page_allocator->allocate(1);
+    }
+    if (!phys_alloc)
+        return false;
+
+    auto phys_addr = reinterpret_cast<PtrData>(phys_alloc.ptr);
+    if (!try_map_task_page(l1_table, virt_addr, phys_addr, Permissions::ReadWrite)) {
+        m_physical_page_allocator->free(phys_alloc);
+        return false;
+    }
+    ref_count_of(phys_addr) = 1;
+
+    // The faulting task's tables are ours and it is stopped until we return,
+    // so it can't see the page before it is zeroed
+    bzero(reinterpret_cast<void*>(virt_addr), PageSize);
+    return true;
+}
+
+bool PageAllocator::try_copy_on_write(L1Table& l1_table, PtrData virt_addr)
+{
+    auto* l2_entry = find_task_page_entry(l1_table, virt_addr);
+    if (!l2_entry)
+        return false;
+    if (l2_entry->as_page.is_writable())
+        return true;  // already copied; the fault raced with us
+
+    // Once the others have their own copies, the last one can just write
+    PageRegion virt_page { virt_addr / PageSize, 1 };
+    auto phys_addr = l2_entry->as_page.physical_address().ptr_data();
+    if (ref_count_of(phys_addr) == 1) {
+        *l2_entry = Page(PhysicalAddress(phys_addr), MemoryType::Normal, Permissions::ReadWrite);
+        invalidate_tlb(virt_page);
+        return true;
+    }
+
+    // Copied through a kernel mapping of the new page, which only lasts as
+    // long as the copy; the faulting task's tables are ours
+    auto [copy_phys_page, copy_virt_page] = allocate_pages(1);
+    if (!copy_phys_page)
+        return false;
+
+    memcpy(copy_virt_page.ptr(), virt_page.ptr(), PageSize);
+    unmap_pages(copy_virt_page, [](size_t) {});
+    invalidate_tlb(copy_virt_page);
+    m_virtual_page_allocator->free({ copy_virt_page.ptr(), copy_virt_page.size() });
+
+    auto copy_phys_addr = reinterpret_cast<PtrData>(copy_phys_page.ptr());
+    PANIC_IF(!try_map_task_page(l1_table, virt_addr, copy_phys_addr, Permissions::ReadWrite));
+    ref_count_of(copy_phys_addr) = 1;
+    invalidate_tlb(virt_page);
+    --ref_count_of(phys_addr);
+    return true;
+}
+
+bool PageAllocator::try_share_pages(L1Table& from, L1Table& to, PageRegion virt_region)
+{
+    bool shared = true;
+    for (size_t offset = 0; offset < virt_region.length; offset++) {
+        auto virt_addr = reinterpret_cast<PtrData>(virt_region.ptr(offset));
+        auto* l2_entry = find_task_page_entry(from, virt_addr);
+        if (!l2_entry)
+            continue;
+
+        // Both become read-only, so that whichever writes first copies it
+        auto phys_addr = l2_entry->as_page.physical_address().ptr_data();
+        *l2_entry = Page(PhysicalAddress(phys_addr), MemoryType::Normal, Permissions::ReadOnly);
+        if (!try_map_task_page(to, virt_addr, phys_addr, Permissions::ReadOnly)) {
+            shared = false;
+            break;
+        }
+        ++ref_count_of(phys_addr);
+    }
+
+    // The pages were writable in the TLB of the core running the task
+    pine::DataBarrier::sync();
+    asm volatile("mcr p15, 0, %0, c8, c3, 0" ::"r"(0) : "memory");  // TLBIALLIS
+    finish_tlb_invalidation();
+    return shared;
+}
+
+void PageAllocator::unmap_and_free_pages(PageRegion virt_region)
+{
+    // Physical pages are freed in contiguous runs
+    PageRegion phys_run { 0, 0 };
+    auto free_phys_run = [&]() {
+        if (phys_run)
+            m_physical_page_allocator->free({ phys_run.ptr(), phys_run.size() });
+    };
+
+    unmap_pages(virt_region, [&](size_t phys_offset) {
+        if (phys_run.end_offset() != phys_offset) {
+            free_phys_run();
+            phys_run = { phys_offset, 0 };
+        }
+        ++phys_run.length;
+    });
+
+    invalidate_tlb(virt_region);
+    free_phys_run();
+    m_virtual_page_allocator->free({ virt_region.ptr(), virt_region.size() });
+}
+
+Pair<PageRegion, PageRegion> PageAllocator::reserve_region(PageRegion region, PageAllocator::Backing backing, MemoryType memory_type)
 {
     auto [phys_alloc, virt_alloc] = try_reserve_region_unrecorded(region, backing);
     if (!phys_alloc)
@@ -248,15 +656,16 @@ Pair<PageRegion, PageRegion> PageAllocator::reserve_region(PageRegion region, Pa
     auto virt_region = PageRegion::from_ptr(virt_alloc.ptr, virt_alloc.size);
     PANIC_IF(virt_region.length != phys_region.length);
 
-    if (!try_record_page_in_l1(phys_region, virt_region)) {
+    if (!try_record_page_in_l1(phys_region, virt_region, memory_type)) {
         m_physical_page_allocator->free(phys_alloc);
-        m_virtual_page_allocator->free(phys_alloc);
+        m_virtual_page_allocator->free(virt_alloc);
+        return {};
     }
 
     return { phys_region, virt_region };
 }
 
-Pair<SectionRegion, SectionRegion> PageAllocator::reserve_section_region(SectionRegion region, PageAllocator::Backing backing)
+Pair<SectionRegion, SectionRegion> PageAllocator::reserve_section_region(SectionRegion region, PageAllocator::Backing backing, MemoryType memory_type)
 {
     auto [phys_alloc, virt_alloc] = try_reserve_region_unrecorded(as_page_region(region), backing);
     if (!phys_alloc)
@@ -265,15 +674,16 @@ Pair<SectionRegion, SectionRegion> PageAllocator::reserve_section_region(Section
     auto phys_region = SectionRegion::from_ptr(phys_alloc.ptr, phys_alloc.size);
     auto virt_region = SectionRegion::from_ptr(virt_alloc.ptr, virt_alloc.size);
 
-    if (!try_record_section_in_l1(phys_region, virt_region)) {
+    if (!try_record_section_in_l1(phys_region, virt_region, memory_type)) {
         m_physical_page_allocator->free(phys_alloc);
-        m_virtual_page_allocator->free(phys_alloc);
+        m_virtual_page_allocator->free(virt_alloc);
+        return {};
     }
 
     return { phys_region, virt_region };
 }
 
-Pair<PageRegion, PageRegion> PageAllocator::allocate_pages(unsigned int num_pages, pine::PageAlignmentLevel alignment, Backing backing)
+Pair<PageRegion, PageRegion> PageAllocator::allocate_pages(unsigned int num_pages, pine::PageAlignmentLevel alignment, Backing backing, MemoryType memory_type)
 {
     auto [phys_alloc, virt_alloc] = try_reserve_page_unrecorded(num_pages, alignment, backing);
     if (!phys_alloc)
@@ -282,9 +692,10 @@ Pair<PageRegion, PageRegion> PageAllocator::allocate_pages(unsigned int num_page
     auto phys_region = PageRegion::from_ptr(phys_alloc.ptr, phys_alloc.size);
     auto virt_region = PageRegion::from_ptr(virt_alloc.ptr, virt_alloc.size);
 
-    if (!try_record_page_in_l1(phys_region, virt_region)) {
+    if (!try_record_page_in_l1(phys_region, virt_region, memory_type)) {
         m_physical_page_allocator->free(phys_alloc);
-        m_virtual_page_allocator->free(phys_alloc);
+        m_virtual_page_allocator->free(virt_alloc);
+        return {};
     }
 
     return { phys_region, virt_region };
@@ -344,7 +755,7 @@ Pair<pine::Allocation, pine::Allocation> PageAllocator::try_reserve_region_unrec
     return { phys_alloc, virt_alloc };
 }
 
-bool PageAllocator::try_record_section_in_l1(SectionRegion phys_region, SectionRegion virt_region)
+bool PageAllocator::try_record_section_in_l1(SectionRegion phys_region, SectionRegion virt_region, MemoryType memory_type)
 {
     if (phys_region.length != virt_region.length)
         return false;  // FIXME: Assert?
@@ -362,14 +773,16 @@ bool PageAllocator::try_record_section_in_l1(SectionRegion phys_region, SectionR
                   "\n", *m_virtual_page_allocator, "\n", *m_l1_table);
             return false;
         case L1Type::Fault:
-            l1_entry = Section(PhysicalAddress(phys_ptr));
+            l1_entry = Section(PhysicalAddress(phys_ptr), memory_type);
             break;
         }
     }
+    // Make the new entries visible to the table walker
+    pine::DataBarrier::sync();
     return true;
 }
 
-bool PageAllocator::try_record_page_in_l1(PageRegion phys_region, PageRegion virt_region, void* l2_backing)
+bool PageAllocator::try_record_page_in_l1(PageRegion phys_region, PageRegion virt_region, MemoryType memory_type, void* l2_backing)
 {
     unsigned num_l1_entries_to_walk = pine::divide_up(virt_region.size(), L1Entry::vm_size);
     constexpr unsigned num_l2_tables = L2Table::num_entries;
@@ -411,7 +824,7 @@ bool PageAllocator::try_record_page_in_l1(PageRegion phys_region, PageRegion vir
             auto& l2_entry = maybe_l2_table->retrieve_entry(virt_ptr);
             switch (l2_entry.type()) {
             case L2Type::Fault:
-                l2_entry = Page(PhysicalAddress(phys_ptr));
+                l2_entry = Page(PhysicalAddress(phys_ptr), memory_type);
                 break;
             default:
                 panic("Tried to record page that was already recorded:", virt_ptr, *m_physical_page_allocator, "\n", *m_virtual_page_allocator, "\n", *m_l1_table);
@@ -419,6 +832,7 @@ bool PageAllocator::try_record_page_in_l1(PageRegion phys_region, PageRegion vir
             }
         }
     }
+    pine::DataBarrier::sync();
     return true;
 }
 
@@ -435,7 +849,7 @@ pine::Allocation PageAllocator::try_reserve_l2_table_entry()
 
     auto region = PageRegion::from_ptr(alloc.ptr, alloc.size);
     // Should always succeed since we have a backing
-    PANIC_IF(!try_record_page_in_l1(region, region, m_spare_free_l2_page));
+    PANIC_IF(!try_record_page_in_l1(region, region, MemoryType::Normal, m_spare_free_l2_page));
 
     m_l2_table_allocator.add(alloc.ptr, alloc.size);
 
@@ -446,5 +860,39 @@ pine::Allocation PageAllocator::try_reserve_l2_table_entry()
     return alloc;
 }
 
+L1Table* try_create_task_tables()
+{
+    return g_page_allocator.try_create_task_tables();
 }
 
+void destroy_task_tables(L1Table& l1_table)
+{
+    g_page_allocator.destroy_task_tables(l1_table);
+}
+
+void switch_task_tables(L1Table& l1_table)
+{
+    set_task_l1_table(&l1_table);
+}
+
+void switch_kernel_tables()
+{
+    set_task_l1_table(nullptr);
+}
+
+bool try_back_page(L1Table& l1_table, PtrData virt_addr)
+{
+    return g_page_allocator.try_back_page(l1_table, virt_addr);
+}
+
+bool try_copy_on_write(L1Table& l1_table, PtrData virt_addr)
+{
+    return g_page_allocator.try_copy_on_write(l1_table, virt_addr);
+}
+
+bool try_share_pages(L1Table& from, L1Table& to, PageRegion virt_region)
+{
+    return g_page_allocator.try_share_pages(from, to, virt_region);
+}
+
+}
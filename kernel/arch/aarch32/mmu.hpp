@@ -9,7 +9,16 @@
 #include <pine/bit.hpp>
 
 #define DEVICES_START 0x3C000000
+#define PERIPHERALS_START 0x3F000000  // Below is VideoCore memory (framebuffer)
 #define DEVICES_END 0x40000000
+// BCM2836 per-core timers and mailboxes; only 256KiB, but mapped as a section
+#define LOCAL_PERIPHERALS_START 0x40000000
+#define LOCAL_PERIPHERALS_END 0x40100000
+// Each task's own, mapped a page at a time; see kernel/demand_paging.hpp.
+// The kernel's L1Table covers everything below (TTBR0) and the task's the
+// rest (TTBR1), so the kernel's entries are never copied between tables
+#define DEMAND_PAGED_START 0x80000000
+#define DEMAND_PAGED_END 0xC0000000
 #define PHYSICAL_MEMORY_END_PAGES 131072
 #define MEMORY_END_PAGES 1048576  // 2^32 / PageSize
 
@@ -40,16 +49,15 @@ private:
     struct L1Tag {};
     struct L2Tag {};
     VirtualAddress(L1Tag, u32 index)
-        : m_as(As{0, 0, index, 0}) {};
+        : m_as(As{0, 0, index}) {};
     VirtualAddress(L2Tag, u32 index)
-        : m_as(As{0, index, 0, 0}) {};
+        : m_as(As{0, index, 0}) {};
 
     // See Figure B3-11 Small page address translation in ARMv7 Reference Manual
     struct As {
         u32 _ : 12;
         u32 l2_table_index : 8;
-        u32 l1_table_index : 10;
-        u32 __ : 2;
+        u32 l1_table_index : 12;
     };
     union {
         As m_as;
@@ -113,6 +121,45 @@ static_assert(sizeof(PhysicalAddress) == sizeof(PtrData));
 
 namespace mmu {
 
+enum class MemoryType {
+    Normal,          // Write-back, write-allocate; RAM
+    Device,          // Shareable device; peripherals
+    WriteCombining,  // Normal, non-cacheable; memory shared with the GPU
+    StronglyOrdered,
+};
+
+/*
+ * The TEX[2:0], C, B and S bits for a MemoryType, with TEX remap disabled.
+ *
+ * See Table B3-10 in the ARMv7 Reference Manual.
+ */
+struct MemoryAttributes {
+    u32 tex;
+    u32 c;
+    u32 b;
+    u32 s;
+};
+
+constexpr MemoryAttributes memory_attributes(MemoryType type)
+{
+    switch (type) {
+    case MemoryType::Normal:
+        return { 0b001, 1, 1, 1 };
+    case MemoryType::Device:
+        return { 0b000, 0, 1, 0 };  // always shareable
+    case MemoryType::WriteCombining:
+        return { 0b001, 0, 0, 1 };
+    case MemoryType::StronglyOrdered:
+        break;
+    }
+    return { 0b000, 0, 0, 0 };
+}
+
+enum class Permissions {
+    ReadWrite,  // Read/write at PL1 and PL0
+    ReadOnly,   // Read-only at PL1 and PL0
+};
+
 enum class L1Type : u32 {
     Fault = 0,
     L2Ptr = 1,
@@ -152,24 +199,25 @@ struct HugePage {
 };
 
 struct Page {
-    Page(PhysicalAddress addr)
+    Page(PhysicalAddress addr, MemoryType memory_type = MemoryType::Normal, Permissions permissions = Permissions::ReadWrite)
         : type(L2Type::Page)
-        , b(0)
-        , c(0)
+        , b(memory_attributes(memory_type).b)
+        , c(memory_attributes(memory_type).c)
         , ap(0b11)
-        , sbz(0)
-        , apx(0)
-        , s(0)
+        , tex(memory_attributes(memory_type).tex)
+        , apx(permissions == Permissions::ReadOnly)
+        , s(memory_attributes(memory_type).s)
         , nG(0)
         , base_addr(addr.l2_base_addr()) {};
 
     PhysicalAddress physical_address() const { return PhysicalAddress::from_l2_base_addr(base_addr); }
+    bool is_writable() const { return apx == 0; }
 
     L2Type type : 2;
     u32 b : 1;
     u32 c : 1;
     u32 ap : 2;
-    u32 sbz : 3;
+    u32 tex : 3;
     u32 apx : 1;
     u32 s : 1;
     u32 nG : 1;
@@ -200,13 +248,23 @@ union L2Entry {
     Page as_page;
 };
 
-struct L2Table {
+// L2Ptr only holds bits [31:10] of the table address
+struct alignas(KiB) L2Table {
     L2Table() = default;
 
     static constexpr auto num_entries = 256;
 
     L2Entry& retrieve_entry(VirtualAddress virt_addr) { return m_entries[virt_addr.l2_index()]; };
 
+    bool is_empty() const
+    {
+        for (auto& entry : m_entries) {
+            if (entry.type() != L2Type::Fault)
+                return false;
+        }
+        return true;
+    }
+
     friend void print_with(pine::Printer&, const L2Table&);
 
 private:
@@ -249,17 +307,17 @@ struct L1Fault {
 
 
 struct Section {
-    Section(PhysicalAddress addr)
+    Section(PhysicalAddress addr, MemoryType memory_type = MemoryType::Normal)
         : type(L1Type::Section)
-        , b(0)
-        , c(0)
+        , b(memory_attributes(memory_type).b)
+        , c(memory_attributes(memory_type).c)
         , xn(0)
         , domain(0)
         , p(0)
         , ap(0b11)
-        , tex(0)
+        , tex(memory_attributes(memory_type).tex)
         , apx(0)
-        , s(0)
+        , s(memory_attributes(memory_type).s)
         , nG(0)
         , _(0)
         , sbz(0)
@@ -336,10 +394,12 @@ union L1Entry {
     SuperSection as_super_section;
 };
 
-struct L1Table {
+// Indexed by the whole address, though with TTBCR.N = 1 the kernel's only
+// uses the lower half and a task's only the upper half
+struct alignas(16 * KiB) L1Table {
     L1Table() = default;
 
-    static constexpr auto num_entries = 1024;
+    static constexpr auto num_entries = 4096;
 
     L1Entry& retrieve_entry(VirtualAddress virt_addr) { return m_entries[virt_addr.l1_index()]; };
 
@@ -352,6 +412,7 @@ private:
 #pragma GCC diagnostic pop
 
 extern "C" void init_page_tables(PtrData code_end);
+extern "C" void init_secondary_page_tables(PtrData code_end);
 
 void set_l1_table(L1Table& l1_addr);
 
@@ -376,17 +437,40 @@ public:
     }
 
     pine::Allocation allocate(size_t);
-    Pair<PageRegion, PageRegion> reserve_region(PageRegion, Backing = Backing::Mixed);
-    Pair<SectionRegion, SectionRegion> reserve_section_region(SectionRegion , Backing = Backing::Mixed);
-    Pair<PageRegion, PageRegion> allocate_pages(unsigned num_pages, pine::PageAlignmentLevel = pine::PageAlignmentLevel::Page, Backing = Backing::Mixed);
+    Pair<PageRegion, PageRegion> reserve_region(PageRegion, Backing = Backing::Mixed, MemoryType = MemoryType::Normal);
+    Pair<SectionRegion, SectionRegion> reserve_section_region(SectionRegion , Backing = Backing::Mixed, MemoryType = MemoryType::Normal);
+    Pair<PageRegion, PageRegion> allocate_pages(unsigned num_pages, pine::PageAlignmentLevel = pine::PageAlignmentLevel::Page, Backing = Backing::Mixed, MemoryType = MemoryType::Normal);
     void free(pine::Allocation);
 
+    /*
+     * Zeroes a free page ahead of time so that allocate() does not have to;
+     * meant for when there is nothing better to do. Returns false when the
+     * pool of zeroed pages is full or we are out of memory.
+     */
+    bool try_zero_free_page();
+
+    // For demand paging; see kernel/demand_paging.hpp
+    L1Table* try_create_task_tables();
+    void destroy_task_tables(L1Table&);
+    bool try_back_page(L1Table&, PtrData virt_addr);
+    bool try_copy_on_write(L1Table&, PtrData virt_addr);
+    bool try_share_pages(L1Table& from, L1Table& to, PageRegion virt_region);
+
 private:
     Pair<pine::Allocation, pine::Allocation> try_reserve_page_unrecorded(unsigned num_pages, pine::PageAlignmentLevel, Backing);
     Pair<pine::Allocation, pine::Allocation> try_reserve_region_unrecorded(PageRegion, Backing);
-    bool try_record_page_in_l1(PageRegion phys_region, PageRegion virt_region, void* l2_backing = nullptr);
-    bool try_record_section_in_l1(SectionRegion phys_region, SectionRegion virt_region);
+    bool try_record_page_in_l1(PageRegion phys_region, PageRegion virt_region, MemoryType, void* l2_backing = nullptr);
+    bool try_record_section_in_l1(SectionRegion phys_region, SectionRegion virt_region, MemoryType);
+    template <typename OnUnmapped>
+    void unmap_pages(PageRegion virt_region, OnUnmapped);
+    void unmap_and_free_pages(PageRegion virt_region);
+    void reclaim_l2_table_pages();
+    pine::Allocation try_allocate_zeroed(size_t num_pages);
+    // Gives back the pool of zeroed pages, for when memory runs short
+    void drain_zeroed_pages();
     pine::Allocation try_reserve_l2_table_entry();
+    bool try_map_task_page(L1Table&, PtrData virt_addr, PtrData phys_addr, Permissions);
+    static L2Entry* find_task_page_entry(L1Table&, PtrData virt_addr);
 
     friend void init_page_tables(PtrData);
 
@@ -395,8 +479,21 @@ private:
     L1Table* m_l1_table = nullptr;
     pine::SlabAllocator<L2Table> m_l2_table_allocator {};
     void* m_spare_free_l2_page = nullptr;
+    // Virtual page offsets of zeroed pages, mapped while they wait in the pool
+    pine::Array<size_t, 1024> m_zeroed_pages;
+    size_t m_num_zeroed_pages = 0;
 };
 
 PageAllocator& page_allocator();
 
+L1Table* try_create_task_tables();
+void destroy_task_tables(L1Table&);
+// Makes the tables the calling core's, in place of whatever task's it had
+void switch_task_tables(L1Table&);
+// For kernel tasks, which have no tables of their own
+void switch_kernel_tables();
+bool try_back_page(L1Table&, PtrData virt_addr);
+bool try_copy_on_write(L1Table&, PtrData virt_addr);
+bool try_share_pages(L1Table& from, L1Table& to, PageRegion virt_region);
+
 }
@@ -48,3 +48,24 @@ void print_with(pine::Printer& printer, const ProcessorMode& mode)
 }
 
 
+
+Registers Registers::forked(const SyscallFrame& frame, PtrData kernel_sp)
+{
+    // User mode's SP and LR are still the task's while it is in the syscall
+    u32 user_sp_lr[2];
+    asm volatile("stm %0, {sp, lr}^" ::"r"(user_sp_lr) : "memory");
+
+    Registers registers(user_sp_lr[0], kernel_sp, frame.pc, 0, PrivilegeLevel::Userspace);
+    registers.cpsr = CPSR::from_data(frame.cpsr);
+    registers.user_lr = user_sp_lr[1];
+    registers.r4 = frame.r4_to_r12[0];
+    registers.r5 = frame.r4_to_r12[1];
+    registers.r6 = frame.r4_to_r12[2];
+    registers.r7 = frame.r4_to_r12[3];
+    registers.r8 = frame.r4_to_r12[4];
+    registers.r9 = frame.r4_to_r12[5];
+    registers.r10 = frame.r4_to_r12[6];
+    registers.r11 = frame.r4_to_r12[7];
+    registers.r12 = frame.r4_to_r12[8];
+    return registers;  // r0, the child's return value, is 0
+}
@@ -16,6 +16,85 @@ struct InterruptDisabler {
     }
 };
 
+/*
+ * Like InterruptDisabler, but puts back whatever was masked before rather
+ * than unmasking, so it can nest inside code that runs with interrupts
+ * disabled.
+ */
+struct InterruptSaver {
+    InterruptSaver() __attribute__((always_inline))
+    {
+        asm volatile("mrs %0, cpsr; cpsid i" : "=r"(m_cpsr)::"memory");
+    }
+
+    ~InterruptSaver() __attribute__((always_inline))
+    {
+        // Only the control bits, so the condition flags are left alone
+        asm volatile("msr cpsr_c, %0" ::"r"(m_cpsr) : "memory");
+    }
+
+    InterruptSaver(const InterruptSaver&) = delete;
+    InterruptSaver(InterruptSaver&&) = delete;
+
+private:
+    u32 m_cpsr;
+};
+
+/*
+ * Puts the processor in a low power state until the next interrupt.
+ */
+inline void wait_for_interrupt()
+{
+    asm volatile("wfi" ::: "memory");
+}
+
+/*
+ * Wakes any cores waiting in a WFE, such as the secondary cores before they
+ * are started; see smp_start_secondary_cores().
+ */
+inline void send_event()
+{
+    asm volatile("dsb sy; sev" ::: "memory");
+}
+
+/*
+ * Starts the calling core's PMU cycle counter, for benchmarks. It is only 32
+ * bits, so it wraps after a few seconds; only measure shorter than that.
+ */
+inline void enable_cycle_counter()
+{
+    // PMCR.E enables the counters, and PMCNTENSET bit 31 the cycle counter
+    u32 control;
+    asm volatile("mrc p15, 0, %0, c9, c12, 0" : "=r"(control));
+    asm volatile("mcr p15, 0, %0, c9, c12, 0; mcr p15, 0, %1, c9, c12, 1; isb" ::"r"(control | 1), "r"(1u << 31) : "memory");
+}
+
+inline u32 cycle_count()
+{
+    u32 count;
+    asm volatile("isb; mrc p15, 0, %0, c9, c13, 0" : "=r"(count)::"memory");
+    return count;
+}
+
+/*
+ * Tells the processor we are busy waiting on another core.
+ */
+inline void spin_loop_hint()
+{
+    asm volatile("yield" ::: "memory");
+}
+
+/*
+ * The core we are running on; 0 is the boot core.
+ */
+inline unsigned core_id()
+{
+    u32 mpidr;
+    // See 4.3.5 in ARM Cortex-A7 MPCore Technical Reference
+    asm volatile("mrc p15, 0, %0, c0, c0, 5" : "=r"(mpidr));
+    return static_cast<unsigned>(mpidr & 0x3);
+}
+
 enum class ProcessorMode : u32 {
     User = 0b10000,
     FIQ = 0b10001,
@@ -117,6 +196,30 @@ private:
     friend constexpr To pine::bit_cast(From);
 };
 
+/*
+ * What a task had when it made a syscall, other than what the C calling
+ * convention lets the syscall clobber; see swi_wrap in vector.S and
+ * Registers::forked().
+ */
+struct SyscallFrame {
+    u32 r4_to_r12[9];
+    u32 pc;  // The PC to return to
+    u32 cpsr;
+};
+
+/*
+ * What task_switch() saves of a task it switches away from: only what a
+ * function call preserves, since it is called from C; see switch.S.
+ */
+struct SwitchedRegisters {
+    u32 r4_to_r11[8];
+    u32 sp;
+    u32 lr;
+    u32 cpsr;
+    u32 user_sp;  // User mode's SP and LR, which aren't banked by task
+    u32 user_lr;
+};
+
 struct Registers {
     explicit Registers(u32 user_sp, u32 kernel_sp, u32 user_pc, PtrData stop_addr, PrivilegeLevel level)
         : cpsr(level == PrivilegeLevel::Kernel ? ProcessorMode::Supervisor : ProcessorMode::User)
@@ -137,7 +240,13 @@ struct Registers {
         , r10(0)
         , r11(0)
         , r12(0)
-        , pc(user_pc) {};
+        , pc(user_pc)
+        , is_switched_out(0)
+        , switched {} {};
+
+    // Those of a new task that returns from the running task's syscall
+    // with 0, as a copy of it; see fork()
+    static Registers forked(const SyscallFrame&, PtrData kernel_sp);
 
     bool is_kernel_registers() const { return user_sp == kernel_sp; };
 
@@ -160,4 +269,11 @@ struct Registers {
     u32 r11;
     u32 r12;
     u32 pc;     // The PC to return to (either user or kernel, depending on if starting a task)
+    // Whether it has been switched away from, so it resumes from switched
+    u32 is_switched_out;
+    SwitchedRegisters switched;
 };
+
+// Used by switch.S
+static_assert(offsetof(Registers, is_switched_out) == 76);
+static_assert(offsetof(Registers, switched) == 80);
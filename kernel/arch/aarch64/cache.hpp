@@ -0,0 +1,55 @@
+#pragma once
+#include "barrier.hpp"
+
+#include <pine/twomath.hpp>
+#include <pine/types.hpp>
+
+namespace pine {
+
+/*
+ * Data cache maintenance by virtual address, to the point of coherency.
+ *
+ * Other bus masters (namely the VideoCore GPU behind the mailbox) do not snoop
+ * our caches, so memory shared with them must be cleaned before they read it
+ * and invalidated before we read what they wrote.
+ */
+class DataCache {
+public:
+    static size_t line_size() __attribute__((always_inline))
+    {
+        // See D13.2.34 in the ARMv8 reference manual; DminLine is log2 words
+        u64 ctr;
+        asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+        return 4u << ((ctr >> 16) & 0xf);
+    }
+
+    static void clean(const void* ptr, size_t size)
+    {
+        for_each_line(ptr, size, [](PtrData line) { asm volatile("dc cvac, %0" ::"r"(line) : "memory"); });
+    }
+
+    static void invalidate(const void* ptr, size_t size)
+    {
+        for_each_line(ptr, size, [](PtrData line) { asm volatile("dc ivac, %0" ::"r"(line) : "memory"); });
+    }
+
+    static void clean_and_invalidate(const void* ptr, size_t size)
+    {
+        for_each_line(ptr, size, [](PtrData line) { asm volatile("dc civac, %0" ::"r"(line) : "memory"); });
+    }
+
+private:
+    template <typename Operation>
+    static void for_each_line(const void* ptr, size_t size, Operation operation)
+    {
+        auto line = line_size();
+        auto start = align_down_two(reinterpret_cast<PtrData>(ptr), line);
+        auto end = reinterpret_cast<PtrData>(ptr) + size;
+        for (; start < end; start += line)
+            operation(start);
+
+        asm volatile("dsb sy" ::: "memory");
+    }
+};
+
+}
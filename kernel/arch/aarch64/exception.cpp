@@ -1,7 +1,10 @@
 #include "exception.hpp"
+#include "../../demand_paging.hpp"
 #include "../../device/interrupts.hpp"
 #include "../../interrupt_disabler.hpp"
+#include "../../smp.hpp"
 #include "../../syscall.hpp"
+#include "../../tasks.hpp"
 #include "panic.hpp"
 
 void data_abort_handler(const ExceptionSavedRegisters& registers)
@@ -10,6 +13,25 @@ void data_abort_handler(const ExceptionSavedRegisters& registers)
     panic("\033[31mData abort! halting.\033[0m\n\n", registers);
 }
 
+// Whether it was a translation fault, or a permission fault on a write, that
+// is now fixed, so the access can be retried; see demand_paging.hpp
+static bool try_handle_page_fault(ESR_EL1 esr)
+{
+    // DFSC (ISS[5:0]) of 0b0001xx or 0b0011xx and WnR (ISS[6]); see D17.2.40
+    // in the ARMv8 Reference Manual
+    PageFault fault;
+    if ((esr.iss & 0b111100) == 0b000100)
+        fault = PageFault::NotMapped;
+    else if ((esr.iss & 0b1111100) == 0b1001100)
+        fault = PageFault::Write;
+    else
+        return false;
+
+    PtrData fault_addr;
+    asm volatile("mrs %0, far_el1" : "=r"(fault_addr));
+    return handle_page_fault(fault_addr, fault);
+}
+
 void undefined_instruction_handler(const ExceptionSavedRegisters& registers)
 {
     panic("\033[31mUndefined instruction! halting.\033[0m\n\n", registers);
@@ -39,6 +61,7 @@ extern "C" {
 
 void synchronous_userspace_handler(PtrData call, PtrData arg1, PtrData arg2, PtrData arg3, ExceptionSavedRegisters& registers)
 {
+    KernelLocker locker;
     ESR_EL1 esr {};
     asm volatile("mrs %0, esr_el1" : "=r"(esr));
 
@@ -47,11 +70,17 @@ void synchronous_userspace_handler(PtrData call, PtrData arg1, PtrData arg2, Ptr
         unknown_reason_handler(registers);
         break;
     case ExceptionClass::SIMDException:
+        // Most likely the first use since the task was switched to, which
+        // is retried once its registers are loaded; see fp.hpp. Interrupts
+        // are disabled in exception handlers
+        if (!task_manager().handle_fp_trap(InterruptsDisabledTag::promise()))
+            fp_or_simd_exception_handler(registers);
+        break;
     case ExceptionClass::FPException:
         fp_or_simd_exception_handler(registers);
         break;
     case ExceptionClass::SVC: {
-        auto return_value = handle_syscall(call, arg1, arg2, arg3);
+        auto return_value = handle_syscall(call, arg1, arg2, arg3, registers);
         registers.xn[0] = return_value;  // x0
         break;
     }
@@ -61,7 +90,8 @@ void synchronous_userspace_handler(PtrData call, PtrData arg1, PtrData arg2, Ptr
         break;
     case ExceptionClass::DataAbortEL0:
     case ExceptionClass::DataAbort:
-        data_abort_handler(registers);
+        if (!try_handle_page_fault(esr))
+            data_abort_handler(registers);
         break;
     case ExceptionClass::SError:
         serror_handler(registers);
@@ -92,9 +122,13 @@ void synchronous_kernel_handler(const ExceptionSavedRegisters& registers)
         undefined_instruction_handler(registers);
         break;
     case ExceptionClass::DataAbortEL0:
-    case ExceptionClass::DataAbort:
-        data_abort_handler(registers);
+    case ExceptionClass::DataAbort: {
+        // Syscalls touch task memory that may not be backed yet
+        KernelLocker locker;
+        if (!try_handle_page_fault(esr))
+            data_abort_handler(registers);
         break;
+    }
     case ExceptionClass::SError:
         serror_handler(registers);
         break;
@@ -105,6 +139,7 @@ void synchronous_kernel_handler(const ExceptionSavedRegisters& registers)
 
 void irq_handler()
 {
+    KernelLocker locker;
     interrupts_handle_irq(InterruptsDisabledTag::promise());
 }
 
@@ -0,0 +1,26 @@
+#pragma once
+#include <pine/types.hpp>
+
+/*
+ * What a task has in the FP/SIMD registers, for the tasks that use them; see
+ * kernel/fp.hpp.
+ */
+struct FPRegisters {
+    u64 vn[32][2];  // the 128-bit V registers, low half first
+    u64 fpcr;
+    u64 fpsr;
+};
+
+// Used by fp.S
+static_assert(offsetof(FPRegisters, fpcr) == 512);
+
+extern "C" {
+// In fp.S; the kernel itself is built without FP/SIMD, so only these touch them
+// Sets up the calling core with EL0 trapping on FP/SIMD instructions
+void fp_init_core();
+// Whether EL0 traps on them; EL1 can always use them
+void fp_enable();
+void fp_disable();
+void fp_save(FPRegisters*);
+void fp_restore(const FPRegisters*);
+}
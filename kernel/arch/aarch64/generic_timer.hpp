@@ -0,0 +1,41 @@
+#pragma once
+
+#include <pine/types.hpp>
+
+/*
+ * The virtual timer of the calling core's ARM generic timer. The counter
+ * counts up at frequency() and never wraps in practice; the timer fires (and
+ * keeps firing) once the counter reaches the compare value.
+ *
+ * See D11.2 in the ARMv8 reference manual.
+ */
+struct GenericTimer {
+    // CNTV_CTL_EL0 bits
+    static constexpr u64 enable = 1 << 0;
+    static constexpr u64 interrupt_masked = 1 << 1;
+
+    static u32 frequency() __attribute__((always_inline))
+    {
+        u64 frequency;
+        asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+        return static_cast<u32>(frequency);
+    }
+
+    static u64 count() __attribute__((always_inline))
+    {
+        // Without the isb, the read may happen out of order with earlier instructions
+        u64 count;
+        asm volatile("isb; mrs %0, cntvct_el0" : "=r"(count)::"memory");
+        return count;
+    }
+
+    static void set_compare(u64 count) __attribute__((always_inline))
+    {
+        asm volatile("msr cntv_cval_el0, %0; isb" ::"r"(count) : "memory");
+    }
+
+    static void set_control(u64 control) __attribute__((always_inline))
+    {
+        asm volatile("msr cntv_ctl_el0, %0; isb" ::"r"(control) : "memory");
+    }
+};
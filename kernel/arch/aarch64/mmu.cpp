@@ -0,0 +1,453 @@
+#include "mmu.hpp"
+#include "../../arch/panic.hpp"
+#include "../../arch/barrier.hpp"
+
+#include <pine/c_builtins.hpp>
+#include <pine/twomath.hpp>
+#include <pine/page.hpp>
+
+// Enough for the L1Table, the L2Tables for the RAM/device and local
+// peripheral gigabytes and the L3Tables for the unaligned kernel image edges
+constexpr unsigned c_num_boot_tables = 8;
+
+namespace mmu {
+
+static PageMapper g_page_mapper;  // dummy; ctor not called
+alignas(PageSize) static u8 g_boot_tables[c_num_boot_tables * PageSize];
+
+PageMapper& page_mapper()
+{
+    return g_page_mapper;
+}
+
+pine::Allocation KernelPageAllocator::allocate(size_t size)
+{
+    if (size > PageSize)
+        return {};
+
+    auto page_addr = g_page_mapper.try_allocate_kernel_page();
+    return { reinterpret_cast<void*>(page_addr), page_addr ? PageSize : 0 };
+}
+
+void KernelPageAllocator::free(pine::Allocation allocation)
+{
+    g_page_mapper.free_kernel_page(reinterpret_cast<PtrData>(allocation.ptr));
+}
+
+KernelPageAllocator& kernel_page_allocator()
+{
+    static KernelPageAllocator g_kernel_page_allocator;
+    return g_kernel_page_allocator;
+}
+
+extern "C" {
+
+void init_page_tables(PtrData text_end, PtrData code_end)
+{
+    extern char __code_start[];
+    auto code_start = reinterpret_cast<PtrData>(__code_start);
+
+    PageRegion boot_tables_region = PageRegion::from_ptr(g_boot_tables, sizeof(g_boot_tables));
+    auto [l1_region, scratch_region] = boot_tables_region.split_left(1);
+
+    // The rest of the RAM (past the kernel heap) backs demand paged memory
+    auto heap_end = pine::align_up_two(code_end, PageSize) + KernelHeapSize;
+    PANIC_IF(heap_end > DEVICES_START);
+    auto pool_region = PageRegion::from_range(heap_end, DEVICES_START);
+
+    auto& l1 = *new (static_cast<L1Table*>(l1_region.ptr())) L1Table();
+    g_page_mapper.init(l1, scratch_region, pool_region);
+
+    // Kernel stacks live below the code; see setup_stacks
+    auto stack_region = PageRegion::from_range(0, code_start);
+    // Userspace runs out of the kernel image at EL0, so text must be
+    // executable at both levels (and therefore read-only; EL0 writable memory
+    // is never executable at EL1)
+    auto text_region = PageRegion::from_range(code_start, text_end);
+    auto ram_region = PageRegion::from_range(text_end, DEVICES_START);
+    auto gpu_region = PageRegion::from_range(DEVICES_START, PERIPHERALS_START);
+    auto peripheral_region = PageRegion::from_range(PERIPHERALS_START, DEVICES_END);
+    auto local_peripheral_region = PageRegion::from_range(LOCAL_PERIPHERALS_START, LOCAL_PERIPHERALS_END);
+
+    // Everything is identity mapped; see also code_end for where the kernel
+    // heap starts
+    PANIC_IF(code_end > DEVICES_START);
+    bool mapped = g_page_mapper.map(stack_region, 0, MemoryType::WriteBack, Permissions::ReadWrite);
+    mapped &= g_page_mapper.map(text_region, code_start, MemoryType::WriteBack, Permissions::ReadExecute);
+    mapped &= g_page_mapper.map(ram_region, text_end, MemoryType::WriteBack, Permissions::ReadWrite);
+    mapped &= g_page_mapper.map(gpu_region, DEVICES_START, MemoryType::WriteCombining, Permissions::ReadWrite);
+    mapped &= g_page_mapper.map(peripheral_region, PERIPHERALS_START, MemoryType::Device, Permissions::ReadWrite);
+    mapped &= g_page_mapper.map(local_peripheral_region, LOCAL_PERIPHERALS_START, MemoryType::Device, Permissions::ReadWrite);
+    PANIC_MESSAGE_IF(!mapped, "Ran out of boot translation tables!");
+
+    set_translation_table(l1);
+}
+
+void init_secondary_page_tables()
+{
+    // The L1Table comes first; see init_page_tables()
+    set_translation_table(*reinterpret_cast<L1Table*>(g_boot_tables));
+}
+}
+
+void PhysicalPagePool::init(PageRegion region)
+{
+    // The reference counts come out of the pool itself; they are only ever
+    // read for pages that were handed out, so they need no initializing
+    auto num_count_pages = pine::divide_up(region.length * sizeof(u16), PageSize);
+    auto [count_region, page_region] = region.split_left(num_count_pages);
+
+    m_free_pages = nullptr;
+    m_untouched_pages = page_region;
+    m_ref_counts = static_cast<u16*>(count_region.ptr());
+    m_first_page = page_region.offset;
+}
+
+u16& PhysicalPagePool::ref_count_of(PtrData page_addr) const
+{
+    return m_ref_counts[page_addr / PageSize - m_first_page];
+}
+
+PtrData PhysicalPagePool::allocate()
+{
+    PtrData page_addr;
+    if (m_free_pages) {
+        auto* page = m_free_pages;
+        m_free_pages = reinterpret_cast<PtrData*>(*page);
+        page_addr = reinterpret_cast<PtrData>(page);
+    }
+    else {
+        if (!m_untouched_pages)
+            return 0;
+
+        auto [page, rest] = m_untouched_pages.split_left(1);
+        m_untouched_pages = rest;
+        page_addr = reinterpret_cast<PtrData>(page.ptr());
+    }
+
+    ref_count_of(page_addr) = 1;
+    return page_addr;
+}
+
+void PhysicalPagePool::ref(PtrData page_addr)
+{
+    ++ref_count_of(page_addr);
+}
+
+void PhysicalPagePool::unref(PtrData page_addr)
+{
+    if (--ref_count_of(page_addr) > 0)
+        return;
+
+    auto* page = reinterpret_cast<PtrData*>(page_addr);
+    *page = reinterpret_cast<PtrData>(m_free_pages);
+    m_free_pages = page;
+}
+
+u16 PhysicalPagePool::ref_count(PtrData page_addr) const
+{
+    return ref_count_of(page_addr);
+}
+
+void PageMapper::init(L1Table& l1_table, PageRegion scratch_region, PageRegion pool_region)
+{
+    m_l1_table = &l1_table;
+    m_table_allocator.add(scratch_region.ptr(), scratch_region.size());
+    m_page_pool.init(pool_region);
+}
+
+template <unsigned Level>
+TranslationTable<Level + 1>* PageMapper::try_walk(TranslationTable<Level>& table, VirtualAddress virt_addr, bool is_task_table)
+{
+    using NextTable = TranslationTable<Level + 1>;
+
+    auto& entry = table.retrieve_entry(virt_addr);
+    switch (entry.type()) {
+    case DescriptorType::TableOrPage:
+        return reinterpret_cast<NextTable*>(entry.as_table.table_address());
+
+    case DescriptorType::Block:
+        panic("Tried to map over an existing block!");
+        return nullptr;
+
+    case DescriptorType::Fault:
+        break;
+    }
+
+    void* table_ptr = nullptr;
+    if (!is_task_table)
+        table_ptr = m_table_allocator.allocate(sizeof(NextTable)).ptr;
+    if (!table_ptr)
+        table_ptr = reinterpret_cast<void*>(m_page_pool.allocate());
+    if (!table_ptr)
+        return nullptr;
+
+    auto* next_table = new (static_cast<NextTable*>(table_ptr)) NextTable();
+    entry = TableDescriptor(reinterpret_cast<PtrData>(next_table));
+    return next_table;
+}
+
+bool PageMapper::map(PageRegion virt_region, PtrData phys_addr, MemoryType memory_type, Permissions permissions)
+{
+    return map(*m_l1_table, virt_region, phys_addr, memory_type, permissions);
+}
+
+bool PageMapper::map(L1Table& l1_table, PageRegion virt_region, PtrData phys_addr, MemoryType memory_type, Permissions permissions)
+{
+    auto virt_addr = reinterpret_cast<PtrData>(virt_region.ptr());
+    auto virt_end = reinterpret_cast<PtrData>(virt_region.end_ptr());
+    bool is_task_table = &l1_table != m_l1_table;
+
+    while (virt_addr < virt_end) {
+        auto* l2_table = try_walk(l1_table, virt_addr, is_task_table);
+        if (!l2_table)
+            return false;
+
+        // Prefer 2MiB blocks: fewer tables and fewer TLB entries
+        bool can_use_block = pine::is_aligned_two(virt_addr, L2Table::vm_size)
+            && pine::is_aligned_two(phys_addr, L2Table::vm_size)
+            && virt_end - virt_addr >= L2Table::vm_size;
+        if (can_use_block) {
+            l2_table->retrieve_entry(virt_addr) = BlockDescriptor(DescriptorType::Block, phys_addr, memory_type, permissions);
+            virt_addr += L2Table::vm_size;
+            phys_addr += L2Table::vm_size;
+            continue;
+        }
+
+        auto* l3_table = try_walk(*l2_table, virt_addr, is_task_table);
+        if (!l3_table)
+            return false;
+
+        l3_table->retrieve_entry(virt_addr) = BlockDescriptor(DescriptorType::TableOrPage, phys_addr, memory_type, permissions);
+        virt_addr += L3Table::vm_size;
+        phys_addr += L3Table::vm_size;
+    }
+
+    return true;
+}
+
+Entry* PageMapper::find_page_entry(L1Table& l1_table, VirtualAddress virt_addr)
+{
+    auto& l1_entry = l1_table.retrieve_entry(virt_addr);
+    if (l1_entry.type() != DescriptorType::TableOrPage)
+        return nullptr;
+
+    auto& l2_table = *reinterpret_cast<L2Table*>(l1_entry.as_table.table_address());
+    auto& l2_entry = l2_table.retrieve_entry(virt_addr);
+    if (l2_entry.type() != DescriptorType::TableOrPage)
+        return nullptr;
+
+    auto& l3_table = *reinterpret_cast<L3Table*>(l2_entry.as_table.table_address());
+    auto& l3_entry = l3_table.retrieve_entry(virt_addr);
+    if (l3_entry.type() != DescriptorType::TableOrPage)
+        return nullptr;
+
+    return &l3_entry;
+}
+
+static void invalidate_tlb_page(PtrData virt_addr)
+{
+    // See D5.10.2 in the ARMv8 Reference Manual; every core must have
+    // dropped the old entry before its page can be handed out again
+    asm volatile("dsb ishst; tlbi vaae1is, %0; dsb ish; isb" ::"r"(virt_addr >> 12) : "memory");
+}
+
+static void invalidate_tlb()
+{
+    asm volatile("dsb ishst; tlbi vmalle1is; dsb ish; isb" ::: "memory");
+}
+
+static constexpr auto task_page_type = MemoryType::WriteBack;
+
+L1Table* PageMapper::try_create_task_tables()
+{
+    auto l1_addr = m_page_pool.allocate();
+    if (!l1_addr)
+        return nullptr;
+
+    // Nothing is mapped in the window by the kernel's, so only the task's
+    // own tables will be there
+    return new (reinterpret_cast<L1Table*>(l1_addr)) L1Table(*m_l1_table);
+}
+
+void PageMapper::destroy_task_tables(L1Table& l1_table)
+{
+    if (&mmu::l1_table() == &l1_table)
+        switch_kernel_tables();
+
+    for (PtrData l1_addr = DEMAND_PAGED_START; l1_addr < DEMAND_PAGED_END; l1_addr += L1Table::vm_size) {
+        auto& l1_entry = l1_table.retrieve_entry(l1_addr);
+        if (l1_entry.type() != DescriptorType::TableOrPage)
+            continue;
+
+        auto l2_table_addr = l1_entry.as_table.table_address();
+        auto& l2_table = *reinterpret_cast<L2Table*>(l2_table_addr);
+        for (PtrData l2_addr = l1_addr; l2_addr < l1_addr + L1Table::vm_size; l2_addr += L2Table::vm_size) {
+            auto& l2_entry = l2_table.retrieve_entry(l2_addr);
+            if (l2_entry.type() != DescriptorType::TableOrPage)
+                continue;
+
+            auto l3_table_addr = l2_entry.as_table.table_address();
+            auto& l3_table = *reinterpret_cast<L3Table*>(l3_table_addr);
+            for (PtrData l3_addr = l2_addr; l3_addr < l2_addr + L2Table::vm_size; l3_addr += L3Table::vm_size) {
+                auto& l3_entry = l3_table.retrieve_entry(l3_addr);
+                if (l3_entry.type() == DescriptorType::TableOrPage)
+                    m_page_pool.unref(l3_entry.as_block.physical_address());
+            }
+            m_page_pool.unref(l3_table_addr);
+        }
+        m_page_pool.unref(l2_table_addr);
+    }
+
+    // Stale entries may be left in the TLBs of the cores that ran the task
+    invalidate_tlb();
+    m_page_pool.unref(reinterpret_cast<PtrData>(&l1_table));
+}
+
+bool PageMapper::try_back_page(L1Table& l1_table, PtrData virt_addr)
+{
+    auto phys_addr = m_page_pool.allocate();
+    if (!phys_addr)
+        return false;
+
+    // Zeroed through the identity mapping, before anyone can see it
+    bzero(reinterpret_cast<void*>(phys_addr), PageSize);
+    if (!map(l1_table, PageRegion { virt_addr / PageSize, 1 }, phys_addr, task_page_type, Permissions::ReadWrite)) {
+        m_page_pool.unref(phys_addr);
+        return false;
+    }
+
+    // Faulting entries are never cached in the TLB, so there is nothing to
+    // invalidate; the table walker only needs to see the new entry
+    asm volatile("dsb ishst; isb" ::: "memory");
+    return true;
+}
+
+bool PageMapper::try_copy_on_write(L1Table& l1_table, PtrData virt_addr)
+{
+    auto* entry = find_page_entry(l1_table, virt_addr);
+    if (!entry)
+        return false;
+    if (entry->as_block.is_writable())
+        return true;  // already copied; the fault raced with us
+
+    // Once the others have their own copies, the last one can just write
+    auto phys_addr = entry->as_block.physical_address();
+    if (m_page_pool.ref_count(phys_addr) == 1) {
+        *entry = BlockDescriptor(DescriptorType::TableOrPage, phys_addr, task_page_type, Permissions::ReadWrite);
+        invalidate_tlb_page(virt_addr);
+        return true;
+    }
+
+    auto copy_addr = m_page_pool.allocate();
+    if (!copy_addr)
+        return false;
+
+    memcpy(reinterpret_cast<void*>(copy_addr), reinterpret_cast<void*>(phys_addr), PageSize);
+
+    // Break-before-make, since the output address changes (see D5.10.1 in
+    // the ARMv8 Reference Manual); otherwise the old and new entries could
+    // both be in the TLB at once
+    *entry = Entry();
+    invalidate_tlb_page(virt_addr);
+    *entry = BlockDescriptor(DescriptorType::TableOrPage, copy_addr, task_page_type, Permissions::ReadWrite);
+    asm volatile("dsb ishst; isb" ::: "memory");
+    m_page_pool.unref(phys_addr);
+    return true;
+}
+
+bool PageMapper::try_share_pages(L1Table& from, L1Table& to, PageRegion virt_region)
+{
+    bool shared = true;
+    for (size_t offset = 0; offset < virt_region.length; offset++) {
+        auto virt_addr = reinterpret_cast<PtrData>(virt_region.ptr(offset));
+        auto* entry = find_page_entry(from, virt_addr);
+        if (!entry)
+            continue;
+
+        // Both become read-only, so that whichever writes first copies it
+        auto phys_addr = entry->as_block.physical_address();
+        *entry = BlockDescriptor(DescriptorType::TableOrPage, phys_addr, task_page_type, Permissions::ReadOnly);
+        if (!map(to, PageRegion { virt_addr / PageSize, 1 }, phys_addr, task_page_type, Permissions::ReadOnly)) {
+            shared = false;
+            break;
+        }
+        m_page_pool.ref(phys_addr);
+    }
+
+    // The pages were writable in the TLB of the core running the task
+    invalidate_tlb();
+    return shared;
+}
+
+L1Table* try_create_task_tables()
+{
+    return g_page_mapper.try_create_task_tables();
+}
+
+void destroy_task_tables(L1Table& l1_table)
+{
+    g_page_mapper.destroy_task_tables(l1_table);
+}
+
+void switch_task_tables(L1Table& l1_table)
+{
+    // Task pages are global (we don't use ASIDs), so whatever the last task
+    // left in the TLB has to go; only this core's, since no other core can
+    // be running either task
+    asm volatile("msr ttbr0_el1, %0; isb; tlbi vmalle1; dsb nsh; isb" ::"r"(reinterpret_cast<PtrData>(&l1_table)) : "memory");
+}
+
+void switch_kernel_tables()
+{
+    switch_task_tables(g_page_mapper.kernel_tables());
+}
+
+bool try_back_page(L1Table& l1_table, PtrData virt_addr)
+{
+    return g_page_mapper.try_back_page(l1_table, virt_addr);
+}
+
+bool try_copy_on_write(L1Table& l1_table, PtrData virt_addr)
+{
+    return g_page_mapper.try_copy_on_write(l1_table, virt_addr);
+}
+
+bool try_share_pages(L1Table& from, L1Table& to, PageRegion virt_region)
+{
+    return g_page_mapper.try_share_pages(from, to, virt_region);
+}
+
+void set_translation_table(L1Table& l1_table)
+{
+    // See D13.2.97 in ARMv8 Reference Manual; keep in sync with MemoryType
+    constexpr u64 mair = (0x04ull << 0)   // Device-nGnRE
+        | (0x44ull << 8)                  // Normal, Inner/Outer Non-cacheable
+        | (0xffull << 16);                // Normal, Inner/Outer Write-Back Read/Write-Allocate
+
+    // See D13.2.131 in ARMv8 Reference Manual
+    constexpr u64 tcr = (25ull << 0)      // T0SZ: 39-bit (512GiB) address space, starting at L1
+        | (0b01ull << 8)                  // IRGN0: Walks are inner write-back cacheable
+        | (0b01ull << 10)                 // ORGN0: Walks are outer write-back cacheable
+        | (0b11ull << 12)                 // SH0: Walks are inner shareable
+        | (0b00ull << 14)                 // TG0: 4KiB granule
+        | (25ull << 16)                   // T1SZ
+        | (1ull << 23)                    // EPD1: No TTBR1 (upper half) walks
+        | (0b000ull << 32);               // IPS: 32-bit physical addresses
+
+    asm volatile("msr mair_el1, %0" ::"r"(mair));
+    asm volatile("msr tcr_el1, %0" ::"r"(tcr));
+    asm volatile("msr ttbr0_el1, %0" ::"r"(reinterpret_cast<PtrData>(&l1_table)));
+    asm volatile("isb" ::: "memory");
+}
+
+L1Table& l1_table()
+{
+    PtrData ttbr0;
+    asm volatile("mrs %0, ttbr0_el1"
+                 : "=r"(ttbr0));
+    // Low bits are CnP and the high bits are the ASID; neither are used
+    return *reinterpret_cast<L1Table*>(ttbr0 & 0x0000fffffffff000ull);
+}
+
+}
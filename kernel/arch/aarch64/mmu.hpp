@@ -0,0 +1,302 @@
+#pragma once
+
+#include <pine/array.hpp>
+#include <pine/malloc.hpp>
+#include <pine/page.hpp>
+#include <pine/twomath.hpp>
+#include <pine/types.hpp>
+#include <pine/units.hpp>
+#include <pine/bit.hpp>
+
+/*
+ * The Raspberry Pi 3 memory map, as seen by the ARM:
+ *
+ *  0x00000000 - 0x3C000000  RAM
+ *  0x3C000000 - 0x3F000000  RAM given to the VideoCore (framebuffer lives here)
+ *  0x3F000000 - 0x40000000  Peripherals (UART, system timer, IRQ controller)
+ *  0x40000000 - 0x40040000  BCM2836 local peripherals (per-core timers, mailboxes)
+ */
+#define DEVICES_START 0x3C000000
+#define PERIPHERALS_START 0x3F000000
+#define DEVICES_END 0x40000000
+#define LOCAL_PERIPHERALS_START 0x40000000
+#define LOCAL_PERIPHERALS_END 0x40040000
+// Nothing else is mapped here; see kernel/demand_paging.hpp
+#define DEMAND_PAGED_START 0x80000000
+#define DEMAND_PAGED_END 0xC0000000
+
+extern "C" void mmu_init();  // Forward declare mmu init symbol
+
+struct VirtualAddress {
+    VirtualAddress(PtrData ptr)
+        : m_ptr(ptr) {};
+    VirtualAddress(void* ptr)
+        : m_ptr(reinterpret_cast<PtrData>(ptr)) {};
+
+    // See Figure D5-9 (4KB granule, 39-bit input address) in ARMv8 Reference Manual
+    unsigned l1_index() const { return static_cast<unsigned>((m_ptr >> 30) & 0x1ff); }
+    unsigned l2_index() const { return static_cast<unsigned>((m_ptr >> 21) & 0x1ff); }
+    unsigned l3_index() const { return static_cast<unsigned>((m_ptr >> 12) & 0x1ff); }
+
+    PtrData ptr_data() const { return m_ptr; }
+    void* ptr() const { return reinterpret_cast<void*>(m_ptr); }
+
+private:
+    PtrData m_ptr;
+};
+
+static_assert(sizeof(VirtualAddress) == sizeof(PtrData));
+
+namespace mmu {
+
+/*
+ * Index into the MAIR_EL1 attributes; see set_translation_table().
+ */
+enum class MemoryType : u64 {
+    Device = 0,         // Device-nGnRE; peripherals
+    WriteCombining = 1, // Normal, non-cacheable; memory shared with the GPU
+    WriteBack = 2,      // Normal, write-back read/write-allocate; RAM
+};
+
+enum class Permissions {
+    ReadWrite,   // Read/write at EL1 and EL0, never executable
+    ReadExecute, // Read-only at EL1 and EL0, executable by both
+    ReadOnly,    // Read-only at EL1 and EL0, never executable
+};
+
+enum class DescriptorType : u64 {
+    Fault = 0b00,
+    Block = 0b01,
+    TableOrPage = 0b11,  // Table at levels 1 and 2, Page at level 3
+};
+
+// We do conversions between bitfields and full types all the time around here,
+// not worth the extra reinterpret_cast<>(*) everywhere...
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+
+struct FaultDescriptor {
+    FaultDescriptor()
+        : type(DescriptorType::Fault)
+        , _(0) {};
+
+    DescriptorType type : 2;
+    u64 _ : 62;
+};
+
+/*
+ * A block (level 1 or 2) or page (level 3) entry; these only differ by type.
+ *
+ * See D5.3.3 in the ARMv8 Reference Manual.
+ */
+struct BlockDescriptor {
+    BlockDescriptor(DescriptorType type, PtrData phys_addr, MemoryType memory_type, Permissions permissions)
+        : type(type)
+        , attr_index(memory_type)
+        , ns(0)
+        , ap(permissions == Permissions::ReadWrite ? 0b01 : 0b11)
+        , sh(memory_type == MemoryType::Device ? 0b00 : 0b11)  // inner shareable
+        , af(1)  // we don't track accesses; avoid access flag faults
+        , ng(0)
+        , output_addr(phys_addr >> 12)
+        , _(0)
+        , contiguous(0)
+        , pxn(permissions != Permissions::ReadExecute)
+        , uxn(permissions != Permissions::ReadExecute)
+        , _1(0) {};
+
+    PtrData physical_address() const { return static_cast<PtrData>(output_addr) << 12; }
+    bool is_writable() const { return ap == 0b01; }
+
+    DescriptorType type : 2;  // 0-1
+    MemoryType attr_index : 3; // 2-4: MAIR_EL1 index
+    u64 ns : 1;               // 5: Non-secure
+    u64 ap : 2;               // 6-7: Access permissions
+    u64 sh : 2;               // 8-9: Shareability
+    u64 af : 1;               // 10: Access flag
+    u64 ng : 1;               // 11: Not global
+    u64 output_addr : 36;     // 12-47
+    u64 _ : 4;                // 48-51
+    u64 contiguous : 1;       // 52
+    u64 pxn : 1;              // 53: Privileged execute never
+    u64 uxn : 1;              // 54: Unprivileged execute never
+    u64 _1 : 9;               // 55-63: Software use and ignored
+
+};
+
+struct TableDescriptor {
+    TableDescriptor(PtrData table_addr)
+        : type(DescriptorType::TableOrPage)
+        , _(0)
+        , table_addr(table_addr >> 12)
+        , _1(0) {};
+
+    PtrData table_address() const { return static_cast<PtrData>(table_addr) << 12; }
+
+    DescriptorType type : 2;  // 0-1
+    u64 _ : 10;               // 2-11: Ignored
+    u64 table_addr : 36;      // 12-47
+    u64 _1 : 16;              // 48-63: Hierarchical permissions; unused
+
+};
+
+#pragma GCC diagnostic pop
+
+union Entry {
+    Entry()
+        : _() {};
+
+    DescriptorType type() const { return pine::bit_cast<DescriptorType>(_.type); }
+
+    Entry& operator=(const BlockDescriptor& block)
+    {
+        as_block = block;
+        return *this;
+    }
+    Entry& operator=(const TableDescriptor& table)
+    {
+        as_table = table;
+        return *this;
+    }
+
+    FaultDescriptor _;
+    BlockDescriptor as_block;
+    TableDescriptor as_table;
+};
+
+static_assert(sizeof(Entry) == sizeof(u64));
+
+template <unsigned Level>
+struct alignas(PageSize) TranslationTable {
+    TranslationTable() = default;
+
+    static constexpr auto num_entries = 512;
+    // Size of the memory covered by each entry
+    static constexpr size_t vm_size = static_cast<size_t>(PageSize) << (9 * (3 - Level));
+
+    Entry& retrieve_entry(VirtualAddress virt_addr)
+    {
+        if constexpr (Level == 1)
+            return m_entries[virt_addr.l1_index()];
+        else if constexpr (Level == 2)
+            return m_entries[virt_addr.l2_index()];
+        else
+            return m_entries[virt_addr.l3_index()];
+    }
+
+private:
+    pine::Array<Entry, num_entries> m_entries;
+};
+
+using L1Table = TranslationTable<1>;
+using L2Table = TranslationTable<2>;
+using L3Table = TranslationTable<3>;
+
+static_assert(sizeof(L1Table) == PageSize);
+static_assert(L2Table::vm_size == 2 * MiB);
+static_assert(L3Table::vm_size == PageSize);
+
+extern "C" void init_page_tables(PtrData text_end, PtrData code_end);
+extern "C" void init_secondary_page_tables();
+
+void set_translation_table(L1Table&);
+
+L1Table& l1_table();
+
+// The kernel heap follows the kernel image; see kernel_allocator()
+constexpr size_t KernelHeapSize = 32 * MiB;
+
+/*
+ * The RAM past the kernel heap, a page at a time. It is all identity mapped
+ * for the kernel, so free pages are linked together through their first
+ * word; the rest has never been handed out.
+ *
+ * Pages are reference counted, since tasks share them after a fork; a page
+ * is freed once the last reference to it is dropped.
+ */
+class PhysicalPagePool {
+public:
+    PhysicalPagePool() = default;
+    void init(PageRegion);
+
+    // Returns 0 when out of memory; otherwise the page has one reference
+    PtrData allocate();
+    void ref(PtrData page_addr);
+    void unref(PtrData page_addr);
+    u16 ref_count(PtrData page_addr) const;
+
+private:
+    u16& ref_count_of(PtrData page_addr) const;
+
+    PtrData* m_free_pages = nullptr;
+    PageRegion m_untouched_pages {};
+    // One for each page of the pool, which starts right after them
+    u16* m_ref_counts = nullptr;
+    size_t m_first_page = 0;
+};
+
+/*
+ * Maps physical memory into a L1Table, using 2MiB blocks where alignment
+ * allows and 4KiB pages otherwise. Once the boot tables run out, tables come
+ * from the PhysicalPagePool.
+ *
+ * Each task has its own L1Table: a copy of the kernel's, so that it shares
+ * the kernel's L2Tables, with its own tables for the demand paged window.
+ * Those always come from the pool, since they are reference counted and
+ * given back to it when the task goes away.
+ */
+class PageMapper {
+public:
+    PageMapper() = default;
+    void init(L1Table&, PageRegion scratch_region, PageRegion pool_region);
+
+    bool map(PageRegion virt_region, PtrData phys_addr, MemoryType, Permissions);
+    L1Table& kernel_tables() { return *m_l1_table; }
+
+    // For demand paging; see kernel/demand_paging.hpp
+    L1Table* try_create_task_tables();
+    void destroy_task_tables(L1Table&);
+    bool try_back_page(L1Table&, PtrData virt_addr);
+    bool try_copy_on_write(L1Table&, PtrData virt_addr);
+    bool try_share_pages(L1Table& from, L1Table& to, PageRegion virt_region);
+
+    // For the kernel's own use; see KernelPageAllocator
+    PtrData try_allocate_kernel_page() { return m_page_pool.allocate(); }
+    void free_kernel_page(PtrData page_addr) { m_page_pool.unref(page_addr); }
+
+private:
+    bool map(L1Table&, PageRegion virt_region, PtrData phys_addr, MemoryType, Permissions);
+    template <unsigned Level>
+    TranslationTable<Level + 1>* try_walk(TranslationTable<Level>&, VirtualAddress, bool is_task_table);
+    static Entry* find_page_entry(L1Table&, VirtualAddress);
+
+    L1Table* m_l1_table = nullptr;
+    pine::HighWatermarkAllocator m_table_allocator {};
+    PhysicalPagePool m_page_pool {};
+};
+
+PageMapper& page_mapper();
+
+/*
+ * Single pages from the PhysicalPagePool, for the kernel's object caches;
+ * the kernel heap is one fixed region, so it can't hand out aligned pages.
+ */
+class KernelPageAllocator {
+public:
+    pine::Allocation allocate(size_t size);
+    void free(pine::Allocation);
+};
+
+KernelPageAllocator& kernel_page_allocator();
+
+L1Table* try_create_task_tables();
+void destroy_task_tables(L1Table&);
+// Makes the tables the calling core's, in place of whatever task's it had
+void switch_task_tables(L1Table&);
+// For kernel tasks, which have no tables of their own
+void switch_kernel_tables();
+bool try_back_page(L1Table&, PtrData virt_addr);
+bool try_copy_on_write(L1Table&, PtrData virt_addr);
+bool try_share_pages(L1Table& from, L1Table& to, PageRegion virt_region);
+
+}
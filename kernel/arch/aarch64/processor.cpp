@@ -50,6 +50,25 @@ void print_with(pine::Printer& printer, const ExceptionSavedRegisters& registers
     print_with(printer, "\n\n");
 }
 
+Registers Registers::forked(const SyscallFrame& frame, PtrData kernel_sp)
+{
+    // SP_EL0 is still the task's while it is in the syscall
+    PtrData user_sp;
+    asm volatile("mrs %0, sp_el0" : "=r"(user_sp));
+
+    // The LR is restored from kernel_lr; see switch.S
+    Registers registers(user_sp, kernel_sp, frame.elr, frame.lr, PrivilegeLevel::Userspace);
+    registers.cpsr = SPSR_EL1::from_data(frame.spsr);
+
+    // Restored in pairs from x28 and x29 down to x0 and x1
+    for (unsigned n = 1; n < 30; n++) {
+        auto pair = (28 - (n & ~1u)) / 2;
+        registers.xn_reversed[2 * pair + (n & 1)] = frame.xn[n];
+    }
+    registers.xn_reversed[28] = 0;  // x0; the child's return value
+    return registers;
+}
+
 PtrData InterruptDisabler::status()
 {
     PtrData state;
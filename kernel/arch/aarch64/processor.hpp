@@ -21,6 +21,29 @@ struct InterruptDisabler {
     static PtrData status();
 };
 
+/*
+ * Like InterruptDisabler, but puts back whatever was masked before rather
+ * than unmasking, so it can nest inside code that runs with interrupts
+ * disabled.
+ */
+struct InterruptSaver {
+    InterruptSaver() __attribute__((always_inline))
+    {
+        asm volatile("mrs %0, daif; msr daifset, #0b0011" : "=r"(m_daif)::"memory");
+    }
+
+    ~InterruptSaver() __attribute__((always_inline))
+    {
+        asm volatile("msr daif, %0" ::"r"(m_daif) : "memory");
+    }
+
+    InterruptSaver(const InterruptSaver&) = delete;
+    InterruptSaver(InterruptSaver&&) = delete;
+
+private:
+    u64 m_daif;
+};
+
 // See https://developer.arm.com/documentation/ddi0595/2020-12/AArch64-Registers/ESR-EL1--Exception-Syndrome-Register--EL1-
 enum class ExceptionClass : u64 {
     UnknownReason = 0x0,
@@ -44,6 +67,59 @@ struct ESR_EL1 {
 
 static_assert(sizeof(ESR_EL1) == 8);
 
+/*
+ * Puts the processor in a low power state until the next interrupt.
+ */
+inline void wait_for_interrupt()
+{
+    asm volatile("wfi" ::: "memory");
+}
+
+/*
+ * Wakes any cores waiting in a WFE, such as the secondary cores before they
+ * are started; see smp_start_secondary_cores().
+ */
+inline void send_event()
+{
+    asm volatile("dsb sy; sev" ::: "memory");
+}
+
+/*
+ * Starts the calling core's PMU cycle counter, for benchmarks.
+ */
+inline void enable_cycle_counter()
+{
+    // PMCR_EL0.E enables the counters, and PMCNTENSET_EL0 bit 31 the cycle counter
+    u64 control;
+    asm volatile("mrs %0, pmcr_el0" : "=r"(control));
+    asm volatile("msr pmcr_el0, %0; msr pmcntenset_el0, %1; isb" ::"r"(control | 1), "r"(1ul << 31) : "memory");
+}
+
+inline u64 cycle_count()
+{
+    u64 count;
+    asm volatile("isb; mrs %0, pmccntr_el0" : "=r"(count)::"memory");
+    return count;
+}
+
+/*
+ * Tells the processor we are busy waiting on another core.
+ */
+inline void spin_loop_hint()
+{
+    asm volatile("yield" ::: "memory");
+}
+
+/*
+ * The core we are running on; 0 is the boot core.
+ */
+inline unsigned core_id()
+{
+    u64 mpidr;
+    asm volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return static_cast<unsigned>(mpidr & 0x3);
+}
+
 enum class ProcessorMode : u64 {
     EL0 = 0b0000,
     EL1t = 0b0100,
@@ -118,10 +194,29 @@ struct ExceptionSavedRegisters {
     u64 xn[30];
     u64 lr;
     u64 zero;
+    u64 elr;  // The PC to return to
+    u64 spsr;
 
     friend void print_with(pine::Printer& printer, const ExceptionSavedRegisters& registers);
 };
 
+// What a task had when it made a syscall; see Registers::forked()
+using SyscallFrame = ExceptionSavedRegisters;
+
+/*
+ * What task_switch() saves of a task it switches away from: only what a
+ * function call preserves, since it is called from C; see switch.S.
+ */
+struct SwitchedRegisters {
+    u64 x19_to_x28[10];
+    u64 fp;
+    u64 lr;
+    u64 sp;
+    u64 daif;
+    u64 user_sp;  // SP_EL0, which isn't banked by task
+    u64 zero;
+};
+
 struct Registers {
     explicit Registers(PtrData user_sp, PtrData kernel_sp, PtrData user_pc, PtrData stop_addr, PrivilegeLevel level)
         : cpsr(level == PrivilegeLevel::Kernel ? ProcessorMode::EL1h : ProcessorMode::EL0)
@@ -129,7 +224,13 @@ struct Registers {
         , user_sp(user_sp)
         , kernel_sp(kernel_sp)
         , kernel_lr(stop_addr)
-        , xn_reversed {0} {};
+        , xn_reversed {0}
+        , is_switched_out(0)
+        , switched {} {};
+
+    // Those of a new task that returns from the running task's syscall
+    // with 0, as a copy of it; see fork()
+    static Registers forked(const SyscallFrame&, PtrData kernel_sp);
 
     bool is_kernel_registers() const { return user_sp == kernel_sp; };
 
@@ -139,4 +240,11 @@ struct Registers {
     u64 kernel_sp;
     u64 kernel_lr;
     u64 xn_reversed[30];
+    // Whether it has been switched away from, so it resumes from switched
+    u64 is_switched_out;
+    SwitchedRegisters switched;
 };
+
+// Used by switch.S
+static_assert(offsetof(Registers, is_switched_out) == 280);
+static_assert(offsetof(Registers, switched) == 288);
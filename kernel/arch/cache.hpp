@@ -0,0 +1,9 @@
+#pragma once
+
+#ifdef AARCH64
+#include "aarch64/cache.hpp"
+#elif AARCH32
+#include "aarch32/cache.hpp"
+#else
+#error Architecture not defined
+#endif
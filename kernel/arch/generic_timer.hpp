@@ -0,0 +1,9 @@
+#pragma once
+
+#ifdef AARCH64
+#include "aarch64/generic_timer.hpp"
+#elif AARCH32
+#include "aarch32/generic_timer.hpp"
+#else
+#error Architecture not defined
+#endif
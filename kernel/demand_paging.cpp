@@ -0,0 +1,173 @@
+#include "demand_paging.hpp"
+#include "arch/processor.hpp"
+#include "smp.hpp"
+
+#include <pine/twomath.hpp>
+
+// Room for the largest region and the page below it
+static constexpr size_t slot_size = AddressSpace::max_region_size + PageSize;
+static_assert(AddressSpace::max_regions * slot_size <= DEMAND_PAGED_END - DEMAND_PAGED_START);
+
+// Whose tables each core has; see AddressSpace::switch_to()
+static AddressSpace* g_current_spaces[NUM_CORES];
+
+static PtrData slot_end(unsigned slot)
+{
+    return DEMAND_PAGED_START + (slot + 1) * slot_size;
+}
+
+static PageRegion slot_region(unsigned slot, size_t size)
+{
+    return PageRegion::from_range(slot_end(slot) - size, slot_end(slot));
+}
+
+pine::Maybe<AddressSpace> AddressSpace::try_create()
+{
+    auto* tables = mmu::try_create_task_tables();
+    if (!tables)
+        return {};
+
+    return AddressSpace(*tables);
+}
+
+AddressSpace::AddressSpace(mmu::L1Table& tables)
+    : m_tables(&tables)
+    , m_region_sizes()
+{
+}
+
+AddressSpace::~AddressSpace()
+{
+    release();
+}
+
+AddressSpace::AddressSpace(AddressSpace&& other)
+    : m_tables(nullptr)
+{
+    take(other);
+}
+
+AddressSpace& AddressSpace::operator=(AddressSpace&& other)
+{
+    if (this != &other) {
+        release();
+        take(other);
+    }
+    return *this;
+}
+
+void AddressSpace::take(AddressSpace& other)
+{
+    m_tables = other.m_tables;
+    for (unsigned slot = 0; slot < max_regions; slot++)
+        m_region_sizes[slot] = other.m_region_sizes[slot];
+
+    for (auto& current_space : g_current_spaces) {
+        if (current_space == &other)
+            current_space = this;
+    }
+    other.m_tables = nullptr;
+}
+
+void AddressSpace::release()
+{
+    if (!m_tables)
+        return;
+
+    // The tables are switched away from on this core; no other core can have
+    // them, since only the task they belong to runs with them
+    auto& current_space = g_current_spaces[core_id()];
+    if (current_space == this)
+        current_space = nullptr;
+
+    mmu::destroy_task_tables(*m_tables);
+    m_tables = nullptr;
+}
+
+PageRegion AddressSpace::reserve_region(size_t size)
+{
+    size = pine::align_up_two(size, PageSize);
+    if (size == 0 || size > max_region_size)
+        return {};
+
+    for (unsigned slot = 0; slot < max_regions; slot++) {
+        if (m_region_sizes[slot] == 0) {
+            m_region_sizes[slot] = size;
+            return slot_region(slot, size);
+        }
+    }
+    return {};
+}
+
+pine::Maybe<AddressSpace> AddressSpace::try_fork()
+{
+    auto maybe_space = try_create();
+    if (!maybe_space)
+        return {};
+
+    auto& space = *maybe_space;
+    for (unsigned slot = 0; slot < max_regions; slot++) {
+        auto size = m_region_sizes[slot];
+        space.m_region_sizes[slot] = size;
+        if (size > 0 && !mmu::try_share_pages(*m_tables, *space.m_tables, slot_region(slot, size)))
+            return {};
+    }
+
+    return maybe_space;
+}
+
+void AddressSpace::switch_to()
+{
+    auto& current_space = g_current_spaces[core_id()];
+    if (current_space == this)
+        return;
+
+    mmu::switch_task_tables(*m_tables);
+    current_space = this;
+}
+
+void AddressSpace::switch_to_none()
+{
+    auto& current_space = g_current_spaces[core_id()];
+    if (!current_space)
+        return;
+
+    mmu::switch_kernel_tables();
+    current_space = nullptr;
+}
+
+bool AddressSpace::is_reserved(PtrData addr, size_t size) const
+{
+    if (addr < DEMAND_PAGED_START || addr >= DEMAND_PAGED_END)
+        return false;
+
+    auto slot = static_cast<unsigned>((addr - DEMAND_PAGED_START) / slot_size);
+    if (slot >= max_regions || addr < slot_end(slot) - m_region_sizes[slot])
+        return false;
+
+    return size <= slot_end(slot) - addr;
+}
+
+bool AddressSpace::handle_fault(PtrData fault_addr, PageFault fault)
+{
+    if (!is_reserved(fault_addr, 1))
+        return false;
+
+    auto page_addr = pine::align_down_two(fault_addr, PageSize);
+    switch (fault) {
+    case PageFault::NotMapped:
+        return mmu::try_back_page(*m_tables, page_addr);
+    case PageFault::Write:
+        return mmu::try_copy_on_write(*m_tables, page_addr);
+    }
+    return false;
+}
+
+bool handle_page_fault(PtrData fault_addr, PageFault fault)
+{
+    auto* current_space = g_current_spaces[core_id()];
+    if (!current_space)
+        return false;
+
+    return current_space->handle_fault(fault_addr, fault);
+}
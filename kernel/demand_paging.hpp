@@ -0,0 +1,77 @@
+#pragma once
+
+#ifdef AARCH64
+#include "arch/aarch64/mmu.hpp"
+#elif AARCH32
+#include "arch/aarch32/mmu.hpp"
+#else
+#error Architecture not defined
+#endif
+
+#include <pine/maybe.hpp>
+#include <pine/page.hpp>
+#include <pine/types.hpp>
+#include <pine/units.hpp>
+
+/*
+ * The memory of a task (its user stack and heap): a window of the address
+ * space (see DEMAND_PAGED_START in mmu.hpp) that each task has its own
+ * translation tables for. Regions of it are reserved up front, but a page is
+ * only backed once it is first touched: the translation fault is handled by
+ * mapping in a zeroed page, and the access is then retried. Tasks take up as
+ * much memory as they use, rather than as much as they might.
+ *
+ * Regions go one to a fixed size slot, so a fault is matched to its region in
+ * constant time. Each region sits at the top of its slot, so there is always
+ * an unmapped page below it that an overflowing stack faults on.
+ *
+ * Forking shares every backed page between the two address spaces, read-only
+ * and reference counted; whichever writes to a page first gets a copy of it
+ * on the permission fault. Forks cost as much as the pages written after.
+ */
+class AddressSpace {
+public:
+    static constexpr size_t max_region_size = 4 * MiB;
+    static constexpr unsigned max_regions = 8;
+
+    static pine::Maybe<AddressSpace> try_create();
+    ~AddressSpace();
+    AddressSpace(const AddressSpace&) = delete;
+    AddressSpace& operator=(const AddressSpace&) = delete;
+    AddressSpace(AddressSpace&&);
+    AddressSpace& operator=(AddressSpace&&);
+
+    // Returns an empty region if it is too large or there are no slots left
+    PageRegion reserve_region(size_t size);
+    // Whether [addr, addr + size) lies within a single reserved region
+    bool is_reserved(PtrData addr, size_t size) const;
+    pine::Maybe<AddressSpace> try_fork();
+
+    // Makes it the calling core's, until another is switched to
+    void switch_to();
+    // For kernel tasks, which have none
+    static void switch_to_none();
+
+    enum class PageFault {
+        NotMapped,  // a translation fault
+        Write,      // a permission fault on a write
+    };
+
+private:
+    explicit AddressSpace(mmu::L1Table& tables);
+    void take(AddressSpace&);
+    void release();
+    bool handle_fault(PtrData fault_addr, PageFault);
+    friend bool handle_page_fault(PtrData, PageFault);
+
+    mmu::L1Table* m_tables;
+    // The size of the region in each slot, or 0 if it is free
+    size_t m_region_sizes[max_regions];
+};
+
+using PageFault = AddressSpace::PageFault;
+
+// Called with the kernel lock held on a page fault in the calling core's
+// address space; returns whether it is in a region and now backed, so the
+// access can be retried
+bool handle_page_fault(PtrData fault_addr, PageFault);
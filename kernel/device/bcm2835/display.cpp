@@ -52,7 +52,8 @@ struct DisplayTagGetPitch {
     u32 out_pitch = 0;
 };
 
-struct __attribute__((__packed__)) DisplayMailboxMessage {
+// Aligned (and so padded) to whole cache lines; see MAILBOX_MESSAGE_ALIGNMENT
+struct __attribute__((__packed__, aligned(MAILBOX_MESSAGE_ALIGNMENT))) DisplayMailboxMessage {
     u32 size = sizeof(DisplayMailboxMessage);
     u32 type = MAILBOX_REQUEST;
 
@@ -83,9 +84,7 @@ void Display::init(unsigned int width, unsigned int height)
     // Easier to work with...
     constexpr auto display_depth = sizeof(m_buffer) * CHAR_BIT;
 
-    // The message must be aligned to 16 bits as only the upper 28 bits are
-    // provided to the mailbox
-    static __attribute__((aligned(16))) DisplayMailboxMessage message {
+    static DisplayMailboxMessage message {
         .phys_dim = {
             .in_out_width = width,
             .in_out_height = height,
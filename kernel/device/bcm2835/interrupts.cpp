@@ -1,9 +1,11 @@
 #include "interrupts.hpp"
+#include "../bcm2836/interrupts.hpp"
 #include "../../device/pl011/uart.hpp"
 #include "../../interrupt_disabler.hpp"
 #include "../../tasks.hpp"
 #include "../../arch/barrier.hpp"
-#include "timer.hpp"
+#include "../../arch/processor.hpp"
+#include "../timer.hpp"
 
 void InterruptRegisters::enable_timer() volatile
 {
@@ -47,24 +49,49 @@ void interrupts_enable_uart()
 
 void interrupts_enable_timer()
 {
-    interrupt_registers().enable_timer();
+    timer_enable_irq();
+}
+
+void interrupts_enable_ipi()
+{
+    local_interrupt_registers().enable_mailbox(core_id());
+}
+
+void interrupts_send_ipi(unsigned core)
+{
+    local_interrupt_registers().send_to_mailbox(core);
 }
 
 void interrupts_handle_irq(InterruptsDisabledTag disabled_tag)
 {
-    bool should_reschedule = false;
-    auto& irq = interrupt_registers();
-
-    // FIXME: Read pending_basic_irq1 once, then make decision based on that,
-    //        rather than reading a bunch of registers here! IRQ handlers
-    //        should be quick.
-    if (irq.timer_pending()) {
-        system_timer().handle_irq(disabled_tag);
-        should_reschedule = true;
+    auto core = core_id();
+    auto& local_irq = local_interrupt_registers();
+
+    // A tick passed on by the boot core, or a task was woken for us
+    if (local_irq.mailbox_pending(core)) {
+        local_irq.clear_mailbox(core);
+        task_manager().tick(disabled_tag);
+    }
+
+    // The timer and GPU IRQs only ever go to the boot core (the timer then
+    // preempts the others with IPIs)
+    if (core == 0) {
+        auto& irq = interrupt_registers();
+
+        // FIXME: Read pending_basic_irq1 once, then make decision based on that,
+        //        rather than reading a bunch of registers here! IRQ handlers
+        //        should be quick.
+        if (timer_irq_pending()) {
+            timer_handle_irq(disabled_tag);
+            task_manager().tick(disabled_tag);
+            task_manager().preempt_other_cores(disabled_tag);
+        }
+        if (irq.uart_pending())
+            uart_request().handle_irq(disabled_tag);
     }
-    if (irq.uart_pending())
-        uart_request().handle_irq(disabled_tag);
 
-    if (should_reschedule)
+    // Either the slice of the running task is up, or an IRQ woke a task
+    // that should run instead
+    if (task_manager().needs_reschedule(disabled_tag))
         task_manager().schedule(disabled_tag);
 }
\ No newline at end of file
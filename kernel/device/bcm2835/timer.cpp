@@ -1,13 +1,22 @@
 #include "timer.hpp"
+#include "interrupts.hpp"
+#include "../timer.hpp"
 #include "../../interrupt_disabler.hpp"
 #include "../../arch/panic.hpp"
 #include "../../arch/barrier.hpp"
+#include "../../lock.hpp"
+#include "../../timers.hpp"
 
 #include <pine/units.hpp>
 
 // 32 bits should ought to be enough for anyone ;)
 static u32 jiffies_since_boot;
 static u32 timer_counter_match;
+// Counter value at the start of the current jiffy
+static u32 jiffy_start_count;
+static u64 boot_count;
+// Only the timer IRQ moves the jiffies forward, but they are read on every core
+static SeqLock jiffy_lock;
 
 void SystemTimer::init()
 {
@@ -19,7 +28,9 @@ void SystemTimer::init()
     timer_counter_match = TIMER_HZ >> SYS_HZ_BITS;
     {
         pine::MemoryBarrier barrier {};
-        compare1 = lower_bits + timer_counter_match;
+        jiffy_start_count = lower_bits;
+        boot_count = counter();
+        compare1 = jiffy_start_count + timer_counter_match;
         compare3 = lower_bits + (timer_counter_match << FALLBACK_SYS_HZ_SCALER_BITS);
 
         // Clear timer match flag
@@ -29,16 +40,22 @@ void SystemTimer::init()
     jiffies_since_boot = 0;
 }
 
-void SystemTimer::handle_irq(InterruptsDisabledTag)
+void SystemTimer::handle_irq(InterruptsDisabledTag disabled_tag)
 {
     PANIC_MESSAGE_IF(!matched(), "IRQ handler for timer called, but not needed!");
 
-    u32 jif_diff = jiffies_since_last_match();
-    reinit();
-    jiffies_since_boot += jif_diff;
+    jiffy_lock.write_lock(disabled_tag);
+    jiffies_since_boot += jiffies_since_last_match();
+    jiffy_lock.write_unlock(disabled_tag);
+
+    // Tick again on the next jiffy unless the scheduler says otherwise; see
+    // program_next_match()
+    reinit(1);
+
+    timer_wheel().advance(disabled_tag, jiffies_since_boot);
 }
 
-void SystemTimer::reinit()
+void SystemTimer::reinit(u32 delay_jiffies)
 {
     pine::MemoryBarrier barrier {};
     /*
@@ -46,8 +63,9 @@ void SystemTimer::reinit()
      * here. Each initialization should be the current timer value + the time
      * you want to wait.
      *
-     * There is max_overhead in re-initing the timer, and this is fixed by only
-     * waiting our SYS_HZ period minus the time left: compare1 + counter_match
+     * There is max_overhead in re-initing the timer, and this is fixed by
+     * matching on jiffy boundaries (jiffy_start_count + n * counter_match)
+     * rather than counting from the current counter value.
      *
      * But this does not work well alone when emulating in QEMU. The system
      * timer simulated by QEMU _is_ accurate to real time, but the clock cycles
@@ -70,27 +88,53 @@ void SystemTimer::reinit()
      * moment.
      */
 
-    // Try harder to ensure timer IRQ happens, potentially missing jiffies. From testing,
-    // we still need compare3 because there are race conditions with the host scheduler
+    // Clear timer match flag; first, so that a match on the new compare
+    // value below can't be cleared along with it
+    control |= (1 << 1);
+
+    // Try harder to ensure timer IRQ happens, potentially missing jiffies
+    // (they are counted once we do get an IRQ). From testing, we still need
+    // compare3 because there are race conditions with the host scheduler
     // (I'm guessing that's the reason)
-    while (compare1 < lower_bits)
-        compare1 += timer_counter_match;
+    u32 next_match = jiffy_start_count + delay_jiffies * timer_counter_match;
+    while (static_cast<i32>(next_match - lower_bits) <= 0)
+        next_match += timer_counter_match;
 
-    compare3 = lower_bits + (timer_counter_match << FALLBACK_SYS_HZ_SCALER_BITS);
+    compare1 = next_match;
+    compare3 = next_match + (timer_counter_match << FALLBACK_SYS_HZ_SCALER_BITS);
+}
 
-    // Clear timer match flag
-    control |= (1 << 1);
+void SystemTimer::program_next_match(u32 delay_jiffies)
+{
+    PANIC_IF(delay_jiffies == 0);
+    reinit(delay_jiffies);
 }
 
-u32 SystemTimer::jiffies_since_last_match() const
+u32 SystemTimer::jiffies_since_last_match()
+{
+    u32 jiffies = jiffies_pending();
+    jiffy_start_count += jiffies * timer_counter_match;
+    return jiffies;
+}
+
+u64 SystemTimer::counter() const
 {
     pine::MemoryBarrier::sync();
-    if (compare3 < lower_bits) {
-        //consoleln("\033[0;31mkernel:\tFallback timer match encountered!\033[0m");
-        return FALLBACK_SYS_HZ_SCALER;
-    }
+    // The upper half may tick over between our reads of the two halves
+    u32 upper, lower;
+    do {
+        upper = upper_bits;
+        lower = lower_bits;
+    } while (upper != upper_bits);
+
+    return (static_cast<u64>(upper) << 32) | lower;
+}
 
-    return 1;
+u32 SystemTimer::jiffies_pending() const
+{
+    pine::MemoryBarrier::sync();
+    // Counts every jiffy, even those skipped while ticking less often
+    return (lower_bits - jiffy_start_count) / timer_counter_match;
 }
 
 bool SystemTimer::matched() const
@@ -110,7 +154,53 @@ void timer_init()
     system_timer().init();
 }
 
+void timer_program_next_tick(InterruptsDisabledTag, u32 delay_jiffies)
+{
+    system_timer().program_next_match(delay_jiffies);
+}
+
+void timer_enable_irq()
+{
+    interrupt_registers().enable_timer();
+}
+
+bool timer_irq_pending()
+{
+    return interrupt_registers().timer_pending();
+}
+
+void timer_handle_irq(InterruptsDisabledTag disabled_tag)
+{
+    system_timer().handle_irq(disabled_tag);
+}
+
+u64 uptime_ns()
+{
+    if (timer_counter_match == 0)  // before timer_init()
+        return 0;
+
+    return (system_timer().counter() - boot_count) * TIMER_NS_PER_COUNT;
+}
+
 u32 jiffies()
 {
-    return jiffies_since_boot;
+    if (timer_counter_match == 0)  // before timer_init()
+        return 0;
+
+    // Timer IRQs may be further apart than a jiffy; see timer_program_next_tick()
+    u32 sequence;
+    u32 jiffies;
+    do {
+        sequence = jiffy_lock.read_begin();
+        jiffies = jiffies_since_boot + system_timer().jiffies_pending();
+    } while (jiffy_lock.read_retry(sequence));
+
+    return jiffies;
+}
+
+#ifdef LOCK_STATS
+const SeqLock& timer_jiffy_lock()
+{
+    return jiffy_lock;
 }
+#endif
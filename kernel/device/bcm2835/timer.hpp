@@ -16,9 +16,9 @@
 
 // The CPU runs at 1 MHz
 #define TIMER_HZ 1000000
+#define TIMER_NS_PER_COUNT (1000000000 / TIMER_HZ)
 
 // See reinit for details on these
-#define FALLBACK_SYS_HZ_SCALER 32
 #define FALLBACK_SYS_HZ_SCALER_BITS 5
 
 /*
@@ -31,11 +31,14 @@ struct SystemTimer {
 public:
     void init();
     void handle_irq(InterruptsDisabledTag);
+    void program_next_match(u32 delay_jiffies);
+    u32 jiffies_pending() const;
+    u64 counter() const;
 
 private:
-    void reinit();
+    void reinit(u32 delay_jiffies);
     bool matched() const;
-    u32 jiffies_since_last_match() const;
+    u32 jiffies_since_last_match();
 
     volatile u32 control;
     volatile u32 lower_bits;
@@ -0,0 +1,51 @@
+#include "interrupts.hpp"
+#include "../../arch/barrier.hpp"
+
+// Bit 3 of the timer control and IRQ source registers is the virtual timer
+static constexpr u32 virtual_timer_bit = 1 << 3;
+// Bit 4 of the IRQ source registers (and bit 0 of the mailbox control
+// registers) is the first mailbox
+static constexpr u32 mailbox_source_bit = 1 << 4;
+static constexpr u32 mailbox_control_bit = 1 << 0;
+
+void LocalInterruptRegisters::enable_virtual_timer(unsigned core) volatile
+{
+    pine::MemoryBarrier barrier {};
+    core_timer_interrupt_control[core] |= virtual_timer_bit;
+}
+
+bool LocalInterruptRegisters::virtual_timer_pending(unsigned core) const
+{
+    pine::MemoryBarrier::sync();
+    return core_irq_source[core] & virtual_timer_bit;
+}
+
+void LocalInterruptRegisters::enable_mailbox(unsigned core) volatile
+{
+    pine::MemoryBarrier barrier {};
+    core_mailbox_interrupt_control[core] |= mailbox_control_bit;
+}
+
+void LocalInterruptRegisters::send_to_mailbox(unsigned core) volatile
+{
+    pine::MemoryBarrier barrier {};
+    core_mailbox_set[core][0] = 1;
+}
+
+bool LocalInterruptRegisters::mailbox_pending(unsigned core) const
+{
+    pine::MemoryBarrier::sync();
+    return core_irq_source[core] & mailbox_source_bit;
+}
+
+void LocalInterruptRegisters::clear_mailbox(unsigned core) volatile
+{
+    pine::MemoryBarrier barrier {};
+    core_mailbox_read_and_clear[core][0] = 0xffffffff;
+}
+
+LocalInterruptRegisters& local_interrupt_registers()
+{
+    static auto* g_local_interrupt_registers = reinterpret_cast<LocalInterruptRegisters*>(LOCAL_INTERRUPTS_BASE);
+    return *g_local_interrupt_registers;
+}
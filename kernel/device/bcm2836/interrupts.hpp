@@ -0,0 +1,55 @@
+#pragma once
+#include "../../smp.hpp"
+
+#include <pine/types.hpp>
+
+/*
+ * The BCM2836 (and BCM2837) put a small per-core interrupt controller in
+ * front of the BCM2835 one. It routes each core's ARM generic timers and
+ * mailboxes, along with the GPU's IRQ (to core 0 by default). See the "Quad-A7
+ * control" document (QA7_rev3.4) for details.
+ */
+#define LOCAL_INTERRUPTS_BASE 0x40000000
+
+struct LocalInterruptRegisters {
+    void enable_virtual_timer(unsigned core) volatile;
+    bool virtual_timer_pending(unsigned core) const;
+
+    // Only the first of each core's four mailboxes is used, for IPIs
+    void enable_mailbox(unsigned core) volatile;
+    void send_to_mailbox(unsigned core) volatile;
+    bool mailbox_pending(unsigned core) const;
+    void clear_mailbox(unsigned core) volatile;
+
+    /*
+     * See section 4 of QA7_rev3.4 for the definition of these; the
+     * per-core ones are indexed by core
+     */
+    volatile u32 control;
+    volatile u32 unused0;
+    volatile u32 core_timer_prescaler;
+    volatile u32 gpu_interrupt_routing;
+    volatile u32 pmu_interrupt_routing_set;
+    volatile u32 pmu_interrupt_routing_clear;
+    volatile u32 unused1;
+    volatile u32 core_timer_lower_bits;
+    volatile u32 core_timer_upper_bits;
+    volatile u32 local_interrupt_routing;
+    volatile u32 unused2;
+    volatile u32 axi_outstanding_counters;
+    volatile u32 axi_outstanding_irq;
+    volatile u32 local_timer_control;
+    volatile u32 local_timer_write_flags;
+    volatile u32 unused3;
+    volatile u32 core_timer_interrupt_control[NUM_CORES];
+    volatile u32 core_mailbox_interrupt_control[NUM_CORES];
+    volatile u32 core_irq_source[NUM_CORES];
+    volatile u32 core_fiq_source[NUM_CORES];
+    volatile u32 core_mailbox_set[NUM_CORES][4];
+    volatile u32 core_mailbox_read_and_clear[NUM_CORES][4];
+};
+
+LocalInterruptRegisters& local_interrupt_registers();
+
+static_assert(offsetof(LocalInterruptRegisters, core_timer_interrupt_control) == 0x40);
+static_assert(offsetof(LocalInterruptRegisters, core_mailbox_read_and_clear) == 0xC0);
@@ -0,0 +1,129 @@
+#include "interrupts.hpp"
+#include "../timer.hpp"
+#include "../../arch/generic_timer.hpp"
+#include "../../arch/panic.hpp"
+#include "../../lock.hpp"
+#include "../../timers.hpp"
+
+#include <pine/math.hpp>
+#include <pine/units.hpp>
+
+/*
+ * Ticks with the ARM generic timer rather than the BCM2835 system timer.
+ *
+ * Deadlines are absolute 64-bit counter values and one already in the past
+ * fires right away, so unlike the system timer's 32-bit compare registers
+ * there is no racing the counter when reprogramming it. It is also not shared
+ * with the GPU, and each core has its own; only the boot core uses it for now.
+ */
+static constexpr unsigned timer_core = 0;
+
+// Counter values per second (from the firmware) and per jiffy
+static u32 counts_per_second;
+static u32 counts_per_jiffy;
+static u32 jiffies_since_boot;
+// Counter value at the start of the current jiffy
+static u64 jiffy_start_count;
+static u64 boot_count;
+// Only the timer IRQ moves the jiffies forward, but they are read on every
+// core (and the 64-bit count can't be read at once on aarch32)
+static SeqLock jiffy_lock;
+
+static u32 jiffies_pending(u64 count)
+{
+    // Idle only skips as many ticks as fit on the first level of the timer
+    // wheel, so there is rarely need for the slow 64-bit division
+    u64 counts = count - jiffy_start_count;
+    if (counts <= 0xffffffff)
+        return static_cast<u32>(counts) / counts_per_jiffy;
+
+    return static_cast<u32>(pine::divmod(counts, counts_per_jiffy).first);
+}
+
+static void program_deadline(u32 delay_jiffies)
+{
+    // Matching on jiffy boundaries keeps ticks from drifting by however long
+    // the IRQ took to handle
+    GenericTimer::set_compare(jiffy_start_count + static_cast<u64>(delay_jiffies) * counts_per_jiffy);
+}
+
+void timer_init()
+{
+    counts_per_second = GenericTimer::frequency();
+    PANIC_MESSAGE_IF((counts_per_second >> SYS_HZ_BITS) == 0, "SYS_HZ is faster than the generic timer!");
+
+    counts_per_jiffy = counts_per_second >> SYS_HZ_BITS;
+    boot_count = GenericTimer::count();
+    jiffy_start_count = boot_count;
+    jiffies_since_boot = 0;
+
+    program_deadline(1);
+    GenericTimer::set_control(GenericTimer::enable);
+}
+
+void timer_program_next_tick(InterruptsDisabledTag, u32 delay_jiffies)
+{
+    PANIC_IF(delay_jiffies == 0);
+    program_deadline(delay_jiffies);
+}
+
+void timer_enable_irq()
+{
+    local_interrupt_registers().enable_virtual_timer(timer_core);
+}
+
+bool timer_irq_pending()
+{
+    return local_interrupt_registers().virtual_timer_pending(timer_core);
+}
+
+void timer_handle_irq(InterruptsDisabledTag disabled_tag)
+{
+    auto jiffies = jiffies_pending(GenericTimer::count());
+    PANIC_MESSAGE_IF(jiffies == 0, "IRQ handler for timer called, but not needed!");
+
+    jiffy_lock.write_lock(disabled_tag);
+    jiffy_start_count += static_cast<u64>(jiffies) * counts_per_jiffy;
+    jiffies_since_boot += jiffies;
+    jiffy_lock.write_unlock(disabled_tag);
+
+    // Tick again on the next jiffy unless the scheduler says otherwise; this
+    // also moves the deadline past the counter, which clears the IRQ
+    program_deadline(1);
+
+    timer_wheel().advance(disabled_tag, jiffies_since_boot);
+}
+
+u64 uptime_ns()
+{
+    if (counts_per_jiffy == 0)  // before timer_init()
+        return 0;
+
+    // The remainder is below counts_per_second, so scaling it can't overflow
+    auto [seconds, counts] = pine::divmod(GenericTimer::count() - boot_count, counts_per_second);
+    auto [nanoseconds, _] = pine::divmod(static_cast<u64>(counts) * 1000000000, counts_per_second);
+    return seconds * 1000000000 + nanoseconds;
+}
+
+u32 jiffies()
+{
+    if (counts_per_jiffy == 0)  // before timer_init()
+        return 0;
+
+    // Timer IRQs may be further apart than a jiffy; see timer_program_next_tick()
+    u32 sequence;
+    u32 jiffies;
+    do {
+        sequence = jiffy_lock.read_begin();
+        jiffies = jiffies_since_boot + jiffies_pending(GenericTimer::count());
+    } while (jiffy_lock.read_retry(sequence));
+
+    return jiffies;
+}
+
+#ifdef LOCK_STATS
+const SeqLock& timer_jiffy_lock()
+{
+    return jiffy_lock;
+}
+#endif
@@ -9,4 +9,10 @@ void interrupts_enable_timer();
 
 void interrupts_enable_uart();
 
+// Inter-processor interrupts, which make the receiving core reschedule;
+// enabling is done by each core for itself
+void interrupts_enable_ipi();
+
+void interrupts_send_ipi(unsigned core);
+
 void interrupts_handle_irq(InterruptsDisabledTag);
\ No newline at end of file
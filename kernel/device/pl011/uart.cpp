@@ -3,11 +3,13 @@
 #include "../../kmalloc.hpp"
 #include "../../arch/panic.hpp"
 #include "../../wait.hpp"
+#include "../../work.hpp"
 #include "../videocore/mailbox.hpp"
 #include "../../arch/barrier.hpp"
 
 #include <pine/math.hpp>
 #include <pine/bit.hpp>
+#include <pine/c_builtins.hpp>
 #include <pine/types.hpp>
 
 void UARTRegisters::poll_write(const char* message)
@@ -227,44 +229,88 @@ UARTRequest& uart_request()
     return g_uart_request;
 }
 
-void reschedule_while_waiting_for(const Waitable&);
+/*
+ * Tasks waiting for the (single) UART request to finish, or to be free.
+ */
+static WaitQueue& uart_wait_queue()
+{
+    static WaitQueue g_uart_wait_queue;
+    return g_uart_wait_queue;
+}
 
 ssize_t UARTFile::read(char *buf, size_t at_most_bytes)
 {
-    PANIC_MESSAGE_IF(!uart_request().is_finished(), "UART request already under operation!");
+    auto& request = uart_request();
+    request.acquire();
+    size_t offset = 0;
+    while (offset < at_most_bytes) {
+        auto size = pine::min(at_most_bytes - offset, UARTRequest::buffer_size);
+        auto size_read = request.run(size, false);
+        memcpy(buf + offset, request.m_buf, size_read);
+        offset += size_read;
+        if (size_read < size) // stopped on a line break
+            break;
+    }
+    request.release();
+    return static_cast<ssize_t>(offset);
+}
 
+ssize_t UARTFile::write(char *buf, size_t size)
+{
     auto& request = uart_request();
-    request = UARTRequest(buf, at_most_bytes, false);
+    request.acquire();
+    size_t offset = 0;
+    while (offset < size) {
+        auto request_size = pine::min(size - offset, UARTRequest::buffer_size);
+        memcpy(request.m_buf, buf + offset, request_size);
+        offset += request.run(request_size, true);
+    }
+    request.release();
+    return static_cast<ssize_t>(offset);
+}
 
-    // Enable after creation, rather than in constructor, because we use the
-    // g_uart_resource handle in our static handle_irq() function; this is not
-    // set until after construction and enabling may cause an IRQ to be raised
-    request.enable_irq();
+void UARTRequest::acquire()
+{
+    InterruptDisabler disabler;
+    while (m_is_in_use)
+        uart_wait_queue().wait(disabler);
 
-    if (!request.is_finished())
-        reschedule_while_waiting_for(request);
+    m_is_in_use = true;
+}
 
-    PANIC_IF(!request.is_finished());
-    return static_cast<ssize_t>(request.size_read_or_written());
+void UARTRequest::release()
+{
+    InterruptDisabler disabler;
+    m_is_in_use = false;
+    uart_wait_queue().wake_all(disabler);
 }
 
-ssize_t UARTFile::write(char *buf, size_t size)
+size_t UARTRequest::run(size_t size, bool is_write_request)
 {
-    PANIC_MESSAGE_IF(!uart_request().is_finished(), "UART request already under operation!");
+    PANIC_MESSAGE_IF(!m_is_in_use, "UART request run without acquiring it!");
+    PANIC_MESSAGE_IF(!is_finished(), "UART request already under operation!");
+    PANIC_MESSAGE_IF(size > buffer_size, "UART request is larger than its buffer!");
 
-    auto& request = uart_request();
-    request = UARTRequest(buf, size, true);
+    m_size = 0;
+    m_capacity = size;
+    m_is_write_request = is_write_request;
 
-    // Enable after creation, rather than in constructor, because we use the
-    // g_uart_resource handle in our static handle_irq() function; this is not
-    // set until after construction and enabling may cause an IRQ to be raised
-    request.enable_irq();
+    auto& uart = uart_registers();
+    if (m_is_write_request)
+        uart.set_write_irq(m_capacity);
+    else
+        uart.set_read_irq(m_capacity);
 
-    if (!request.is_finished())
-        reschedule_while_waiting_for(request);
+    // Enable only once the request is set up, since enabling may cause an
+    // IRQ to be raised before this call ends
+    enable_irq();
 
-    PANIC_IF(!request.is_finished());
-    return static_cast<ssize_t>(request.size_read_or_written());
+    {
+        InterruptDisabler disabler;
+        while (!is_finished())
+            uart_wait_queue().wait(disabler);
+    }
+    return size_read_or_written();
 }
 
 void UARTRequest::enable_irq()
@@ -278,17 +324,13 @@ void UARTRequest::enable_irq()
         uart.enable_read_irq();
 }
 
-UARTRequest::UARTRequest(char *buf, size_t size, bool is_write_request)
-    : m_buf(buf)
-    , m_size(0)
-    , m_capacity(size)
-    , m_is_write_request(is_write_request)
+void UARTRequest::disable_irq()
 {
     auto& uart = uart_registers();
     if (m_is_write_request)
-        uart.set_write_irq(m_capacity - m_size);
+        uart.disable_write_irq();
     else
-        uart.set_read_irq(m_capacity - m_size);
+        uart.disable_read_irq();
 }
 
 void UARTRequest::fill_from_uart()
@@ -306,33 +348,45 @@ void UARTRequest::fill_from_uart()
     }
 }
 
-void UARTRequest::handle_irq(InterruptsDisabledTag)
+/*
+ * Filling the request echoes and copies a byte at a time, polling the UART,
+ * so it is left to the worker task and done with interrupts enabled.
+ */
+static Work& uart_fill_work()
 {
-    // We assume interrupts are disabled here, because we don't want nesting
-    // of reads/writes to occur.
+    static Work g_uart_fill_work { UARTRequest::handle_deferred_irq, nullptr };
+    return g_uart_fill_work;
+}
 
+void UARTRequest::handle_irq(InterruptsDisabledTag disabled_tag)
+{
+    // No more IRQs until the request is filled, which also keeps the filling
+    // from being interrupted by one of ours
     auto& uart = uart_registers();
     if (m_is_write_request)
         uart.clear_write_irq();
     else
         uart.clear_read_irq();
+    disable_irq();
 
-    fill_from_uart();
+    work_queue().queue(disabled_tag, uart_fill_work());
+}
 
-    if (m_size == m_capacity) {
-        // Disable it now, instead of in destructor, because we don't want any
-        // more IRQs (after returning from this IRQ) being raised that simply
-        // return when we handle it
-        if (m_is_write_request)
-            uart.disable_write_irq();
-        else
-            uart.disable_read_irq();
+void UARTRequest::handle_deferred_irq(void*)
+{
+    auto& request = uart_request();
+    request.fill_from_uart();
 
+    auto& uart = uart_registers();
+    InterruptDisabler disabler;
+    if (request.m_size == request.m_capacity) {
+        uart_wait_queue().wake_all(disabler);
         return;
     }
 
-    if (m_is_write_request)
-        uart.set_write_irq(m_capacity - m_size);
+    if (request.m_is_write_request)
+        uart.set_write_irq(request.m_capacity - request.m_size);
     else
-        uart.set_read_irq(m_capacity - m_size);
-}
\ No newline at end of file
+        uart.set_read_irq(request.m_capacity - request.m_size);
+    request.enable_irq();
+}
@@ -1,6 +1,5 @@
 #pragma once
 #include "../../file.hpp"
-#include "../../wait.hpp"
 #include "../../interrupt_disabler.hpp"
 
 #include <pine/maybe.hpp>
@@ -38,27 +37,45 @@
 #define GPPUD 0x3F200094
 #define GPPUDCLK0 0x3F200098
 
-class UARTRequest : public Waitable {
+/*
+ * The bytes in flight to or from the UART. They are copied in and out of the
+ * task's buffer by the task itself, since the request is filled by the
+ * worker task, which can't see the memory of other tasks. There is only the
+ * one, so a task holds it for the whole of a read or write; the others wait
+ * their turn.
+ */
+class UARTRequest {
 public:
-    ~UARTRequest() override = default;
-    bool is_finished() const override { return m_size == m_capacity; };
+    static constexpr size_t buffer_size = 128;
+
+    bool is_finished() const { return m_size == m_capacity; };
+    // Only quiets the UART; the request is filled later by the worker task
     void handle_irq(InterruptsDisabledTag disabled_tag);
+    // The bottom half of handle_irq(); see work.hpp
+    static void handle_deferred_irq(void*);
 
 private:
     UARTRequest() = default;
-    UARTRequest(char* buf, size_t size, bool is_write_request);
+    // Waits until no other task is using the request, then takes it
+    void acquire();
+    void release();
+    // Waits for the UART to read or write size bytes of m_buf, at most
+    // buffer_size, returning how many it did
+    size_t run(size_t size, bool is_write_request);
 
     friend class UARTFile;
     friend UARTRequest& uart_request();
 
     void fill_from_uart();
     void enable_irq();
+    void disable_irq();
     size_t size_read_or_written() const { return m_size; };
 
-    char* m_buf = nullptr;
+    char m_buf[buffer_size] {};
     size_t m_size = 0;
     size_t m_capacity = 0;
     bool m_is_write_request = false;
+    bool m_is_in_use = false;
 };
 
 UARTRequest& uart_request();
@@ -1,7 +1,37 @@
 #pragma once
 
+#include "../interrupt_disabler.hpp"
+#include "../lock.hpp"
+
+#include <pine/types.hpp>
+
 // These are implemented by the device/*/timer.cpp file
 
 void timer_init();
 
+/*
+ * Has the next timer IRQ come in the given number of jiffies (at least one),
+ * rather than on the next jiffy; lets the idle task sleep through ticks
+ * nothing is waiting for. Only lasts until the next timer IRQ.
+ */
+void timer_program_next_tick(InterruptsDisabledTag, u32 delay_jiffies);
+
+// Routes the timer's IRQ to us and checks for it; see device/interrupts.hpp
+void timer_enable_irq();
+bool timer_irq_pending();
+
+// Counts the jiffies that passed and runs the timers due
+void timer_handle_irq(InterruptsDisabledTag);
+
 u32 jiffies();
+
+#ifdef LOCK_STATS
+// Guards the jiffies; for its stats
+const SeqLock& timer_jiffy_lock();
+#endif
+
+/*
+ * Monotonic time since timer_init(), read from the free-running counter; the
+ * resolution is the counter's, not a jiffy.
+ */
+u64 uptime_ns();
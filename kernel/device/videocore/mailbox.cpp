@@ -1,5 +1,6 @@
 #include "mailbox.hpp"
 #include "../../arch/barrier.hpp"
+#include "../../arch/cache.hpp"
 #include "../../arch/panic.hpp"
 
 #include <pine/twomath.hpp>
@@ -32,11 +33,15 @@ bool MailboxRegisters::send_in_property_channel(u32* message_contents)
 {
     // See https://github.com/raspberrypi/firmware/wiki/Accessing-mailboxes
     auto message_addr = reinterpret_cast<PtrData>(message_contents);
-    PANIC_IF(!pine::is_aligned_two(message_addr, 16u));
+    PANIC_IF(!pine::is_aligned_two(message_addr, static_cast<PtrData>(MAILBOX_MESSAGE_ALIGNMENT)));
 
     // upper 28 msb are the message address, lower 4 lsb are the channel
     auto message = message_addr | static_cast<PtrData>(MailboxChannel::PropertyTagsSend);
 
+    // The message length in bytes comes first; see MAILBOX_MESSAGE_ALIGNMENT
+    auto message_size = pine::align_up_two(static_cast<size_t>(message_contents[0]), static_cast<size_t>(MAILBOX_MESSAGE_ALIGNMENT));
+    pine::DataCache::clean(message_contents, message_size);
+
     while (status() & MAILBOX_FULL) {};
 
     write(message);
@@ -47,6 +52,8 @@ bool MailboxRegisters::send_in_property_channel(u32* message_contents)
 
         // check if response to our message
         while (read() == message) {
+            // Nothing of ours shares its lines, so nothing needs writing back
+            pine::DataCache::invalidate(message_contents, message_size);
             if (message_contents[1] == MAILBOX_RESPONSE)
                 return true;
             if (message_contents[1] == MAILBOX_ERROR)
@@ -59,9 +66,8 @@ bool MailboxRegisters::send_in_property_channel(u32* message_contents)
 
 pine::Maybe<SerialNum> try_retrieve_serial_num_from_mailbox()
 {
-    // The message must be aligned to 16 bits as only the upper 28 bits are
-    // provided to the mailbox
-    static __attribute__((aligned(16))) u32 message_contents[8];
+    // Padded out to a whole cache line; see MAILBOX_MESSAGE_ALIGNMENT
+    static __attribute__((aligned(MAILBOX_MESSAGE_ALIGNMENT))) u32 message_contents[MAILBOX_MESSAGE_ALIGNMENT / sizeof(u32)];
 
     message_contents[0] = sizeof(message_contents);     // length of buffer
     message_contents[1] = MAILBOX_REQUEST;              // mark as request
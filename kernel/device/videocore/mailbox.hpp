@@ -19,6 +19,13 @@ enum class MailboxChannel : u32 {
     PropertyTagsRecieve = 9,
 };
 
+/*
+ * The VideoCore does not snoop our caches, so messages are cleaned before
+ * they are sent and invalidated once answered. Each must start on a cache
+ * line and take up whole lines, so that neither touches anything around it.
+ */
+#define MAILBOX_MESSAGE_ALIGNMENT 64
+
 /* tags */
 #define MAILBOX_TAG_GET_SERIAL      0x10004
 #define MAILBOX_END_TAG             0
@@ -27,27 +27,33 @@ ssize_t FileDescription::write(char *buf, size_t bytes) {
 
 FileDescription* FileTable::open(pine::StringView path, FileMode mode)
 {
-    pine::Maybe<KOwner<File>> maybe_file;
+    pine::Maybe<KCacheOwner<File>> maybe_file;
     if (path == "/dev/null") {
-        maybe_file = KOwner<DevNullFile>::try_create(kernel_allocator());
+        maybe_file = try_create_cached<DevNullFile>();
     }
     else if (path == "/dev/zero") {
-        maybe_file = KOwner<DevZeroFile>::try_create(kernel_allocator());
+        maybe_file = try_create_cached<DevZeroFile>();
     }
     else if (path == "/dev/uart0") {
-        maybe_file = KOwner<UARTFile>::try_create(kernel_allocator());
+        maybe_file = try_create_cached<UARTFile>();
     }
     else if (path == "/dev/display") {
-        maybe_file = KOwner<DisplayFile>::try_create(kernel_allocator());
+        maybe_file = try_create_cached<DisplayFile>();
     }
 
     if (!maybe_file)
         return nullptr;
 
-    if (!m_files.append(FileDescription(*pine::move(maybe_file), mode)))
+    auto [ptr, _] = object_cache<FileDescription>().allocate();
+    if (!ptr)
         return nullptr;
 
-    return &m_files[m_files.length() - 1];
+    return new (ptr) FileDescription(*pine::move(maybe_file), mode);
+}
+
+void FileTable::ref(FileDescription& file_description)
+{
+    ++file_description.m_ref_count;
 }
 
 void FileTable::close(FileDescription& file_description)
@@ -55,9 +61,31 @@ void FileTable::close(FileDescription& file_description)
     --file_description.m_ref_count;
     if (file_description.m_ref_count == 0) {
         file_description.FileDescription::~FileDescription();
+        object_cache<FileDescription>().free({ &file_description, sizeof(FileDescription) });
+    }
+}
+
+FileDescriptorTable::~FileDescriptorTable()
+{
+    for (auto* descriptor : m_descriptors) {
+        if (descriptor)
+            file_table().close(*descriptor);
     }
 }
 
+pine::Maybe<FileDescriptorTable> FileDescriptorTable::try_clone() const
+{
+    FileDescriptorTable clone;
+    for (auto* descriptor : m_descriptors) {
+        if (!clone.m_descriptors.append(static_cast<FileDescription*>(descriptor)))
+            return {};
+        if (descriptor)
+            file_table().ref(*descriptor);
+    }
+
+    return pine::move(clone);
+}
+
 int FileDescriptorTable::try_insert(FileDescription& description)
 {
     if (m_descriptors.length() > static_cast<size_t>(pine::limits<int>::max))
@@ -140,5 +168,9 @@ int FileDescriptorTable::dup(int fd)
     if (!descriptor)
         return -EBADF;
 
-    return try_insert(*descriptor);
+    int new_fd = try_insert(*descriptor);
+    if (new_fd >= 0)
+        file_table().ref(*descriptor);
+
+    return new_fd;
 }
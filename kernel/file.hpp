@@ -19,12 +19,12 @@ public:
 private:
     friend class FileTable;
 
-    FileDescription(KOwner<File> file, FileMode mode)
+    FileDescription(KCacheOwner<File> file, FileMode mode)
         : m_file(pine::move(file))
         , m_mode(mode)
         , m_ref_count(1) {};
 
-    KOwner<File> m_file;
+    KCacheOwner<File> m_file;
     FileMode m_mode;
     unsigned m_ref_count;
 };
@@ -32,16 +32,23 @@ private:
 class FileTable {
 public:
     FileDescription* open(pine::StringView path, FileMode mode);
+    // Another descriptor refers to it, which must be closed as well
+    void ref(FileDescription&);
     void close(FileDescription&);
-
-private:
-    KVector<FileDescription> m_files { kernel_allocator() };
 };
 
 FileTable& file_table();
 
 class FileDescriptorTable {
 public:
+    FileDescriptorTable() = default;
+    ~FileDescriptorTable();
+    FileDescriptorTable(FileDescriptorTable&&) = default;
+    FileDescriptorTable& operator=(FileDescriptorTable&&) = default;
+
+    // The same descriptions under the same descriptors, for fork()
+    pine::Maybe<FileDescriptorTable> try_clone() const;
+
     int open(pine::StringView path, FileMode mode);
     FileDescription* try_get(int fd);
     int close(int fd);
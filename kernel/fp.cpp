@@ -0,0 +1,70 @@
+#include "fp.hpp"
+#include "arch/processor.hpp"
+#include "smp.hpp"
+
+// The task whose registers each core has loaded, if any
+static FPState* g_fp_owners[NUM_CORES];
+// Whether each core has them enabled; only ever while its owner runs
+static bool g_fp_enabled[NUM_CORES];
+
+static bool is_owner(const FPState& state, unsigned core)
+{
+    return g_fp_owners[core] == &state && state.is_loaded && state.loaded_core == core;
+}
+
+void fp_init()
+{
+    fp_init_core();
+    g_fp_owners[core_id()] = nullptr;
+    g_fp_enabled[core_id()] = false;
+}
+
+void fp_switch_out(InterruptsDisabledTag, FPState& from)
+{
+    if (g_fp_enabled[core_id()])
+        fp_save(&from.registers);
+}
+
+void fp_switch_in(InterruptsDisabledTag, FPState& to)
+{
+    auto core = core_id();
+    bool should_enable = is_owner(to, core);
+    if (should_enable == g_fp_enabled[core])
+        return;
+
+    if (should_enable)
+        fp_enable();
+    else
+        fp_disable();
+    g_fp_enabled[core] = should_enable;
+}
+
+void fp_copy(InterruptsDisabledTag, const FPState& running, FPState& copy)
+{
+    // While enabled, the saved registers are out of date
+    if (g_fp_enabled[core_id()])
+        fp_save(&copy.registers);
+    else
+        copy.registers = running.registers;
+
+    copy.is_loaded = false;
+}
+
+bool fp_handle_trap(InterruptsDisabledTag, FPState& running)
+{
+    auto core = core_id();
+    if (g_fp_enabled[core])
+        return false;
+
+    fp_enable();
+    g_fp_enabled[core] = true;
+    if (is_owner(running, core))
+        return true;
+
+    // The last owner was saved when it was switched away from
+    fp_restore(&running.registers);
+    g_fp_owners[core] = &running;
+    running.is_loaded = true;
+    running.loaded_core = core;
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "arch/fp.hpp"
+#include "interrupt_disabler.hpp"
+
+#include <pine/types.hpp>
+
+/*
+ * Tasks' FP/SIMD registers are switched lazily, since most tasks never use
+ * them. Each core keeps them disabled until the running task first uses
+ * them, and only then loads that task's registers and makes it the core's
+ * owner. Switching between tasks that don't use them costs nothing more.
+ *
+ * An owner's registers are saved as soon as it is switched away from (not
+ * when another task first uses them), since it may well be run by another
+ * core next. Switching back to it on the same core, with nothing else having
+ * used them since, enables them again without loading anything.
+ */
+struct FPState {
+    FPRegisters registers {};
+    // Where its registers were last loaded; they are still there only while
+    // it is that core's owner. Owners are compared by address, so this also
+    // keeps a task from being mistaken for one that exited
+    bool is_loaded = false;
+    unsigned loaded_core = 0;
+};
+
+// Called by each core once, before it starts scheduling
+void fp_init();
+
+// Called with the task being switched away from and the one switched to
+void fp_switch_out(InterruptsDisabledTag, FPState&);
+void fp_switch_in(InterruptsDisabledTag, FPState&);
+
+// Gives a task forked from the running one a copy of its registers
+void fp_copy(InterruptsDisabledTag, const FPState& running, FPState& copy);
+
+// Called when the running task used the FP/SIMD registers with them
+// disabled; returns whether it can now retry, rather than having faulted
+bool fp_handle_trap(InterruptsDisabledTag, FPState& running);
@@ -1,4 +1,5 @@
 #ifdef AARCH64
+#include "arch/aarch64/mmu.hpp"
 #elif AARCH32
 #include "arch/aarch32/mmu.hpp"
 #else
@@ -14,10 +15,12 @@
 #include "device/videocore/mailbox.hpp"
 #include "tasks.hpp"
 
+#include <pine/c_builtins.hpp>
 #include <pine/types.hpp>
 
 extern "C" {
 void init();  // Export init symbol as C
+void secondary_init();
 }
 
 /*
@@ -47,10 +50,9 @@ void init()
     interrupts_init();
     uart_init();
     console("Initializing... ");
-#ifndef AARCH64
     console("memory ");
     mmu_init();
-#endif
+    pine::enable_cache_block_zeroing();
     console("timer ");
     timer_init();
     console("display");
@@ -68,3 +70,12 @@ void init()
 
     tasks_init();
 }
+
+/*
+ * Where the secondary cores end up once the boot core starts them, with their
+ * MMU on; see smp_start_secondary_cores().
+ */
+void secondary_init()
+{
+    tasks_init();
+}
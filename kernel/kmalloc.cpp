@@ -7,7 +7,7 @@ extern size_t __code_end;
 KernelMemoryAllocator& kernel_allocator()
 {
 #ifdef AARCH64
-    static auto g_fixed_kernel_memory_allocator = pine::FixedAllocation(pine::align_up_two(reinterpret_cast<size_t>(&__code_end), PageSize), 32 * MiB);
+    static auto g_fixed_kernel_memory_allocator = pine::FixedAllocation(pine::align_up_two(reinterpret_cast<size_t>(&__code_end), PageSize), mmu::KernelHeapSize);
     static auto g_kernel_memory_allocator = KernelMemoryAllocator(&g_fixed_kernel_memory_allocator);
 #elif AARCH32
     static auto g_kernel_memory_allocator = KernelMemoryAllocator(&mmu::page_allocator());
@@ -17,6 +17,17 @@ KernelMemoryAllocator& kernel_allocator()
     return g_kernel_memory_allocator;
 }
 
+KernelPageAllocator& kernel_page_allocator()
+{
+#ifdef AARCH64
+    return mmu::kernel_page_allocator();
+#elif AARCH32
+    return mmu::page_allocator();
+#else
+#error Architecture not defined
+#endif
+}
+
 pine::Allocation kmalloc(size_t requested_size)
 {
     return kernel_allocator().allocate(requested_size);
@@ -26,3 +37,15 @@ void kfree(pine::Allocation alloc)
 {
     kernel_allocator().free(alloc);
 }
+
+bool try_zero_free_page()
+{
+#ifdef AARCH64
+    // The heap is a single fixed region; there are no pages to hand out
+    return false;
+#elif AARCH32
+    return mmu::page_allocator().try_zero_free_page();
+#else
+#error Architecture not defined
+#endif
+}
@@ -9,6 +9,7 @@
 #include <pine/vector.hpp>
 
 #ifdef AARCH64
+#include "arch/aarch64/mmu.hpp"
 #elif AARCH32
 #include "arch/aarch32/mmu.hpp"
 #else
@@ -16,17 +17,32 @@
 #endif
 
 #ifdef AARCH64
-using KernelMemoryAllocator = pine::FallbackAllocatorBinder<pine::FixedAllocation, pine::IntrusiveFreeList>;
+using KernelMemoryAllocator = pine::FallbackAllocatorBinder<pine::FixedAllocation, pine::TLSFAllocator>;
 #else
-using KernelMemoryAllocator = pine::FallbackAllocatorBinder<mmu::PageAllocator, pine::IntrusiveFreeList>;
+using KernelMemoryAllocator = pine::FallbackAllocatorBinder<mmu::PageAllocator, pine::TLSFAllocator>;
 #endif
 
 KernelMemoryAllocator& kernel_allocator();
 
+// Hands out aligned pages, for object caches
+#ifdef AARCH64
+using KernelPageAllocator = mmu::KernelPageAllocator;
+#else
+using KernelPageAllocator = mmu::PageAllocator;
+#endif
+
+KernelPageAllocator& kernel_page_allocator();
+
 void kfree(pine::Allocation);
 
 pine::Allocation kmalloc(size_t);
 
+/*
+ * Zeroes a free page ahead of time, if the architecture's page allocator
+ * keeps a pool of them. Returns false when there is nothing left to do.
+ */
+bool try_zero_free_page();
+
 template <class Value>
 using KOwner = pine::Owner<Value, KernelMemoryAllocator>;
 
@@ -34,3 +50,47 @@ template <class Value>
 using KVector = pine::Vector<Value, KernelMemoryAllocator>;
 
 using KString = pine::String<KernelMemoryAllocator>;
+
+template <class Value>
+using KObjectCache = pine::ObjectCache<Value, KernelPageAllocator>;
+
+/*
+ * The kernel's cache of Value objects, carved out of whole pages the first
+ * time it is used.
+ */
+template <class Value>
+KObjectCache<Value>& object_cache()
+{
+    static KObjectCache<Value> g_object_cache { &kernel_page_allocator(), KObjectCache<Value>::objects_per_page() };
+    return g_object_cache;
+}
+
+/*
+ * Owns an object allocated out of an object_cache(); may point to a base
+ * class of the cached type.
+ */
+template <class Value>
+using KCacheOwner = pine::Owner<Value, pine::ObjectAllocator>;
+
+template <class Value, class... Args>
+pine::Maybe<KCacheOwner<Value>> try_create_cached(Args&&... args)
+{
+    return KCacheOwner<Value>::try_create(object_cache<Value>(), pine::forward<Args>(args)...);
+}
+
+/*
+ * A string allocated out of an object cache rather than the kernel heap; for
+ * short names that come and go with the objects they name.
+ */
+using KShortString = pine::String<pine::ObjectAllocator>;
+
+struct KShortStringStorage {
+    char chars[32];
+};
+
+// Longer strings are truncated to fit
+inline pine::Maybe<KShortString> try_create_short_string(const char* from)
+{
+    auto length = pine::min(pine::strlen(from), sizeof(KShortStringStorage::chars) - 1);  // - '\0'
+    return KShortString::try_create(object_cache<KShortStringStorage>(), from, length);
+}
@@ -0,0 +1,122 @@
+#include "lock.hpp"
+#include "arch/generic_timer.hpp"
+#include "arch/panic.hpp"
+
+#ifdef LOCK_STATS
+static u64 lock_stats_count()
+{
+    return GenericTimer::count();
+}
+
+void print_with(pine::Printer& printer, const LockStats& stats)
+{
+    print_each_with_spacing(printer, "acquisitions:", stats.acquisitions, "contentions:", stats.contentions,
+                            "wait:", stats.wait_counts, "hold:", stats.hold_counts, "max hold:", stats.max_hold_counts);
+}
+#endif
+
+void SpinLock::lock()
+{
+#ifdef LOCK_STATS
+    auto wait_start_count = lock_stats_count();
+#else
+    u64 wait_start_count = 0;
+#endif
+
+    // The ticket is taken with a load/store exclusive pair (LDXR/STXR, or
+    // LDADD with LSE, on aarch64; LDREX/STREX on armv7) that orders nothing;
+    // the acquire is the load of m_now_serving below, which is all that
+    // waiting for it needs
+    auto ticket = __atomic_fetch_add(&m_next_ticket, 1, __ATOMIC_RELAXED);
+    bool was_contended = false;
+    while (__atomic_load_n(&m_now_serving, __ATOMIC_ACQUIRE) != ticket) {
+        was_contended = true;
+        spin_loop_hint();
+    }
+
+    acquired(wait_start_count, was_contended);
+}
+
+bool SpinLock::try_lock()
+{
+    // Only if nobody holds or waits for it, by taking the ticket being served
+    auto now_serving = __atomic_load_n(&m_now_serving, __ATOMIC_RELAXED);
+    auto expected = now_serving;
+    if (!__atomic_compare_exchange_n(&m_next_ticket, &expected, static_cast<u16>(now_serving + 1), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+
+#ifdef LOCK_STATS
+    acquired(lock_stats_count(), false);
+#else
+    acquired(0, false);
+#endif
+    return true;
+}
+
+void SpinLock::acquired([[maybe_unused]] u64 wait_start_count, [[maybe_unused]] bool was_contended)
+{
+#ifdef LOCK_STATS
+    m_acquired_count = lock_stats_count();
+    m_stats.acquisitions++;
+    m_stats.contentions += was_contended;
+    m_stats.wait_counts += m_acquired_count - wait_start_count;
+#endif
+}
+
+void SpinLock::unlock()
+{
+    PANIC_MESSAGE_IF(!is_locked(), "Unlocking a spin lock that is not locked!");
+
+#ifdef LOCK_STATS
+    auto held_counts = lock_stats_count() - m_acquired_count;
+    m_stats.hold_counts += held_counts;
+    if (held_counts > m_stats.max_hold_counts)
+        m_stats.max_hold_counts = held_counts;
+#endif
+
+    // Only the holder writes this, so it doesn't need to be exclusive
+    auto now_serving = __atomic_load_n(&m_now_serving, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_now_serving, static_cast<u16>(now_serving + 1), __ATOMIC_RELEASE);
+}
+
+bool SpinLock::is_locked() const
+{
+    return __atomic_load_n(&m_next_ticket, __ATOMIC_RELAXED) != __atomic_load_n(&m_now_serving, __ATOMIC_RELAXED);
+}
+
+u32 SeqLock::read_begin() const
+{
+    u32 sequence;
+    while ((sequence = __atomic_load_n(&m_sequence, __ATOMIC_ACQUIRE)) & 1)
+        spin_loop_hint();
+
+    return sequence;
+}
+
+bool SeqLock::read_retry(u32 sequence) const
+{
+    // The reads of the data must happen before we check it wasn't written
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    bool should_retry = __atomic_load_n(&m_sequence, __ATOMIC_RELAXED) != sequence;
+
+#ifdef LOCK_STATS
+    __atomic_fetch_add(&m_read_stats.acquisitions, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&m_read_stats.contentions, should_retry, __ATOMIC_RELAXED);
+#endif
+    return should_retry;
+}
+
+void SeqLock::write_lock(InterruptsDisabledTag)
+{
+    m_writer_lock.lock();
+
+    // Readers must see the sequence go odd before any of the writes
+    __atomic_store_n(&m_sequence, m_sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void SeqLock::write_unlock(InterruptsDisabledTag)
+{
+    __atomic_store_n(&m_sequence, m_sequence + 1, __ATOMIC_RELEASE);
+    m_writer_lock.unlock();
+}
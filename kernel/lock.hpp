@@ -0,0 +1,116 @@
+#pragma once
+#include "arch/processor.hpp"
+#include "interrupt_disabler.hpp"
+
+#include <pine/print.hpp>
+#include <pine/types.hpp>
+
+/*
+ * Kernel locks for data shared between cores. They spin rather than sleep, so
+ * keep what they guard short; use a WaitQueue to wait for longer.
+ *
+ * A lock also taken by an IRQ handler must be held with interrupts disabled,
+ * or an IRQ on the same core spins on it forever; see KernelLock, which
+ * masks them itself.
+ *
+ * Build with LOCK_STATS=1 to have each lock count how often it was contended
+ * and for how long it was waited on and held, in generic timer counts.
+ */
+
+#ifdef LOCK_STATS
+struct LockStats {
+    u32 acquisitions = 0;
+    u32 contentions = 0;  // acquisitions that had to wait
+    u64 wait_counts = 0;
+    u64 hold_counts = 0;
+    u64 max_hold_counts = 0;
+
+    friend void print_with(pine::Printer&, const LockStats&);
+};
+#endif
+
+/*
+ * A ticket lock: cores get the lock in the order they asked for it, so no
+ * core can be starved by the others.
+ */
+class SpinLock {
+public:
+    SpinLock() = default;
+    SpinLock(const SpinLock&) = delete;
+    SpinLock& operator=(const SpinLock&) = delete;
+
+    void lock();
+    bool try_lock();
+    void unlock();
+
+    bool is_locked() const;
+
+#ifdef LOCK_STATS
+    const LockStats& stats() const { return m_stats; }
+#endif
+
+private:
+    void acquired(u64 wait_start_count, bool was_contended);
+
+    u16 m_next_ticket = 0;
+    u16 m_now_serving = 0;
+#ifdef LOCK_STATS
+    LockStats m_stats;
+    u64 m_acquired_count = 0;
+#endif
+};
+
+/*
+ * For small read-mostly data, like the clock. Readers never block the writer
+ * (nor each other); they retry if a write happened while they were reading:
+ *
+ *     u32 sequence;
+ *     do {
+ *         sequence = seqlock.read_begin();
+ *         value = data;
+ *     } while (seqlock.read_retry(sequence));
+ *
+ * Writers must have interrupts disabled, so that a reader can't interrupt
+ * them and wait for the write to finish forever.
+ */
+class SeqLock {
+public:
+    SeqLock() = default;
+    SeqLock(const SeqLock&) = delete;
+    SeqLock& operator=(const SeqLock&) = delete;
+
+    u32 read_begin() const;
+    bool read_retry(u32 sequence) const;
+
+    void write_lock(InterruptsDisabledTag);
+    void write_unlock(InterruptsDisabledTag);
+
+#ifdef LOCK_STATS
+    // A contention here is a read that had to be retried
+    const LockStats& read_stats() const { return m_read_stats; }
+    const LockStats& write_stats() const { return m_writer_lock.stats(); }
+#endif
+
+private:
+    SpinLock m_writer_lock;
+    u32 m_sequence = 0;  // odd while being written
+#ifdef LOCK_STATS
+    mutable LockStats m_read_stats;
+#endif
+};
+
+template <typename Lock>
+struct Locker {
+    explicit Locker(Lock& lock)
+        : m_lock(lock)
+    {
+        m_lock.lock();
+    }
+    ~Locker() { m_lock.unlock(); }
+
+    Locker(const Locker&) = delete;
+    Locker(Locker&&) = delete;
+
+private:
+    Lock& m_lock;
+};
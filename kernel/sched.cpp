@@ -0,0 +1,408 @@
+#include "sched.hpp"
+#include "tasks.hpp"
+#include "device/timer.hpp"
+
+#include <pine/math.hpp>
+#include <pine/twomath.hpp>
+
+// Each nice level is worth about 10% of the CPU against a task one level
+// apart, so each is ~1.25x the weight of the next; the same table as Linux
+static constexpr u32 g_nice_to_weight[FairRunQueue::max_nice - FairRunQueue::min_nice + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548, 7620, 6100, 4904, 3906,
+    /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+    /*   0 */ 1024, 820, 655, 526, 423,
+    /*   5 */ 335, 272, 215, 172, 137,
+    /*  10 */ 110, 87, 70, 56, 45,
+    /*  15 */ 36, 29, 23, 18, 15,
+};
+static constexpr u32 nice_0_weight = 1024;
+
+// How long it should take for every queued task to get a turn. Slices only
+// expire on a tick though, so with few ticks per second they are longer
+static constexpr u64 latency_ns = 20'000'000;
+// Past this many tasks, they each get this long instead
+static constexpr u64 min_slice_ns = 4'000'000;
+// How much less a woken task must have run to preempt the running one; more
+// preemption than this costs more in switches than it gains in latency
+static constexpr u64 wakeup_granularity_ns = 2'000'000;
+
+u32 FairRunQueue::weight_of(int nice)
+{
+    return g_nice_to_weight[nice - min_nice];
+}
+
+FairTaskState& FairRunQueue::state_of(Task& task)
+{
+    return task.m_fair;
+}
+
+const FairTaskState& FairRunQueue::state_of(const Task& task)
+{
+    return task.m_fair;
+}
+
+// Compared by their difference, so either may be relative (and "negative")
+static bool is_before(u64 first_vruntime, u64 second_vruntime)
+{
+    return static_cast<i64>(first_vruntime - second_vruntime) < 0;
+}
+
+static u64 to_vruntime(u64 ns, u32 weight)
+{
+    if (weight == nice_0_weight)
+        return ns;
+
+    return pine::divmod(ns * nice_0_weight, weight).first;
+}
+
+bool FairRunQueue::Traits::less(const Task& first, const Task& second)
+{
+    return is_before(state_of(first).vruntime, state_of(second).vruntime);
+}
+
+void FairRunQueue::attach(Task& running)
+{
+    // As if it were new, so that changing classes can't be used to skip ahead
+    auto& state = state_of(running);
+    state.vruntime = m_min_vruntime;
+    state.slice_ns = 0;
+}
+
+void FairRunQueue::enqueue(Task& task, EnqueueReason reason)
+{
+    auto& state = state_of(task);
+    switch (reason) {
+    case EnqueueReason::New:
+        state.vruntime = m_min_vruntime;
+        break;
+
+    case EnqueueReason::Woken: {
+        // However long it slept, it gets at most half a latency period ahead
+        // of the others; enough to preempt tasks hogging the CPU, but not
+        // enough to then hog it in turn
+        state.vruntime += m_min_vruntime;
+        auto earliest_vruntime = m_min_vruntime - latency_ns / 2;
+        if (is_before(state.vruntime, earliest_vruntime))
+            state.vruntime = earliest_vruntime;
+        break;
+    }
+
+    case EnqueueReason::Migrated:
+        state.vruntime += m_min_vruntime;
+        break;
+
+    case EnqueueReason::Preempted:
+        break;
+    }
+
+    m_tasks.insert(task);
+    m_total_weight += weight_of(state.nice);
+}
+
+void FairRunQueue::remove(Task& task)
+{
+    m_tasks.remove(task);
+    m_total_weight -= weight_of(state_of(task).nice);
+}
+
+Task* FairRunQueue::pick_next()
+{
+    auto* task = m_tasks.first();
+    if (!task)
+        return nullptr;
+
+    remove(*task);
+    state_of(*task).slice_ns = 0;
+    update_min_vruntime(task);
+    return task;
+}
+
+Task* FairRunQueue::take_for_migration()
+{
+    // The one next in line has waited the longest
+    auto* task = m_tasks.first();
+    if (!task)
+        return nullptr;
+
+    remove(*task);
+    state_of(*task).vruntime -= m_min_vruntime;
+    return task;
+}
+
+void FairRunQueue::charge(Task& running, u64 ran_ns)
+{
+    auto& state = state_of(running);
+    state.vruntime += to_vruntime(ran_ns, weight_of(state.nice));
+    state.slice_ns += ran_ns;
+    update_min_vruntime(&running);
+}
+
+void FairRunQueue::blocked(Task& running)
+{
+    // Kept relative, since it may be woken onto another core's queue
+    state_of(running).vruntime -= m_min_vruntime;
+}
+
+void FairRunQueue::yielded(Task& running)
+{
+    // Queued behind the next in line, so that it runs next
+    auto& state = state_of(running);
+    auto* first = m_tasks.first();
+    if (first && is_before(state.vruntime, state_of(*first).vruntime))
+        state.vruntime = state_of(*first).vruntime;
+}
+
+bool FairRunQueue::slice_expired(const Task& running) const
+{
+    if (m_tasks.is_empty())
+        return false;
+
+    auto& state = state_of(running);
+    auto weight = weight_of(state.nice);
+    auto slice_ns = pine::divmod(latency_ns * weight, m_total_weight + weight).first;
+    return state.slice_ns >= pine::max(slice_ns, min_slice_ns);
+}
+
+bool FairRunQueue::should_preempt(const Task& running, const Task& enqueued) const
+{
+    auto& enqueued_state = state_of(enqueued);
+    auto granularity = to_vruntime(wakeup_granularity_ns, weight_of(enqueued_state.nice));
+    return is_before(enqueued_state.vruntime + granularity, state_of(running).vruntime);
+}
+
+void FairRunQueue::update_min_vruntime(const Task* running)
+{
+    auto* first = m_tasks.first();
+    if (!running && !first)
+        return;
+
+    u64 vruntime;
+    if (running && first)
+        vruntime = Traits::less(*running, *first) ? state_of(*running).vruntime : state_of(*first).vruntime;
+    else
+        vruntime = running ? state_of(*running).vruntime : state_of(*first).vruntime;
+
+    if (is_before(m_min_vruntime, vruntime))
+        m_min_vruntime = vruntime;
+}
+
+// Tasks of the same priority take turns this often
+static constexpr u64 real_time_slice_ns = 100'000'000;
+
+RealTimeTaskState& RealTimeRunQueue::state_of(Task& task)
+{
+    return task.m_real_time;
+}
+
+const RealTimeTaskState& RealTimeRunQueue::state_of(const Task& task)
+{
+    return task.m_real_time;
+}
+
+u32 RealTimeRunQueue::highest_queued_priority() const
+{
+    return 31 - pine::countl_zero(m_queued_priorities);
+}
+
+void RealTimeRunQueue::attach(Task& running)
+{
+    state_of(running).slice_ns = 0;
+}
+
+void RealTimeRunQueue::enqueue(Task& task, EnqueueReason reason)
+{
+    // Only those done with their slice go to the back
+    auto& state = state_of(task);
+    auto& queue = m_queues[state.priority];
+    if (reason == EnqueueReason::Preempted && state.slice_ns < real_time_slice_ns) {
+        queue.insert_before(queue.front(), task);
+    }
+    else {
+        state.slice_ns = 0;
+        queue.append(task);
+    }
+
+    m_queued_priorities |= 1u << state.priority;
+    m_length++;
+}
+
+Task* RealTimeRunQueue::pick_next()
+{
+    if (m_length == 0)
+        return nullptr;
+
+    auto priority = highest_queued_priority();
+    auto& queue = m_queues[priority];
+    auto* task = queue.take_front();
+    if (queue.is_empty())
+        m_queued_priorities &= ~(1u << priority);
+
+    m_length--;
+    return task;
+}
+
+void RealTimeRunQueue::charge(Task& running, u64 ran_ns)
+{
+    state_of(running).slice_ns += ran_ns;
+}
+
+void RealTimeRunQueue::yielded(Task& running)
+{
+    state_of(running).slice_ns = real_time_slice_ns;
+}
+
+bool RealTimeRunQueue::slice_expired(const Task& running) const
+{
+    if (m_length == 0)
+        return false;
+
+    auto& state = state_of(running);
+    auto priority = highest_queued_priority();
+    return priority > state.priority || (priority == state.priority && state.slice_ns >= real_time_slice_ns);
+}
+
+bool RealTimeRunQueue::should_preempt(const Task& running, const Task& enqueued) const
+{
+    return state_of(enqueued).priority > state_of(running).priority;
+}
+
+// Bandwidths are fractions of a core, with this many bits after the point
+static constexpr unsigned bandwidth_shift = 20;
+// The rest of the core is left for the other classes
+static constexpr u32 max_total_bandwidth = (1u << bandwidth_shift) / 20 * 19;
+
+DeadlineTaskState& DeadlineRunQueue::state_of(Task& task)
+{
+    return task.m_deadline;
+}
+
+const DeadlineTaskState& DeadlineRunQueue::state_of(const Task& task)
+{
+    return task.m_deadline;
+}
+
+bool DeadlineRunQueue::Traits::less(const Task& first, const Task& second)
+{
+    return state_of(first).deadline_ns < state_of(second).deadline_ns;
+}
+
+bool DeadlineRunQueue::are_valid_params(u64 runtime_ns, u64 period_ns)
+{
+    return runtime_ns > 0 && runtime_ns <= period_ns && period_ns >= min_period_ns && period_ns <= max_period_ns;
+}
+
+bool DeadlineRunQueue::try_admit(Task& running, u64 runtime_ns, u64 period_ns)
+{
+    auto& state = state_of(running);
+    auto bandwidth = static_cast<u32>(pine::divmod(runtime_ns << bandwidth_shift, static_cast<u32>(period_ns)).first);
+    if (m_total_bandwidth - state.bandwidth + bandwidth > max_total_bandwidth)
+        return false;
+
+    m_total_bandwidth = m_total_bandwidth - state.bandwidth + bandwidth;
+    state.bandwidth = bandwidth;
+    state.runtime_ns = runtime_ns;
+    state.period_ns = period_ns;
+    return true;
+}
+
+void DeadlineRunQueue::release(Task& running)
+{
+    auto& state = state_of(running);
+    m_total_bandwidth -= state.bandwidth;
+    state.bandwidth = 0;
+}
+
+void DeadlineRunQueue::attach(Task& running)
+{
+    auto& state = state_of(running);
+    state.deadline_ns = uptime_ns() + state.period_ns;
+    state.remaining_ns = state.runtime_ns;
+}
+
+void DeadlineRunQueue::enqueue(Task& task, EnqueueReason reason)
+{
+    // A task waking up keeps its deadline only if it can still use what it
+    // has left at no more than its bandwidth: remaining / (deadline - now)
+    // <= runtime / period. Otherwise it would take from the others
+    auto& state = state_of(task);
+    if (reason != EnqueueReason::Preempted) {
+        auto now_ns = uptime_ns();
+        if (state.deadline_ns <= now_ns || state.remaining_ns * state.period_ns > (state.deadline_ns - now_ns) * state.runtime_ns) {
+            state.deadline_ns = now_ns + state.period_ns;
+            state.remaining_ns = state.runtime_ns;
+        }
+    }
+
+    if (state.remaining_ns == 0)
+        m_throttled_tasks.insert(task);
+    else
+        m_tasks.insert(task);
+}
+
+void DeadlineRunQueue::replenish()
+{
+    auto now_ns = uptime_ns();
+    while (auto* task = m_throttled_tasks.first()) {
+        auto& state = state_of(*task);
+        if (state.deadline_ns > now_ns)
+            break;
+
+        m_throttled_tasks.remove(*task);
+        state.deadline_ns += state.period_ns;
+        if (state.deadline_ns <= now_ns)  // replenished late, e.g. while tickless
+            state.deadline_ns = now_ns + state.period_ns;
+        state.remaining_ns = state.runtime_ns;
+        m_tasks.insert(*task);
+    }
+}
+
+Task* DeadlineRunQueue::pick_next()
+{
+    replenish();
+    auto* task = m_tasks.first();
+    if (task)
+        m_tasks.remove(*task);
+
+    return task;
+}
+
+void DeadlineRunQueue::charge(Task& running, u64 ran_ns)
+{
+    auto& state = state_of(running);
+    state.remaining_ns -= pine::min(ran_ns, state.remaining_ns);
+
+    auto now_ns = uptime_ns();
+    if (state.deadline_ns <= now_ns) {
+        // A task that is blocking had nothing left to run, so what is left of
+        // its runtime went unused rather than unserved
+        if (state.remaining_ns > 0 && running.can_run())
+            state.misses++;
+
+        state.deadline_ns = now_ns + state.period_ns;
+        state.remaining_ns = state.runtime_ns;
+    }
+    // Otherwise, once it has run for all of its runtime it is throttled until
+    // its deadline; see replenish()
+}
+
+void DeadlineRunQueue::yielded(Task& running)
+{
+    // Done for this period, so throttled until the next
+    state_of(running).remaining_ns = 0;
+}
+
+bool DeadlineRunQueue::slice_expired(const Task& running) const
+{
+    if (state_of(running).remaining_ns == 0)
+        return true;
+
+    auto* first = m_tasks.first();
+    return first && Traits::less(*first, running);
+}
+
+bool DeadlineRunQueue::should_preempt(const Task& running, const Task& enqueued) const
+{
+    return Traits::less(enqueued, running);
+}
@@ -0,0 +1,245 @@
+#pragma once
+#include "wait.hpp"
+
+#include <pine/rb_tree.hpp>
+#include <pine/syscall.hpp>
+#include <pine/types.hpp>
+
+class Task;
+
+enum class EnqueueReason {
+    New,        // it has never run
+    Woken,      // it was blocked; see RunQueue::blocked()
+    Preempted,  // it was running on this core (or yielded)
+    Migrated,   // from another core; see RunQueue::take_for_migration()
+};
+
+/*
+ * The runnable tasks of one scheduling class on one core, other than the one
+ * running. The task manager tells it what the running task does, and asks it
+ * what to run next and whether to switch away sooner. Each class only ever
+ * runs when the classes above it have nothing to run; see SchedPolicy.
+ */
+class RunQueue {
+public:
+    virtual size_t length() const = 0;
+    bool is_empty() const { return length() == 0; }
+
+    // The running task just joined the class
+    virtual void attach(Task& running) = 0;
+
+    virtual void enqueue(Task&, EnqueueReason) = 0;
+    // Takes off the task that should run next, if any
+    virtual Task* pick_next() = 0;
+    // Takes off a task to be enqueued on another core, if any
+    virtual Task* take_for_migration() = 0;
+
+    // The running task ran for a while longer
+    virtual void charge(Task& running, u64 ran_ns) = 0;
+    // The running task can't run until it is woken
+    virtual void blocked(Task& running) = 0;
+    // The running task is about to be enqueued, but lets the others go first
+    virtual void yielded(Task& running) = 0;
+
+    // Whether the running task has had its share for now
+    virtual bool slice_expired(const Task& running) const = 0;
+    // Whether a task that was just enqueued should run instead
+    virtual bool should_preempt(const Task& running, const Task& enqueued) const = 0;
+
+protected:
+    ~RunQueue() = default;
+};
+
+/*
+ * Embedded in every Task; what FairRunQueue keeps track of for it.
+ */
+struct FairTaskState {
+    // The time it has run, scaled by its weight. While blocked or migrating,
+    // this is relative to the min_vruntime of the queue it left
+    u64 vruntime = 0;
+    // The time it has run since it was last picked
+    u64 slice_ns = 0;
+    int nice = 0;
+    pine::RBTreeLink<Task> link;
+};
+
+/*
+ * Shares the CPU between tasks by weight, like Linux's CFS: the task that
+ * has had the least (weighted) time runs next, for a slice of the latency
+ * period in proportion to its weight. Tasks that slept come back with a small
+ * head start, so they preempt the ones hogging the CPU and interactive tasks
+ * stay responsive.
+ */
+class FairRunQueue final : public RunQueue {
+public:
+    static constexpr int min_nice = -20;
+    static constexpr int max_nice = 19;
+    static u32 weight_of(int nice);
+
+    FairRunQueue() = default;
+    FairRunQueue(const FairRunQueue&) = delete;
+    FairRunQueue& operator=(const FairRunQueue&) = delete;
+
+    size_t length() const override { return m_tasks.size(); }
+
+    void attach(Task& running) override;
+    void enqueue(Task&, EnqueueReason) override;
+    Task* pick_next() override;
+    Task* take_for_migration() override;
+
+    void charge(Task& running, u64 ran_ns) override;
+    void blocked(Task& running) override;
+    void yielded(Task& running) override;
+
+    bool slice_expired(const Task& running) const override;
+    bool should_preempt(const Task& running, const Task& enqueued) const override;
+
+private:
+    static FairTaskState& state_of(Task&);
+    static const FairTaskState& state_of(const Task&);
+
+    struct Traits {
+        static pine::RBTreeLink<Task>& link(Task& task) { return state_of(task).link; }
+        static bool less(const Task& first, const Task& second);
+    };
+
+    void remove(Task&);
+    void update_min_vruntime(const Task* running);
+
+    // Ordered by vruntime
+    pine::RBTree<Task, Traits> m_tasks;
+    // Only ever increases, trailing the least vruntime on the core
+    u64 m_min_vruntime = 0;
+    // Of the queued tasks
+    u32 m_total_weight = 0;
+};
+
+/*
+ * Embedded in every Task; what RealTimeRunQueue keeps track of for it.
+ */
+struct RealTimeTaskState {
+    u32 priority = 0;
+    // The time it has run since it was last given a new slice
+    u64 slice_ns = 0;
+};
+
+/*
+ * Static priorities: the highest priority task always runs, and tasks of the
+ * same priority take turns with fixed slices. Preempted tasks keep their
+ * place in line. They are never preempted by fair tasks, so a task here that
+ * never blocks starves them.
+ */
+class RealTimeRunQueue final : public RunQueue {
+public:
+    static constexpr u32 num_priorities = 32;
+
+    RealTimeRunQueue() = default;
+    RealTimeRunQueue(const RealTimeRunQueue&) = delete;
+    RealTimeRunQueue& operator=(const RealTimeRunQueue&) = delete;
+
+    size_t length() const override { return m_length; }
+
+    void attach(Task& running) override;
+    void enqueue(Task&, EnqueueReason) override;
+    Task* pick_next() override;
+    Task* take_for_migration() override { return pick_next(); }
+
+    void charge(Task& running, u64 ran_ns) override;
+    void blocked(Task&) override {}
+    void yielded(Task& running) override;
+
+    bool slice_expired(const Task& running) const override;
+    bool should_preempt(const Task& running, const Task& enqueued) const override;
+
+private:
+    static RealTimeTaskState& state_of(Task&);
+    static const RealTimeTaskState& state_of(const Task&);
+
+    u32 highest_queued_priority() const;
+
+    TaskQueue m_queues[num_priorities];
+    // A bit for each priority with queued tasks
+    u32 m_queued_priorities = 0;
+    size_t m_length = 0;
+};
+
+/*
+ * Embedded in every Task; what DeadlineRunQueue keeps track of for it.
+ */
+struct DeadlineTaskState {
+    // It needs to run for runtime_ns every period_ns
+    u64 runtime_ns = 0;
+    u64 period_ns = 0;
+    // runtime_ns / period_ns, in fixed point; see DeadlineRunQueue
+    u32 bandwidth = 0;
+    // The end of its current period, in uptime
+    u64 deadline_ns = 0;
+    // What it has left of its runtime for the current period; once it is 0,
+    // the task is throttled until its deadline
+    u64 remaining_ns = 0;
+    // Periods that ended while it was runnable, before it ran for its runtime
+    u32 misses = 0;
+    pine::RBTreeLink<Task> link;
+};
+
+/*
+ * Earliest deadline first, for tasks that need to run for some time every
+ * period. Tasks are only admitted while the sum of runtime / period on the
+ * core is less than one (less a bit for the other classes), so that every
+ * deadline can be met.
+ *
+ * A task that has run for all of its runtime is throttled: it is kept off
+ * the queue until its deadline, when it gets its runtime back for the next
+ * period. So it can't take from the others, even if it never blocks (the
+ * constant bandwidth server). Tasks are kept on the core they were admitted
+ * on.
+ */
+class DeadlineRunQueue final : public RunQueue {
+public:
+    static constexpr u64 min_period_ns = 1'000'000;
+    static constexpr u64 max_period_ns = 4'000'000'000;
+    static bool are_valid_params(u64 runtime_ns, u64 period_ns);
+
+    DeadlineRunQueue() = default;
+    DeadlineRunQueue(const DeadlineRunQueue&) = delete;
+    DeadlineRunQueue& operator=(const DeadlineRunQueue&) = delete;
+
+    // Reserves bandwidth for the running task (in place of any it had),
+    // returning whether there was enough
+    bool try_admit(Task& running, u64 runtime_ns, u64 period_ns);
+    void release(Task& running);
+
+    // Throttled tasks aren't counted; see replenish()
+    size_t length() const override { return m_tasks.size(); }
+    size_t num_throttled() const { return m_throttled_tasks.size(); }
+    // Queues the throttled tasks whose deadline has come, with their runtime
+    // back; called on each tick
+    void replenish();
+
+    void attach(Task& running) override;
+    void enqueue(Task&, EnqueueReason) override;
+    Task* pick_next() override;
+    Task* take_for_migration() override { return nullptr; }
+
+    void charge(Task& running, u64 ran_ns) override;
+    void blocked(Task&) override {}
+    void yielded(Task& running) override;
+
+    bool slice_expired(const Task& running) const override;
+    bool should_preempt(const Task& running, const Task& enqueued) const override;
+
+private:
+    static DeadlineTaskState& state_of(Task&);
+    static const DeadlineTaskState& state_of(const Task&);
+
+    struct Traits {
+        static pine::RBTreeLink<Task>& link(Task& task) { return state_of(task).link; }
+        static bool less(const Task& first, const Task& second);
+    };
+
+    // Both ordered by deadline; a task is only ever in one of them
+    pine::RBTree<Task, Traits> m_tasks;
+    pine::RBTree<Task, Traits> m_throttled_tasks;
+    // Of all the tasks admitted on the core, queued or not
+    u32 m_total_bandwidth = 0;
+};
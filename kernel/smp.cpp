@@ -0,0 +1,83 @@
+#include "smp.hpp"
+#include "arch/cache.hpp"
+#include "arch/panic.hpp"
+#include "arch/processor.hpp"
+
+#include <pine/units.hpp>
+
+void KernelLock::lock()
+{
+    // IRQ handlers take the lock too; one taking it on a core that is still
+    // waiting for it (or has yet to note it owns it) would wait on itself
+    InterruptSaver saver;
+    auto owner = static_cast<u32>(core_id()) + 1;
+    if (__atomic_load_n(&m_owner, __ATOMIC_RELAXED) == owner) {
+        m_depth++;
+        return;
+    }
+
+    m_lock.lock();
+    __atomic_store_n(&m_owner, owner, __ATOMIC_RELAXED);
+    m_depth = 1;
+}
+
+void KernelLock::unlock()
+{
+    auto held = depth();
+    PANIC_MESSAGE_IF(held == 0, "Unlocking the kernel lock without holding it!");
+    set_depth(held - 1);
+}
+
+unsigned KernelLock::depth() const
+{
+    auto owner = static_cast<u32>(core_id()) + 1;
+    return __atomic_load_n(&m_owner, __ATOMIC_RELAXED) == owner ? m_depth : 0;
+}
+
+void KernelLock::set_depth(unsigned depth)
+{
+    // Likewise, an IRQ handler must not see us half way through letting go
+    InterruptSaver saver;
+    if (this->depth() == 0) {
+        PANIC_MESSAGE_IF(depth > 0, "Setting the depth of a kernel lock we do not hold!");
+        return;
+    }
+
+    m_depth = depth;
+    if (depth == 0) {
+        __atomic_store_n(&m_owner, 0, __ATOMIC_RELAXED);
+        m_lock.unlock();
+    }
+}
+
+KernelLock& kernel_lock()
+{
+    static KernelLock g_kernel_lock {};
+    return g_kernel_lock;
+}
+
+// Boot stacks for the secondary cores, only used until they start their
+// scheduler. On aarch32 the bottom 1KiB of each is also the stack of the
+// exception modes; see setup_secondary_stacks
+alignas(16) static u8 g_secondary_boot_stacks[NUM_CORES - 1][8 * KiB];
+
+extern "C" {
+// Polled by the secondary cores in bootup.S before BSS is zeroed, so it can't
+// live there
+__attribute__((section(".data"))) PtrData secondary_boot_stacks[NUM_CORES] = {};
+}
+
+void smp_start_secondary_cores()
+{
+    // The secondary cores run with their caches off until their MMU is on,
+    // so what they read must be in memory, and nothing cached may later
+    // shadow what they wrote there
+    for (unsigned core = 1; core < NUM_CORES; core++) {
+        auto& stack = g_secondary_boot_stacks[core - 1];
+        pine::DataCache::clean_and_invalidate(stack, sizeof(stack));
+        secondary_boot_stacks[core] = reinterpret_cast<PtrData>(stack + sizeof(stack));
+    }
+    pine::DataCache::clean(secondary_boot_stacks, sizeof(secondary_boot_stacks));
+
+    send_event();
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "lock.hpp"
+
+#include <pine/types.hpp>
+
+// The BCM2836 and BCM2837 both have four cores
+#define NUM_CORES 4
+
+/*
+ * The one lock around the kernel. A core holds it whenever it runs kernel code
+ * other than the idle loop, so the kernel runs on one core at a time (while
+ * userspace runs on all of them) and InterruptDisabler still means what it
+ * did on a single core.
+ *
+ * It is recursive, since IRQs nest into syscalls. IRQs are masked while it
+ * is being taken or let go, so a handler only ever finds it held or free;
+ * in between, they may come in as usual. How deep the running task holds it
+ * is switched along with the task; see TaskManager::schedule().
+ * Underneath is a SpinLock, so the cores take turns in the order they came.
+ */
+class KernelLock {
+public:
+    KernelLock() = default;
+    KernelLock(const KernelLock&) = delete;
+    KernelLock& operator=(const KernelLock&) = delete;
+
+    void lock();
+    void unlock();
+
+    // How many times the calling core holds the lock; 0 if it does not
+    unsigned depth() const;
+    // Hands over the calling core's hold on the lock, releasing it at 0
+    void set_depth(unsigned depth);
+
+#ifdef LOCK_STATS
+    const LockStats& stats() const { return m_lock.stats(); }
+#endif
+
+private:
+    SpinLock m_lock;
+    u32 m_owner = 0;  // the holding core + 1, or 0 when unlocked
+    unsigned m_depth = 0;
+};
+
+KernelLock& kernel_lock();
+
+struct KernelLocker {
+    KernelLocker() { kernel_lock().lock(); }
+    ~KernelLocker() { kernel_lock().unlock(); }
+
+    KernelLocker(const KernelLocker&) = delete;
+    KernelLocker(KernelLocker&&) = delete;
+};
+
+/*
+ * Releases the other cores from bootup.S; each comes up in secondary_init()
+ * once the kernel lock is free.
+ */
+void smp_start_secondary_cores();
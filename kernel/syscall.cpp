@@ -4,18 +4,42 @@
 #include "tasks.hpp"
 
 #include <pine/cast.hpp>
+#include <pine/errno.hpp>
+#include <pine/math.hpp>
 
 pine::Maybe<Syscall> validate_syscall(PtrData call_data)
 {
     static_assert(pine::is_signed<pine::underlying_type<Syscall>>);
 
     auto syscall_signed = pine::bit_cast<ptrdiff_t>(call_data);
-    if (syscall_signed < static_cast<ptrdiff_t>(Syscall::Yield) || syscall_signed > static_cast<ptrdiff_t>(Syscall::Exit)) {
+    if (syscall_signed < static_cast<ptrdiff_t>(Syscall::Yield) || syscall_signed > static_cast<ptrdiff_t>(Syscall::LockStats)) {
         return {};
     }
     return { static_cast<Syscall>(call_data) };
 }
 
+pine::Maybe<Clock> validate_clock(PtrData clock_data)
+{
+    static_assert(pine::is_signed<pine::underlying_type<Clock>>);
+
+    auto clock_signed = pine::bit_cast<ptrdiff_t>(clock_data);
+    if (clock_signed < static_cast<ptrdiff_t>(Clock::Monotonic) || clock_signed > static_cast<ptrdiff_t>(Clock::TaskCPUTime)) {
+        return {};
+    }
+    return { static_cast<Clock>(clock_data) };
+}
+
+pine::Maybe<SchedPolicy> validate_sched_policy(PtrData policy_data)
+{
+    static_assert(pine::is_signed<pine::underlying_type<SchedPolicy>>);
+
+    auto policy_signed = pine::bit_cast<ptrdiff_t>(policy_data);
+    if (policy_signed < static_cast<ptrdiff_t>(SchedPolicy::Fair) || policy_signed > static_cast<ptrdiff_t>(SchedPolicy::Deadline)) {
+        return {};
+    }
+    return { static_cast<SchedPolicy>(policy_data) };
+}
+
 pine::Maybe<FileMode> validate_file_mode(PtrData file_mode_data)
 {
     static_assert(pine::is_signed<pine::underlying_type<FileMode>>);
@@ -27,7 +51,7 @@ pine::Maybe<FileMode> validate_file_mode(PtrData file_mode_data)
     return { static_cast<FileMode>(file_mode_data) };
 }
 
-PtrData handle_syscall(PtrData call_data, PtrData arg1, PtrData arg2, PtrData arg3)
+PtrData handle_syscall(PtrData call_data, PtrData arg1, PtrData arg2, PtrData arg3, const SyscallFrame& frame)
 {
     auto conversion_error = from_signed_cast<PtrData>(-1);
 
@@ -51,12 +75,51 @@ PtrData handle_syscall(PtrData call_data, PtrData arg1, PtrData arg2, PtrData ar
         break;
     }
 
+    case Syscall::Fork: {
+        InterruptDisabler disabler;
+        auto ret = task_mgr.fork_running_task(disabler, frame);
+        return from_signed_cast<PtrData>(ret);
+    }
+
     case Syscall::Yield: {
         InterruptDisabler disabler;
-        task_mgr.schedule(disabler);
+        task_mgr.yield_running_task(disabler);
         break;
     }
 
+    case Syscall::Nice: {
+        InterruptDisabler disabler;
+        if (!fits_within<int>(arg1)) {
+            return conversion_error;
+        }
+        int increment = to_signed_cast<int>(arg1);
+        int nice = task_mgr.renice_running_task(disabler, increment);
+        return from_signed_cast<PtrData>(nice);
+    }
+
+    case Syscall::SetSchedParams: {
+        InterruptDisabler disabler;
+        auto* params = reinterpret_cast<const SchedParams*>(arg1);
+        if (task.userspace_buffer_is_valid(reinterpret_cast<const char*>(params), sizeof(SchedParams)) < 0) {
+            return conversion_error;
+        }
+        if (!validate_sched_policy(static_cast<PtrData>(params->policy))) {
+            return conversion_error;
+        }
+        auto ret = task_mgr.set_running_task_sched_params(disabler, *params);
+        return from_signed_cast<PtrData>(ret);
+    }
+
+    case Syscall::GetSchedParams: {
+        InterruptDisabler disabler;
+        auto* params = reinterpret_cast<SchedParams*>(arg1);
+        if (task.userspace_buffer_is_valid(reinterpret_cast<const char*>(params), sizeof(SchedParams)) < 0) {
+            return conversion_error;
+        }
+        *params = task.sched_params();
+        return 0;
+    }
+
     case Syscall::Sleep:
         if (!fits_within<u32>(arg1)) {
             return conversion_error;
@@ -110,10 +173,35 @@ PtrData handle_syscall(PtrData call_data, PtrData arg1, PtrData arg2, PtrData ar
         return reinterpret_cast<PtrData>(task.sbrk(static_cast<size_t>(arg1)));
 
     case Syscall::Uptime:
-        return static_cast<PtrData>(jiffies());
+        return static_cast<PtrData>(pine::divmod(uptime_ns(), 1'000'000).first);
 
     case Syscall::CPUTime:
-        return static_cast<PtrData>(task.cputime());
+        return static_cast<PtrData>(pine::divmod(task.cputime_ns(), 1'000'000).first);
+
+    case Syscall::ClockGetTime: {
+        auto maybe_clock = validate_clock(arg1);
+        auto* time_spec = reinterpret_cast<TimeSpec*>(arg2);
+        if (!maybe_clock || task.userspace_buffer_is_valid(reinterpret_cast<const char*>(time_spec), sizeof(TimeSpec)) < 0) {
+            return conversion_error;
+        }
+
+        u64 ns = *maybe_clock == Clock::Monotonic ? uptime_ns() : task.cputime_ns();
+        auto [seconds, nanoseconds] = pine::divmod(ns, 1'000'000'000);
+        *time_spec = TimeSpec { seconds, nanoseconds };
+        return 0;
+    }
+
+    case Syscall::LockStats: {
+#ifdef LOCK_STATS
+        auto& jiffy_lock = timer_jiffy_lock();
+        consoleln("kernel lock:", kernel_lock().stats());
+        consoleln("jiffy lock reads:", jiffy_lock.read_stats());
+        consoleln("jiffy lock writes:", jiffy_lock.write_stats());
+        return 0;
+#else
+        return from_signed_cast<PtrData>(-EINVAL);
+#endif
+    }
     }
 
     return 0;
@@ -1,6 +1,8 @@
 #pragma once
+#include "arch/processor.hpp"
 
 #include <pine/types.hpp>
 #include <pine/syscall.hpp>
 
-PtrData handle_syscall(PtrData call_data, PtrData arg1, PtrData arg2, PtrData arg3);
\ No newline at end of file
+// The frame is what the task had when it made the syscall, for fork()
+PtrData handle_syscall(PtrData call_data, PtrData arg1, PtrData arg2, PtrData arg3, const SyscallFrame& frame);
\ No newline at end of file
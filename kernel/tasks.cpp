@@ -2,15 +2,17 @@
 #include "arch/panic.hpp"
 #include "device/timer.hpp"
 #include "device/interrupts.hpp"
+#include "timers.hpp"
+#include "work.hpp"
 
 #include <pine/limits.hpp>
 #include <pine/units.hpp>
 #include <pine/errno.hpp>
 
-Registers construct_user_task_registers(const Stack& stack, const Stack& kernel_stack, PtrData pc)
+Registers construct_user_task_registers(PtrData user_sp, const Stack& kernel_stack, PtrData pc)
 {
     static auto halt_addr_cached = halt_addr();
-    return Registers(stack.sp(), kernel_stack.sp(), pc, halt_addr_cached, PrivilegeLevel::Userspace);
+    return Registers(user_sp, kernel_stack.sp(), pc, halt_addr_cached, PrivilegeLevel::Userspace);
 }
 
 Registers construct_kernel_task_registers(const Stack& kernel_stack, PtrData pc)
@@ -21,49 +23,59 @@ Registers construct_kernel_task_registers(const Stack& kernel_stack, PtrData pc)
     return registers;
 }
 
-Task::Task(KString name, Heap heap, Stack kernel_stack, pine::Maybe<Stack> user_stack, Registers registers, FileDescriptorTable fd_table)
+Task::Task(KShortString name, pine::Maybe<AddressSpace> address_space, Heap heap, Stack kernel_stack, Registers registers, FileDescriptorTable fd_table)
     : m_name(pine::move(name))
+    , m_id(0)
     , m_state(State::New)
-    , m_user_stack(pine::move(user_stack))
+    , m_address_space(pine::move(address_space))
     , m_kernel_stack(pine::move(kernel_stack))
     , m_registers(registers)
     , m_heap(heap)
-    , m_jiffies_when_scheduled(0)
-    , m_cpu_jiffies(0)
-    , m_waiting_for()
+    , m_ns_when_scheduled(0)
+    , m_ns_when_charged(0)
+    , m_cpu_ns(0)
+    , m_core(0)
+    , m_queue_link()
+    , m_policy(SchedPolicy::Fair)
+    , m_fair()
+    , m_real_time()
+    , m_deadline()
+    , m_fp()
     , m_fd_table(pine::move(fd_table))
 {
 }
 
 pine::Maybe<Task> Task::try_create(const char* name, PtrData pc, CreateFlags flags)
 {
+    // Faults on the kernel stack can't be handled on that same stack, so it
+    // is backed up front, unlike the rest of the task's memory
     auto maybe_kernel_stack = Stack::try_create(8 * PageSize);
     if (!maybe_kernel_stack)
         return {};
 
     pine::Maybe<Registers> registers;  // delay initialization
-    pine::Maybe<Stack> maybe_stack;
+    pine::Maybe<AddressSpace> maybe_address_space;
+    Heap heap { 0, 0 };
 
     if (!(flags & CreateKernelTask)) {
-        maybe_stack = Stack::try_create(2 * MiB);
-        if (!maybe_stack)
+        maybe_address_space = AddressSpace::try_create();
+        if (!maybe_address_space)
             return {};
 
-        registers = construct_user_task_registers(*maybe_stack, *maybe_kernel_stack, pc);
+        auto& address_space = *maybe_address_space;
+        auto stack_region = address_space.reserve_region(2 * MiB);
+        auto heap_region = address_space.reserve_region(4 * MiB);
+        if (!stack_region || !heap_region)
+            return {};
+
+        registers = construct_user_task_registers(reinterpret_cast<PtrData>(stack_region.end_ptr()), *maybe_kernel_stack, pc);
+        heap = Heap(reinterpret_cast<PtrData>(heap_region.ptr()), heap_region.size());
     }
     else {
         registers = construct_kernel_task_registers(*maybe_kernel_stack, pc);
     }
 
-    size_t heap_size = 4 * MiB;
-    auto heap_alloc = kmalloc(heap_size);
-    if (!heap_alloc)
-        return {};
-
-    auto heap_ptr_data = reinterpret_cast<PtrData>(heap_alloc.ptr);
-    Heap heap(heap_ptr_data, heap_ptr_data + heap_size);
-
-    auto maybe_name = KString::try_create(kernel_allocator(), name);
+    auto maybe_name = try_create_short_string(name);
     if (!maybe_name)
         return {};
 
@@ -78,42 +90,100 @@ pine::Maybe<Task> Task::try_create(const char* name, PtrData pc, CreateFlags fla
 
     return Task {
         pine::move(*maybe_name),
+        pine::move(maybe_address_space),
         heap,
         pine::move(*maybe_kernel_stack),
-        pine::move(maybe_stack),
         *registers,
         pine::move(fd_table),
     };
 }
 
-void Task::switch_to(Task& to_run_task, InterruptsDisabledTag tag)
+pine::Maybe<Task> Task::try_fork(InterruptsDisabledTag disabled_tag, const SyscallFrame& frame)
 {
-    m_cpu_jiffies += jiffies() - m_jiffies_when_scheduled;
-    to_run_task.start(&m_registers, is_kernel_task(), tag);
+    if (!m_address_space)
+        return {};
+
+    auto maybe_kernel_stack = Stack::try_create(8 * PageSize);
+    if (!maybe_kernel_stack)
+        return {};
+
+    auto maybe_name = try_create_short_string(m_name.c_str());
+    if (!maybe_name)
+        return {};
+
+    auto maybe_fd_table = m_fd_table.try_clone();
+    if (!maybe_fd_table)
+        return {};
+
+    // Last, since it makes our memory copy-on-write
+    auto maybe_address_space = (*m_address_space).try_fork();
+    if (!maybe_address_space)
+        return {};
+
+    auto registers = Registers::forked(frame, (*maybe_kernel_stack).sp());
+    Task task {
+        pine::move(*maybe_name),
+        pine::move(maybe_address_space),
+        m_heap,
+        pine::move(*maybe_kernel_stack),
+        registers,
+        pine::move(*maybe_fd_table),
+    };
+    fp_copy(disabled_tag, m_fp, task.m_fp);
+
+    // Deadline bandwidth is reserved per task, so the copy has to ask again
+    task.m_policy = m_policy == SchedPolicy::Deadline ? SchedPolicy::Fair : m_policy;
+    task.m_fair.nice = m_fair.nice;
+    task.m_real_time.priority = m_real_time.priority;
+    return task;
 }
 
-void Task::start(Registers* to_save_registers, bool is_kernel_task_to_save, InterruptsDisabledTag)
-{
-    m_state = State::Runnable;  // move away from New state if new
-    m_jiffies_when_scheduled = jiffies();
+// Whether the task being switched to on each core is new; see finish_task_switch()
+static bool g_is_starting_new_task[NUM_CORES];
 
-    task_switch(to_save_registers, is_kernel_task_to_save, &m_registers, is_kernel_task());
+void finish_task_switch()
+{
+    task_manager().reap_exited_task(InterruptsDisabledTag::promise());
+
+    // A new task starts outside of the kernel, rather than returning through
+    // it, so our hold on the kernel lock ends here. Not any sooner, since
+    // the task we switched away from may be run by another core once we let go
+    auto& is_starting_new_task = g_is_starting_new_task[core_id()];
+    if (is_starting_new_task) {
+        is_starting_new_task = false;
+        kernel_lock().set_depth(0);
+    }
 }
 
-Task::SleepWaitable::SleepWaitable(u32 secs)
-    : m_sleep_end_time(jiffies() + secs * SYS_HZ)
+void Task::switch_to(Task& to_run_task, InterruptsDisabledTag tag)
 {
+    m_cpu_ns += uptime_ns() - m_ns_when_scheduled;
+    fp_switch_out(tag, m_fp);
+    to_run_task.start(&m_registers, is_kernel_task(), tag);
 }
 
-bool Task::SleepWaitable::is_finished() const
+void Task::start(Registers* to_save_registers, bool is_kernel_task_to_save, InterruptsDisabledTag tag)
 {
-    return m_sleep_end_time <= jiffies();
+    if (m_address_space)
+        (*m_address_space).switch_to();
+    else
+        AddressSpace::switch_to_none();
+
+    fp_switch_in(tag, m_fp);
+    g_is_starting_new_task[core_id()] = m_state == State::New;
+    m_state = State::Runnable;  // move away from New state if new
+    m_ns_when_scheduled = uptime_ns();
+    m_ns_when_charged = m_ns_when_scheduled;
+
+    task_switch(to_save_registers, is_kernel_task_to_save, &m_registers, is_kernel_task());
+    // Only reached when switching back to a task that ran before
+    finish_task_switch();
 }
 
-void Task::sleep(u32 secs)
+void Task::sleep(u32 ms)
 {
     InterruptDisabler disabler;
-    reschedule_while_waiting_for(disabler, SleepWaitable(secs));
+    task_manager().sleep_running_task(disabler, ms_to_jiffies(ms));
 }
 
 int Task::open(pine::StringView path, FileMode mode)
@@ -121,11 +191,22 @@ int Task::open(pine::StringView path, FileMode mode)
     return m_fd_table.open(path, mode);
 }
 
-int Task::userspace_buffer_is_valid(const char* buf, size_t bytes)
+int Task::userspace_buffer_is_valid(const char* buf, size_t bytes) const
 {
     if (bytes > pine::limits<ssize_t>::max)
         return -EFBIG;
 
+    auto start = reinterpret_cast<PtrData>(buf);
+    if (!buf || start + bytes < start)
+        return -EFAULT;
+
+    // Tasks run from the kernel's image, so may pass us buffers in it, but
+    // they only have the parts of the demand paged window they reserved;
+    // touching the rest of it would fault in the kernel
+    bool overlaps_window = start < DEMAND_PAGED_END && start + bytes > DEMAND_PAGED_START;
+    if (overlaps_window && (!m_address_space || !(*m_address_space).is_reserved(start, bytes)))
+        return -EFAULT;
+
     return 0;
 }
 
@@ -173,63 +254,329 @@ void* Task::sbrk(size_t increase)
     return ptr;
 }
 
-void Task::update_state()
+SchedParams Task::sched_params() const
 {
-    if (m_state == State::Waiting && m_waiting_for && m_waiting_for->is_finished()) {
-        m_state = State::Runnable;
-    }
+    return SchedParams {
+        m_policy,
+        m_real_time.priority,
+        m_deadline.runtime_ns,
+        m_deadline.period_ns,
+        m_deadline.misses,
+    };
 }
 
-u32 Task::cputime()
+u64 Task::cputime_ns()
 {
     InterruptDisabler disabler {};
     if (&(task_manager().running_task(disabler)) == this) // if we're scheduled
-        return m_cpu_jiffies + jiffies() - m_jiffies_when_scheduled;
+        return m_cpu_ns + uptime_ns() - m_ns_when_scheduled;
 
-    return m_cpu_jiffies;
+    return m_cpu_ns;
 }
 
-void reschedule_while_waiting_for(const Waitable& wait_for)
+void TaskManager::block_running_task(InterruptsDisabledTag disabled_tag, TaskQueue& wait_on)
 {
-    InterruptDisabler disabler {};
-    task_manager().running_task(disabler).reschedule_while_waiting_for(disabler, wait_for);
+    auto& task = running_task(disabled_tag);
+    PANIC_MESSAGE_IF(&task == this_core().idle_task, "The idle task cannot wait!");
+
+    task.m_state = Task::State::Waiting;
+    wait_on.append(task);
+    schedule(disabled_tag);
+}
+
+static void wake_sleeping_task(void* task, InterruptsDisabledTag disabled_tag)
+{
+    task_manager().wake(disabled_tag, *static_cast<Task*>(task));
+}
+
+void TaskManager::sleep_running_task(InterruptsDisabledTag disabled_tag, u32 delay_jiffies)
+{
+    auto& task = running_task(disabled_tag);
+
+    // Lives on our kernel stack while we are blocked. Longer sleeps can be
+    // late by a little, letting their wake ups share a tick with others
+    Timer timer(wake_sleeping_task, &task);
+    timer_wheel().add(disabled_tag, timer, delay_jiffies, delay_jiffies / 16);
+    block_running_task(disabled_tag, m_sleeping_tasks);
+    timer_wheel().cancel(disabled_tag, timer);
+}
+
+void TaskManager::wake(InterruptsDisabledTag, Task& task)
+{
+    if (auto* queue = TaskQueue::queue_of(task))
+        queue->remove(task);
+
+    task.m_state = Task::State::Runnable;
+
+    // Back to where it last ran, unless that core is busy and another isn't.
+    // Deadline tasks stay on the core they have bandwidth on
+    if (task.m_policy != SchedPolicy::Deadline && !m_cores[task.m_core].is_idle()) {
+        for (unsigned core = 0; core < NUM_CORES; core++) {
+            if (m_cores[core].is_idle()) {
+                task.m_core = core;
+                break;
+            }
+        }
+    }
+
+    auto& core = m_cores[task.m_core];
+    auto& run_queue = core.run_queue_for(task);
+    run_queue.enqueue(task, EnqueueReason::Woken);
+    if (!core.is_online)
+        return;
+
+    if (!core.should_preempt(task))
+        return;
+
+    core.needs_reschedule = true;
+    if (&core != &this_core())
+        interrupts_send_ipi(task.m_core);
+}
+
+RunQueue& CoreScheduler::run_queue_for(const Task& task)
+{
+    switch (task.sched_policy()) {
+    case SchedPolicy::RealTime:
+        return real_time_queue;
+    case SchedPolicy::Deadline:
+        return deadline_queue;
+    case SchedPolicy::Fair:
+        break;
+    }
+
+    return fair_queue;
+}
+
+size_t CoreScheduler::num_queued_tasks() const
+{
+    size_t num_tasks = 0;
+    for (auto* run_queue : run_queues)
+        num_tasks += run_queue->length();
+
+    return num_tasks;
+}
+
+bool CoreScheduler::should_preempt(const Task& enqueued)
+{
+    // Right away if the core is idle or the task is of a higher class; if it
+    // is of the same class, that class decides
+    auto& running = *running_task;
+    if (&running == idle_task || enqueued.sched_policy() > running.sched_policy())
+        return true;
+    if (enqueued.sched_policy() < running.sched_policy())
+        return false;
+
+    return run_queue_for(enqueued).should_preempt(running, enqueued);
+}
+
+Task* CoreScheduler::pick_next()
+{
+    for (auto* run_queue : run_queues) {
+        if (auto* task = run_queue->pick_next())
+            return task;
+    }
+
+    return nullptr;
 }
 
-void Task::reschedule_while_waiting_for(InterruptsDisabledTag disabled_tag, const Waitable& wait_for)
+void TaskManager::try_steal_task(CoreScheduler& thief)
 {
-    m_state = State::Waiting;
-    m_waiting_for = &wait_for;
-    task_manager().schedule(disabled_tag);
+    // The busiest core has the longest wait for its tasks
+    CoreScheduler* busiest = nullptr;
+    for (auto& core : m_cores) {
+        if (core.num_queued_tasks() > 0 && (!busiest || core.num_queued_tasks() > busiest->num_queued_tasks()))
+            busiest = &core;
+    }
+    if (!busiest)
+        return;
+
+    // Whichever would run first, that can move
+    for (auto* run_queue : busiest->run_queues) {
+        if (auto* task = run_queue->take_for_migration()) {
+            thief.run_queue_for(*task).enqueue(*task, EnqueueReason::Migrated);
+            return;
+        }
+    }
 }
 
 Task& TaskManager::pick_next_task()
 {
-    do {
-        // Round robben
-        m_running_task_index++;
-        if (m_running_task_index >= m_tasks.length())
-            m_running_task_index = 0;
+    auto& core = this_core();
+    if (core.num_queued_tasks() == 0)
+        try_steal_task(core);
+
+    auto* task = core.pick_next();
+    if (!task)
+        return *core.idle_task;
+
+    task->m_core = core_id();
+    return *task;
+}
+
+void TaskManager::program_next_tick(InterruptsDisabledTag disabled_tag, const Task& to_run_task)
+{
+    // Only the boot core has a timer IRQ; see preempt_other_cores()
+    if (core_id() != 0)
+        return;
+
+    // Tickless while idle: nothing needs a timeslice, so only wake for the
+    // next timer (or an IRQ that wakes a task). Other cores with tasks
+    // waiting still need us to tick for them
+    bool needs_timeslices = &to_run_task != this_core().idle_task;
+    for (auto& core : m_cores)
+        needs_timeslices |= core.needs_ticks();
+
+    u32 delay_jiffies = 1;
+    if (!needs_timeslices)
+        delay_jiffies = timer_wheel().jiffies_until_next_advance(disabled_tag);
+
+    timer_program_next_tick(disabled_tag, delay_jiffies);
+}
+
+void TaskManager::preempt_other_cores(InterruptsDisabledTag)
+{
+    // Cores with nothing waiting can keep running what they have
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        if (core != core_id() && m_cores[core].is_online && m_cores[core].needs_ticks())
+            interrupts_send_ipi(core);
+    }
+}
+
+void TaskManager::charge_running_task(CoreScheduler& core)
+{
+    auto& task = *core.running_task;
+    auto now_ns = uptime_ns();
+    auto ran_ns = now_ns - task.m_ns_when_charged;
+    task.m_ns_when_charged = now_ns;
+
+    if (&task != core.idle_task)
+        core.run_queue_for(task).charge(task, ran_ns);
+}
+
+void TaskManager::tick(InterruptsDisabledTag)
+{
+    auto& core = this_core();
+    core.deadline_queue.replenish();
+    auto& task = *core.running_task;
+    if (&task == core.idle_task) {
+        core.needs_reschedule |= core.num_queued_tasks() > 0;
+        return;
+    }
 
-        m_tasks[m_running_task_index].update_state();
-    } while (!m_tasks[m_running_task_index].can_run());
+    charge_running_task(core);
+    auto& run_queue = core.run_queue_for(task);
+    if (run_queue.slice_expired(task))
+        core.needs_reschedule = true;
+
+    // A task of a higher class would normally have preempted us when it was
+    // enqueued, but not if it was stolen onto our core
+    for (auto* higher_run_queue : core.run_queues) {
+        if (higher_run_queue == &run_queue)
+            break;
+        if (!higher_run_queue->is_empty())
+            core.needs_reschedule = true;
+    }
+}
 
-    return m_tasks[m_running_task_index];
+bool TaskManager::handle_fp_trap(InterruptsDisabledTag disabled_tag)
+{
+    return fp_handle_trap(disabled_tag, running_task(disabled_tag).m_fp);
 }
 
 void TaskManager::schedule(InterruptsDisabledTag disabled_tag)
 {
+    auto& core = this_core();
+    core.needs_reschedule = false;
+
     auto& curr_task = running_task(disabled_tag);
+    if (&curr_task != core.idle_task) {
+        charge_running_task(core);
+        auto& run_queue = core.run_queue_for(curr_task);
+        if (curr_task.can_run())
+            run_queue.enqueue(curr_task, EnqueueReason::Preempted);
+        else
+            run_queue.blocked(curr_task);
+    }
 
     auto& to_run_task = pick_next_task();
+    program_next_tick(disabled_tag, to_run_task);
     if (&to_run_task == &curr_task)
         return;
 
+    // We may be switched back to on another core, holding the kernel lock
+    // on behalf of a different task; take back however deep we held it
+    auto lock_depth = kernel_lock().depth();
+    core.running_task = &to_run_task;
     curr_task.switch_to(to_run_task, disabled_tag);
+    kernel_lock().set_depth(lock_depth);
+}
+
+void TaskManager::yield_running_task(InterruptsDisabledTag disabled_tag)
+{
+    auto& core = this_core();
+    auto& task = *core.running_task;
+    if (&task != core.idle_task) {
+        charge_running_task(core);
+        core.run_queue_for(task).yielded(task);
+    }
+
+    schedule(disabled_tag);
+}
+
+int TaskManager::renice_running_task(InterruptsDisabledTag disabled_tag, int increment)
+{
+    // The running task isn't queued, so its weight can change freely
+    auto& task = running_task(disabled_tag);
+    auto nice = pine::max(FairRunQueue::min_nice, pine::min(task.m_fair.nice + increment, FairRunQueue::max_nice));
+    task.m_fair.nice = nice;
+    return nice;
+}
+
+int TaskManager::set_running_task_sched_params(InterruptsDisabledTag disabled_tag, const SchedParams& params)
+{
+    auto& core = this_core();
+    auto& task = running_task(disabled_tag);
+    PANIC_MESSAGE_IF(&task == core.idle_task, "The idle task cannot change class!");
+
+    switch (params.policy) {
+    case SchedPolicy::Fair:
+        break;
+
+    case SchedPolicy::RealTime:
+        if (params.priority >= RealTimeRunQueue::num_priorities)
+            return -EINVAL;
+
+        task.m_real_time.priority = params.priority;
+        break;
+
+    case SchedPolicy::Deadline:
+        if (!DeadlineRunQueue::are_valid_params(params.runtime_ns, params.period_ns))
+            return -EINVAL;
+        if (!core.deadline_queue.try_admit(task, params.runtime_ns, params.period_ns))
+            return -EBUSY;
+        break;
+    }
+
+    if (task.m_policy == SchedPolicy::Deadline && params.policy != SchedPolicy::Deadline)
+        core.deadline_queue.release(task);
+
+    task.m_policy = params.policy;
+    core.run_queue_for(task).attach(task);
+
+    // Something else may need to run now that we're in a different class
+    if (core.num_queued_tasks() > 0)
+        schedule(disabled_tag);
+
+    return 0;
 }
 
 void TaskManager::start_scheduler(InterruptsDisabledTag disabled_tag)
 {
-    m_tasks[0].start(nullptr, false, disabled_tag);
+    auto& core = this_core();
+    core.is_online = true;
+    core.running_task = &pick_next_task();
+    program_next_tick(disabled_tag, *core.running_task);
+    core.running_task->start(nullptr, false, disabled_tag);
 }
 
 extern "C" {
@@ -238,9 +585,115 @@ PtrData spin_addr();
 PtrData shell_addr(); // forward declare; in userspace/shell.hpp
 }
 
+static PtrData work_queue_worker_addr()
+{
+    PtrData addr;
+    asm volatile("ldr %0, =work_queue_worker"
+                 : "=r"(addr));
+    return addr;
+}
+
+#ifdef SWITCH_BENCHMARK
+// How many times each of the two benchmark tasks yields
+static constexpr unsigned switch_benchmark_yields = 10'000;
+// The last benchmark task to yield, so each can tell whether the other ran
+static Task* g_switch_benchmark_last_task;
+
+extern "C" {
+void switch_benchmark_task();
+}
+
+/*
+ * Yields back and forth with the other benchmark task, reporting the cycles
+ * per voluntary switch. A yield only counts as a switch if the other task ran
+ * before we were switched back to; the other cores may steal one of us.
+ */
+void switch_benchmark_task()
+{
+    InterruptDisabler disabler;
+    KernelLocker locker;
+    auto& task_mgr = task_manager();
+    auto& task = task_mgr.running_task(disabler);
+
+    enable_cycle_counter();
+    unsigned switches = 0;
+    auto start_count = cycle_count();
+    for (unsigned yields = 0; yields < switch_benchmark_yields; yields++) {
+        g_switch_benchmark_last_task = &task;
+        task_mgr.yield_running_task(disabler);
+        switches += g_switch_benchmark_last_task != &task;
+    }
+    auto cycles = cycle_count() - start_count;
+
+    // Each switch away comes with one back
+    if (switches > 0)
+        consoleln(task.name(), "cycles per switch:", cycles / (2 * switches), "over", switches, "yields that switched");
+    else
+        consoleln(task.name(), "never switched to the other benchmark task");
+
+    task_mgr.exit_running_task(disabler, 0);
+}
+
+static PtrData switch_benchmark_addr()
+{
+    PtrData addr;
+    asm volatile("ldr %0, =switch_benchmark_task"
+                 : "=r"(addr));
+    return addr;
+}
+#endif
+
+TaskTable::TaskTable()
+    : m_tasks()
+    , m_free_ids()
+    , m_free_head(0)
+    , m_num_free(max_tasks)
+{
+    for (unsigned slot = 0; slot < max_tasks; slot++)
+        m_free_ids[slot] = static_cast<int>(slot + 1);
+}
+
+int TaskTable::try_add(Task& task)
+{
+    if (m_num_free == 0)
+        return 0;
+
+    auto id = m_free_ids[m_free_head];
+    m_free_head = (m_free_head + 1) & (max_tasks - 1);
+    m_num_free--;
+
+    m_tasks[slot_of(id)] = &task;
+    return id;
+}
+
+void TaskTable::remove(const Task& task)
+{
+    auto slot = slot_of(task.m_id);
+    PANIC_MESSAGE_IF(m_tasks[slot] != &task, "Task is not in the task table!");
+    m_tasks[slot] = nullptr;
+
+    // The slot's next id, starting over before it would overflow
+    auto next_id = static_cast<int>(slot + 1);
+    if (task.m_id <= pine::limits<int>::max - static_cast<int>(max_tasks))
+        next_id = task.m_id + static_cast<int>(max_tasks);
+
+    m_free_ids[(m_free_head + m_num_free) & (max_tasks - 1)] = next_id;
+    m_num_free++;
+}
+
+Task* TaskTable::find(int id) const
+{
+    if (id <= 0)
+        return nullptr;
+
+    auto* task = m_tasks[slot_of(id)];
+    return task && task->m_id == id ? task : nullptr;
+}
+
 TaskManager::TaskManager()
-    : m_tasks(kernel_allocator())
-    , m_running_task_index(0)
+    : m_task_table()
+    , m_cores()
+    , m_sleeping_tasks()
 {
     // The compiler will literally give us null if we try and get the address
     // of a function via (void*) or (PtrData) casts... undefined behavior?
@@ -249,29 +702,129 @@ TaskManager::TaskManager()
     auto spin_task_addr = spin_addr();
     auto shell_task_addr = shell_addr();
 
-    PANIC_MESSAGE_IF(!try_create_task("shell", shell_task_addr, Task::CreateUserTask), "Could not create shell task! Out of memory?!");
-
-    // The idea behind this task is that it will always be runnable so we
-    // never have to deal with no runnable tasks. It will spin of course,
-    // which is not ideal :P
-    PANIC_MESSAGE_IF(!try_create_task("spin", spin_task_addr, Task::CreateKernelTask), "Could not create spin task! Out of memory?!");
+    auto* shell_task = try_create_task("shell", shell_task_addr, Task::CreateUserTask);
+    PANIC_MESSAGE_IF(!shell_task, "Could not create shell task! Out of memory?!");
+    this_core().fair_queue.enqueue(*shell_task, EnqueueReason::New);
+
+    // Runs the bottom halves of IRQ handlers, so it preempts everything but
+    // deadline tasks as soon as an IRQ queues work; see work.hpp
+    auto* worker_task = try_create_task("worker", work_queue_worker_addr(), Task::CreateKernelTask);
+    PANIC_MESSAGE_IF(!worker_task, "Could not create worker task! Out of memory?!");
+    worker_task->m_policy = SchedPolicy::RealTime;
+    worker_task->m_real_time.priority = RealTimeRunQueue::num_priorities - 1;
+    this_core().real_time_queue.enqueue(*worker_task, EnqueueReason::New);
+
+#ifdef SWITCH_BENCHMARK
+    for (unsigned count = 0; count < 2; count++) {
+        auto* benchmark_task = try_create_task("switchbench", switch_benchmark_addr(), Task::CreateKernelTask);
+        PANIC_MESSAGE_IF(!benchmark_task, "Could not create switch benchmark task! Out of memory?!");
+        this_core().fair_queue.enqueue(*benchmark_task, EnqueueReason::New);
+    }
+#endif
+
+    // The idea behind these tasks is that they will always be runnable so
+    // we never have to deal with no runnable tasks. They zero pages ahead of
+    // time and otherwise sleep until the next interrupt; see spin_task()
+    for (unsigned core = 0; core < NUM_CORES; core++) {
+        auto* idle_task = try_create_task("spin", spin_task_addr, Task::CreateKernelTask);
+        PANIC_MESSAGE_IF(!idle_task, "Could not create spin task! Out of memory?!");
+
+        // The idle task is picked when there is nothing else, never from a run queue
+        idle_task->m_core = core;
+        m_cores[core].idle_task = idle_task;
+    }
 }
 
-bool TaskManager::try_create_task(const char* name, PtrData start_addr, Task::CreateFlags flags)
+Task* TaskManager::try_create_task(const char* name, PtrData start_addr, Task::CreateFlags flags)
 {
     auto maybe_task = Task::try_create(name, start_addr, flags);
     if (!maybe_task)
-        return false;
+        return nullptr;
 
-    m_tasks.append(pine::move(*maybe_task));
-    return true;
+    return try_add_task(pine::move(*maybe_task));
+}
+
+Task* TaskManager::try_add_task(Task&& new_task)
+{
+    auto [ptr, _] = object_cache<Task>().allocate();
+    if (!ptr)
+        return nullptr;
+
+    auto* task = new (ptr) Task(pine::move(new_task));
+    task->m_id = m_task_table.try_add(*task);
+    if (task->m_id == 0) {
+        destroy_task(*task);
+        return nullptr;
+    }
+
+    return task;
+}
+
+void TaskManager::destroy_task(Task& task)
+{
+    task.Task::~Task();
+    object_cache<Task>().free({ &task, sizeof(Task) });
+}
+
+int TaskManager::fork_running_task(InterruptsDisabledTag disabled_tag, const SyscallFrame& frame)
+{
+    auto maybe_task = running_task(disabled_tag).try_fork(disabled_tag, frame);
+    if (!maybe_task)
+        return -ENOMEM;
+
+    auto* task = try_add_task(pine::move(*maybe_task));
+    if (!task)
+        return -ENOMEM;
+    PANIC_MESSAGE_IF(find_task(disabled_tag, task->m_id) != task, "Forked task can't be found by its id!");
+
+    // Queued here, where its memory is likely still in the cache
+    task->m_core = core_id();
+    this_core().run_queue_for(*task).enqueue(*task, EnqueueReason::New);
+    return task->m_id;
 }
 
 void TaskManager::exit_running_task(InterruptsDisabledTag disabler, int code)
 {
-    consoleln(running_task(disabler).name(), "has exited with code:", code);
-    m_tasks.remove(m_running_task_index);
-    pick_next_task().start(nullptr, false, disabler);
+    auto& task = running_task(disabler);
+    consoleln(task.name(), "has exited with code:", code);
+
+    auto& core = this_core();
+    if (task.m_policy == SchedPolicy::Deadline)
+        core.deadline_queue.release(task);
+
+    // The running task is never on a queue. We are still on its kernel
+    // stack (and address space), so leave destroying it to the next task
+    m_task_table.remove(task);
+    PANIC_MESSAGE_IF(core.exited_task, "Exited task was never reaped!");
+    core.exited_task = &task;
+
+    core.running_task = &pick_next_task();
+    program_next_tick(disabler, *core.running_task);
+    core.running_task->start(nullptr, false, disabler);
+}
+
+void TaskManager::reap_exited_task(InterruptsDisabledTag)
+{
+    auto& exited_task = this_core().exited_task;
+    if (exited_task)
+        destroy_task(*pine::exchange(exited_task, nullptr));
+}
+
+void spin_task()
+{
+    for (;;) {
+        // Nothing else wants to run, so get ahead on zeroing pages for
+        // allocations; once there is nothing left to do, sleep until the next
+        // interrupt. Ticks are skipped while we run (see program_next_tick),
+        // so that is the next timer, device IRQ or IPI
+        bool zeroed_page;
+        {
+            KernelLocker locker;
+            zeroed_page = try_zero_free_page();
+        }
+        if (!zeroed_page)
+            wait_for_interrupt();
+    }
 }
 
 TaskManager& task_manager()
@@ -283,6 +836,16 @@ TaskManager& task_manager()
 void tasks_init()
 {
     InterruptDisabler disabler {};
-    interrupts_enable_timer();
+    KernelLocker locker {};
+    if (core_id() == 0) {
+        interrupts_enable_timer();
+        // The others wait for us to let go of the kernel lock, by which
+        // point the task manager is ready for them
+        task_manager();
+        smp_start_secondary_cores();
+    }
+
+    interrupts_enable_ipi();
+    fp_init();
     task_manager().start_scheduler(disabler);
 }
@@ -1,10 +1,14 @@
 #pragma once
 #include "arch/processor.hpp"
 #include "stack.hpp"
+#include "demand_paging.hpp"
 #include "file.hpp"
+#include "fp.hpp"
 #include "kmalloc.hpp"
 #include "wait.hpp"
 #include "interrupt_disabler.hpp"
+#include "sched.hpp"
+#include "smp.hpp"
 
 #include <pine/maybe.hpp>
 #include <pine/memory.hpp>
@@ -19,20 +23,18 @@ extern "C" {
 PtrData halt_addr();
 // In switch.S
 void task_switch(Registers* to_save_registers, bool is_kernel_task_save, const Registers* new_registers, bool is_kernel_task_new);
+// Called once on the new task's kernel stack; by task_switch for new tasks,
+// otherwise by Task::start() when task_switch returns
+void finish_task_switch();
 }
 
-Registers construct_user_task_registers(const Stack& stack, const Stack& kernel_stack, PtrData pc);
+Registers construct_user_task_registers(PtrData user_sp, const Stack& kernel_stack, PtrData pc);
 Registers construct_kernel_task_registers(const Stack& kernel_stack, PtrData pc);
 
-class Heap : public pine::FallbackAllocatorBinder<pine::FixedAllocation, pine::HighWatermarkAllocator> {
+// Grown by sbrk() over a region of the task's address space
+class Heap : public pine::HighWatermarkAllocator {
 public:
-    Heap(PtrData start, size_t size)
-        : pine::FallbackAllocatorBinder<pine::FixedAllocation, pine::HighWatermarkAllocator>(&m_allocation)
-        , m_allocation(start, size)
-        , m_high_watermark_allocator() {};
-
-    pine::FixedAllocation m_allocation;
-    pine::HighWatermarkAllocator m_high_watermark_allocator;
+    Heap(PtrData start, size_t size) { add(reinterpret_cast<void*>(start), size); }
 };
 
 class Task {
@@ -48,81 +50,193 @@ public:
     };
 
     static pine::Maybe<Task> try_create(const char* name, PtrData pc, CreateFlags flags);
+    // A copy of the running task, returning from its syscall (with 0)
+    pine::Maybe<Task> try_fork(InterruptsDisabledTag, const SyscallFrame&);
     Task(const Task& other) = delete;
     Task(Task&& other) = default;
     Task& operator=(Task&& other) = default;
 
-    const KString& name() const { return m_name; }
-    void sleep(u32 secs);
+    const KShortString& name() const { return m_name; }
+    int id() const { return m_id; }
+    void sleep(u32 ms);
     int open(pine::StringView path, FileMode mode);
     ssize_t read(int fd, char* buf, size_t at_most_bytes);
     ssize_t write(int fd, char* buf, size_t bytes);
     int close(int fd);
     int dup(int fd);
-    u32 cputime();
+    u64 cputime_ns();
     void* sbrk(size_t increase);
-
-    void reschedule_while_waiting_for(InterruptsDisabledTag disabled_tag, const Waitable&);
+    // Returns 0 if the kernel can safely access the buffer for the task, or
+    // -EFBIG or -EFAULT
+    int userspace_buffer_is_valid(const char* buffer, size_t size) const;
 
     bool is_kernel_task() const { return m_registers.is_kernel_registers(); }
+    int nice() const { return m_fair.nice; }
+    SchedPolicy sched_policy() const { return m_policy; }
+    SchedParams sched_params() const;
 
 private:
-    Task(KString name, Heap heap, Stack kernel_stack, pine::Maybe<Stack> user_stack, Registers registers, FileDescriptorTable fd_table);
-    void update_state();
+    Task(KShortString name, pine::Maybe<AddressSpace> address_space, Heap heap, Stack kernel_stack, Registers registers, FileDescriptorTable fd_table);
     void start(Registers*, bool is_kernel_task_to_save, InterruptsDisabledTag);
     void switch_to(Task&, InterruptsDisabledTag);
     friend class TaskManager;
+    friend class TaskQueue;
+    friend class TaskTable;
+    friend class FairRunQueue;
+    friend class RealTimeRunQueue;
+    friend class DeadlineRunQueue;
 
     bool can_run() const { return m_state == State::New || m_state == State::Runnable; };
 
-    class SleepWaitable : public Waitable {
-    public:
-        SleepWaitable(u32 secs);
-        bool is_finished() const override;
-
-    private:
-        u32 m_sleep_end_time;
-    };
-
-    int userspace_buffer_is_valid(const char* buffer, size_t size);
-
-    KString m_name;
+    KShortString m_name;
+    int m_id;  // given by the task manager
     State m_state;
-    pine::Maybe<Stack> m_user_stack;
+    // Kernel tasks have none; see demand_paging.hpp
+    pine::Maybe<AddressSpace> m_address_space;
     Stack m_kernel_stack;
     Registers m_registers;
     Heap m_heap;
-    u32 m_jiffies_when_scheduled;
-    u32 m_cpu_jiffies;
-    const Waitable* m_waiting_for;
+    u64 m_ns_when_scheduled;
+    u64 m_ns_when_charged;  // to its run queue; see TaskManager::charge_running_task()
+    u64 m_cpu_ns;
+    unsigned m_core;  // the core it last ran on, or is queued to run on
+    TaskQueueLink m_queue_link;  // also used by RealTimeRunQueue
+    SchedPolicy m_policy;
+    FairTaskState m_fair;
+    RealTimeTaskState m_real_time;
+    DeadlineTaskState m_deadline;
+    FPState m_fp;
     FileDescriptorTable m_fd_table;
 };
 
-void reschedule_while_waiting_for(const Waitable&);
-
 extern "C" {
 [[noreturn]] void spin_task();
 }
 
+/*
+ * What a core is running and what it runs next.
+ */
+struct CoreScheduler {
+    Task* running_task = nullptr;
+    // Always runnable, but only run when there is nothing else to run
+    Task* idle_task = nullptr;
+    // Runnable tasks other than the running and idle tasks, by class
+    DeadlineRunQueue deadline_queue;
+    RealTimeRunQueue real_time_queue;
+    FairRunQueue fair_queue;
+    // From the class that runs first to the one that runs last
+    RunQueue* const run_queues[3] = { &deadline_queue, &real_time_queue, &fair_queue };
+    // Whether the running task should be switched away from on the way out
+    // of the IRQ; its slice is up, or a task that should run instead was woken
+    bool needs_reschedule = false;
+    // Whether the core has started scheduling, so tasks can be given to it
+    bool is_online = false;
+    // A task that exited, destroyed once we are off its kernel stack; see
+    // finish_task_switch()
+    Task* exited_task = nullptr;
+
+    RunQueue& run_queue_for(const Task&);
+    size_t num_queued_tasks() const;
+    bool is_idle() const { return is_online && running_task == idle_task && num_queued_tasks() == 0; }
+    // Whether the core needs its ticks: to share it out, or to replenish
+    // throttled deadline tasks
+    bool needs_ticks() const { return num_queued_tasks() > 0 || deadline_queue.num_throttled() > 0; }
+    // Whether a task just enqueued should run instead of the running task
+    bool should_preempt(const Task& enqueued);
+    Task* pick_next();
+};
+
+/*
+ * Every task, by id. Each id maps straight to a slot, and a slot's next id
+ * is only given out after the other free slots have had a turn, so ids of
+ * exited tasks aren't reused soon after.
+ */
+class TaskTable {
+public:
+    static constexpr unsigned max_tasks = 256;
+
+    TaskTable();
+    TaskTable(const TaskTable&) = delete;
+    TaskTable& operator=(const TaskTable&) = delete;
+
+    // Returns the task's new id, or 0 if the table is full
+    int try_add(Task&);
+    void remove(const Task&);
+    Task* find(int id) const;
+
+private:
+    static unsigned slot_of(int id) { return static_cast<unsigned>(id - 1) & (max_tasks - 1); }
+
+    Task* m_tasks[max_tasks];
+    // The ids to give out next, in a ring from m_free_head
+    int m_free_ids[max_tasks];
+    unsigned m_free_head;
+    unsigned m_num_free;
+};
+
+/*
+ * Each core has its own run queue, so that tasks tend to stay on the core
+ * (and in the caches) they ran on. A core with nothing left to run steals
+ * from the busiest one, and tasks woken up go to idle cores first. What runs
+ * next, and for how long, is up to the run queue; see sched.hpp.
+ */
 class TaskManager {
 public:
     TaskManager();
+    // Called by each core once, after the boot core creates the task manager
     void start_scheduler(InterruptsDisabledTag);
     void schedule(InterruptsDisabledTag);
+    // Lets the other tasks on the core run before the running task again
+    void yield_running_task(InterruptsDisabledTag);
     void exit_running_task(InterruptsDisabledTag, int code);
-    Task& running_task(InterruptsDisabledTag) { return m_tasks[m_running_task_index]; }
+    // Destroys the task that last exited on this core, if any
+    void reap_exited_task(InterruptsDisabledTag);
+    Task& running_task(InterruptsDisabledTag) { return *this_core().running_task; }
+    // Returns the new nice value, which is kept within the valid range
+    int renice_running_task(InterruptsDisabledTag, int increment);
+    // Returns 0, or -EINVAL for bad parameters and -EBUSY if a deadline
+    // task wouldn't fit on the core
+    int set_running_task_sched_params(InterruptsDisabledTag, const SchedParams&);
+    // Returns the new task's id, or -ENOMEM
+    int fork_running_task(InterruptsDisabledTag, const SyscallFrame&);
+    Task* find_task(InterruptsDisabledTag, int id) const { return m_task_table.find(id); }
+
+    // Takes the running task off the run queue until it is woken
+    void block_running_task(InterruptsDisabledTag, TaskQueue& wait_on);
+    void sleep_running_task(InterruptsDisabledTag, u32 delay_jiffies);
+    void wake(InterruptsDisabledTag, Task&);
+
+    bool needs_reschedule(InterruptsDisabledTag) { return this_core().needs_reschedule; }
+    // Called on each tick (or IPI); decides whether the slice of the running task is up
+    void tick(InterruptsDisabledTag);
+    // Called when the running task traps on an FP/SIMD instruction; returns
+    // whether it can retry it, rather than having faulted
+    bool handle_fp_trap(InterruptsDisabledTag);
+    // Called on each tick of the boot core, which is the only one with a timer
+    void preempt_other_cores(InterruptsDisabledTag);
 
 private:
     TaskManager(const TaskManager&) = delete;
     TaskManager(TaskManager&&) = delete;
+    CoreScheduler& this_core() { return m_cores[core_id()]; }
     Task& pick_next_task();
-
-    bool try_create_task(const char* name, PtrData start_addr, Task::CreateFlags flags);
-
-    KVector<Task> m_tasks;
-    unsigned m_running_task_index;
+    void try_steal_task(CoreScheduler& thief);
+    void charge_running_task(CoreScheduler&);
+    void program_next_tick(InterruptsDisabledTag, const Task& to_run_task);
+
+    Task* try_create_task(const char* name, PtrData start_addr, Task::CreateFlags flags);
+    Task* try_add_task(Task&&);
+    void destroy_task(Task&);
+
+    // Tasks are allocated out of their own object cache, so they never move
+    // while linked into queues and are freed without touching the others
+    TaskTable m_task_table;
+    CoreScheduler m_cores[NUM_CORES];
+    // Woken by their sleep timer; see sleep_running_task()
+    TaskQueue m_sleeping_tasks;
 };
 
 TaskManager& task_manager();
 
+// Starts scheduling on the calling core; the boot core also starts the others
 void tasks_init();
@@ -0,0 +1,154 @@
+#include "timers.hpp"
+#include "arch/panic.hpp"
+#include "device/timer.hpp"
+
+#include <pine/twomath.hpp>
+
+Timer::~Timer()
+{
+    PANIC_MESSAGE_IF(is_armed(), "Timer destroyed while still armed!");
+}
+
+void TimerList::add(Timer& timer)
+{
+    timer.m_list = this;
+    timer.m_prev = nullptr;
+    timer.m_next = m_head;
+    if (m_head)
+        m_head->m_prev = &timer;
+    m_head = &timer;
+}
+
+void TimerList::remove(Timer& timer)
+{
+    if (timer.m_prev)
+        timer.m_prev->m_next = timer.m_next;
+    else
+        m_head = timer.m_next;
+
+    if (timer.m_next)
+        timer.m_next->m_prev = timer.m_prev;
+
+    timer.m_next = timer.m_prev = nullptr;
+    timer.m_list = nullptr;
+}
+
+Timer* TimerList::take_front()
+{
+    auto* timer = m_head;
+    if (timer)
+        remove(*timer);
+
+    return timer;
+}
+
+void TimerWheel::add(InterruptsDisabledTag disabled_tag, Timer& timer, u32 delay_jiffies, u32 slack_jiffies)
+{
+    cancel(disabled_tag, timer);
+
+    // Measure from the current jiffy rather than the last one advanced to,
+    // which lags behind while idle ticks are skipped
+    timer.m_period = 0;
+    timer.m_slack = slack_jiffies;
+    timer.m_expires = apply_slack(jiffies() + delay_jiffies, slack_jiffies);
+    schedule(timer);
+}
+
+void TimerWheel::add_periodic(InterruptsDisabledTag disabled_tag, Timer& timer, u32 period_jiffies, u32 slack_jiffies)
+{
+    PANIC_MESSAGE_IF(period_jiffies == 0, "Periodic timers need a period!");
+
+    add(disabled_tag, timer, period_jiffies, slack_jiffies);
+    timer.m_period = period_jiffies;
+}
+
+void TimerWheel::cancel(InterruptsDisabledTag, Timer& timer)
+{
+    if (timer.m_list)
+        timer.m_list->remove(timer);
+}
+
+u32 TimerWheel::apply_slack(u32 expires, u32 slack)
+{
+    // Clear as many low bits as we can without going past the slack, so that
+    // nearby expiries round to the same jiffy
+    u32 limit = expires + slack;
+    u32 differing_bits = expires ^ limit;
+    if (slack == 0 || differing_bits == 0)
+        return expires;
+
+    unsigned highest_bit = 31 - pine::countl_zero(differing_bits);
+    return limit & ~((1u << highest_bit) - 1);
+}
+
+void TimerWheel::schedule(Timer& timer)
+{
+    u32 delay = timer.m_expires - m_current_jiffy;
+    if (static_cast<i32>(delay) < 0) {  // already due
+        timer.m_expires = m_current_jiffy;
+        delay = 0;
+    }
+    if (delay > max_delay) {
+        timer.m_expires = m_current_jiffy + max_delay;
+        delay = max_delay;
+    }
+
+    unsigned level = 0;
+    while (level + 1 < num_levels && delay >= (1u << (level_bits * (level + 1))))
+        level++;
+
+    auto slot = (timer.m_expires >> (level_bits * level)) & (slots_per_level - 1);
+    m_slots[level][slot].add(timer);
+}
+
+void TimerWheel::cascade(unsigned level)
+{
+    // Everything in this slot is now within range of the levels below
+    auto& slot = m_slots[level][(m_current_jiffy >> (level_bits * level)) & (slots_per_level - 1)];
+    while (auto* timer = slot.take_front())
+        schedule(*timer);
+}
+
+void TimerWheel::advance(InterruptsDisabledTag disabled_tag, u32 now_jiffies)
+{
+    while (static_cast<i32>(now_jiffies - m_current_jiffy) >= 0) {
+        for (unsigned level = 1; level < num_levels; level++) {
+            bool lower_level_wrapped = (m_current_jiffy & ((1u << (level_bits * level)) - 1)) == 0;
+            if (!lower_level_wrapped)
+                break;
+
+            cascade(level);
+        }
+
+        auto& slot = m_slots[0][m_current_jiffy & (slots_per_level - 1)];
+        m_current_jiffy++;
+
+        // Timers (re)added by callbacks land in later slots, never this one
+        while (auto* timer = slot.take_front()) {
+            if (timer->m_period) {
+                timer->m_expires = apply_slack(timer->m_expires + timer->m_period, timer->m_slack);
+                schedule(*timer);
+            }
+
+            timer->m_callback(timer->m_context, disabled_tag);
+        }
+    }
+}
+
+u32 TimerWheel::jiffies_until_next_advance(InterruptsDisabledTag) const
+{
+    // Only first level slots hold exact expiries; the rest have to cascade
+    // down when it wraps around before we know more
+    u32 last_jiffy = m_current_jiffy - 1;
+    for (u32 jiffy = m_current_jiffy;; jiffy++) {
+        auto index = jiffy & (slots_per_level - 1);
+        if (index == 0 || !m_slots[0][index].is_empty())
+            return jiffy - last_jiffy;
+    }
+}
+
+TimerWheel& timer_wheel()
+{
+    static TimerWheel g_timer_wheel {};
+    return g_timer_wheel;
+}
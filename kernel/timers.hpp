@@ -0,0 +1,109 @@
+#pragma once
+#include "interrupt_disabler.hpp"
+
+#include <pine/types.hpp>
+#include <pine/units.hpp>
+
+/*
+ * Rounds up, so that sleeping for a few milliseconds sleeps for at least a
+ * jiffy.
+ */
+constexpr u32 ms_to_jiffies(u32 ms)
+{
+    return static_cast<u32>((static_cast<u64>(ms) * SYS_HZ + 999) / 1000);
+}
+
+class TimerList;
+
+/*
+ * A one-shot or periodic callback run by the TimerWheel from the timer IRQ,
+ * with interrupts disabled.
+ *
+ * Timers are intrusive; the owner keeps them alive while armed and must cancel
+ * them before they go away.
+ */
+class Timer {
+public:
+    using Callback = void (*)(void* context, InterruptsDisabledTag);
+
+    Timer(Callback callback, void* context)
+        : m_callback(callback)
+        , m_context(context) {};
+    ~Timer();
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    bool is_armed() const { return m_list; }
+    u32 expires() const { return m_expires; }
+
+private:
+    friend class TimerList;
+    friend class TimerWheel;
+
+    Callback m_callback;
+    void* m_context;
+    u32 m_expires = 0;
+    u32 m_period = 0;  // 0 for one-shot timers
+    u32 m_slack = 0;
+    Timer* m_next = nullptr;
+    Timer* m_prev = nullptr;
+    TimerList* m_list = nullptr;
+};
+
+class TimerList {
+public:
+    bool is_empty() const { return !m_head; }
+    void add(Timer&);
+    void remove(Timer&);
+    Timer* take_front();
+
+private:
+    Timer* m_head = nullptr;
+};
+
+/*
+ * A hierarchical timer wheel. The first level has a slot per jiffy for the
+ * next 64 jiffies, and each level above covers 64 times the range of the one
+ * below with slots as coarse. Whenever the first level wraps around, the next
+ * slot of the level above is cascaded down (and so on up the levels).
+ *
+ * Adding, cancelling and firing a timer are constant time, and a tick only
+ * looks at the one slot that is due, no matter how many timers are pending.
+ *
+ * Slack lets a timer fire up to that many jiffies late, which is used to round
+ * its expiry so that timers with similar expiries share a tick (and so that
+ * far off timers land in a slot that needs no cascading).
+ */
+class TimerWheel {
+public:
+    static constexpr unsigned level_bits = 6;
+    static constexpr unsigned slots_per_level = 1u << level_bits;
+    static constexpr unsigned num_levels = 4;
+    // Anything further out fires (early) at the end of the wheel
+    static constexpr u32 max_delay = (1u << (level_bits * num_levels)) - 1;
+
+    TimerWheel() = default;
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    void add(InterruptsDisabledTag, Timer&, u32 delay_jiffies, u32 slack_jiffies = 0);
+    void add_periodic(InterruptsDisabledTag, Timer&, u32 period_jiffies, u32 slack_jiffies = 0);
+    void cancel(InterruptsDisabledTag, Timer&);
+
+    // Runs every timer due up to and including the given jiffy
+    void advance(InterruptsDisabledTag, u32 now_jiffies);
+
+    // Jiffies from the last advance() until one is next needed, to fire a
+    // timer or cascade; at most a first level's worth
+    u32 jiffies_until_next_advance(InterruptsDisabledTag) const;
+
+private:
+    void schedule(Timer&);
+    void cascade(unsigned level);
+    static u32 apply_slack(u32 expires, u32 slack);
+
+    TimerList m_slots[num_levels][slots_per_level] {};
+    u32 m_current_jiffy = 0;  // the next jiffy to run timers for
+};
+
+TimerWheel& timer_wheel();
@@ -0,0 +1,85 @@
+#include "wait.hpp"
+#include "arch/panic.hpp"
+#include "tasks.hpp"
+
+Task* TaskQueue::next(const Task& task)
+{
+    return task.m_queue_link.next;
+}
+
+TaskQueue* TaskQueue::queue_of(const Task& task)
+{
+    return task.m_queue_link.queue;
+}
+
+void TaskQueue::append(Task& task)
+{
+    insert_before(nullptr, task);
+}
+
+void TaskQueue::insert_before(Task* position, Task& task)
+{
+    auto& link = task.m_queue_link;
+    PANIC_MESSAGE_IF(link.queue, "Task is already on a queue!");
+
+    link.queue = this;
+    link.next = position;
+    link.prev = position ? position->m_queue_link.prev : m_tail;
+
+    if (link.prev)
+        link.prev->m_queue_link.next = &task;
+    else
+        m_head = &task;
+
+    if (position)
+        position->m_queue_link.prev = &task;
+    else
+        m_tail = &task;
+
+    m_length++;
+}
+
+void TaskQueue::remove(Task& task)
+{
+    auto& link = task.m_queue_link;
+    PANIC_MESSAGE_IF(link.queue != this, "Task is not on this queue!");
+
+    if (link.prev)
+        link.prev->m_queue_link.next = link.next;
+    else
+        m_head = link.next;
+
+    if (link.next)
+        link.next->m_queue_link.prev = link.prev;
+    else
+        m_tail = link.prev;
+
+    link = TaskQueueLink {};
+    m_length--;
+}
+
+Task* TaskQueue::take_front()
+{
+    auto* task = m_head;
+    if (task)
+        remove(*task);
+
+    return task;
+}
+
+void WaitQueue::wait(InterruptsDisabledTag disabled_tag)
+{
+    task_manager().block_running_task(disabled_tag, m_waiters);
+}
+
+void WaitQueue::wake_one(InterruptsDisabledTag disabled_tag)
+{
+    if (auto* task = m_waiters.front())
+        task_manager().wake(disabled_tag, *task);
+}
+
+void WaitQueue::wake_all(InterruptsDisabledTag disabled_tag)
+{
+    while (auto* task = m_waiters.front())
+        task_manager().wake(disabled_tag, *task);
+}
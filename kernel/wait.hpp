@@ -1,7 +1,69 @@
 #pragma once
+#include "interrupt_disabler.hpp"
 
-class Waitable {
+#include <pine/types.hpp>
+
+class Task;
+class TaskQueue;
+
+/*
+ * Embedded in every Task; links it into the one TaskQueue it is on, if any.
+ */
+struct TaskQueueLink {
+    Task* next = nullptr;
+    Task* prev = nullptr;
+    TaskQueue* queue = nullptr;
+};
+
+/*
+ * An intrusive FIFO of tasks, so moving a task between the run queue and the
+ * queues it waits on never allocates and is constant time.
+ */
+class TaskQueue {
 public:
-    virtual ~Waitable() = default;
-    virtual bool is_finished() const = 0;
-};
\ No newline at end of file
+    TaskQueue() = default;
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+
+    bool is_empty() const { return !m_head; }
+    size_t length() const { return m_length; }
+    Task* front() const { return m_head; }
+    static Task* next(const Task&);
+    static TaskQueue* queue_of(const Task&);
+
+    void append(Task&);
+    void insert_before(Task* position, Task&);  // appends if position is null
+    void remove(Task&);
+    Task* take_front();
+
+private:
+    Task* m_head = nullptr;
+    Task* m_tail = nullptr;
+    size_t m_length = 0;
+};
+
+/*
+ * Tasks blocked until something, usually an IRQ handler, explicitly wakes
+ * them; blocked tasks are never looked at by the scheduler. Check the
+ * condition being waited for with interrupts disabled, so that a wake up
+ * can't be lost between the check and the wait:
+ *
+ *     InterruptDisabler disabler;
+ *     while (!request.is_finished())
+ *         wait_queue.wait(disabler);
+ */
+class WaitQueue {
+public:
+    WaitQueue() = default;
+    WaitQueue(const WaitQueue&) = delete;
+    WaitQueue& operator=(const WaitQueue&) = delete;
+
+    void wait(InterruptsDisabledTag);
+    void wake_one(InterruptsDisabledTag);
+    void wake_all(InterruptsDisabledTag);
+
+    bool has_waiters() const { return !m_waiters.is_empty(); }
+
+private:
+    TaskQueue m_waiters;
+};
@@ -0,0 +1,57 @@
+#include "work.hpp"
+#include "smp.hpp"
+
+void WorkQueue::queue(InterruptsDisabledTag disabled_tag, Work& work)
+{
+    if (work.m_is_queued)
+        return;
+
+    work.m_is_queued = true;
+    work.m_next = nullptr;
+    if (m_tail)
+        m_tail->m_next = &work;
+    else
+        m_head = &work;
+    m_tail = &work;
+
+    m_worker.wake_one(disabled_tag);
+}
+
+Work* WorkQueue::take_front()
+{
+    auto* work = m_head;
+    m_head = work->m_next;
+    if (!m_head)
+        m_tail = nullptr;
+
+    // So that it can be queued again while it runs
+    work->m_next = nullptr;
+    work->m_is_queued = false;
+    return work;
+}
+
+void WorkQueue::run_worker()
+{
+    for (;;) {
+        KernelLocker locker;
+        Work* work;
+        {
+            InterruptDisabler disabler;
+            while (!m_head)
+                m_worker.wait(disabler);
+            work = take_front();
+        }
+        work->m_callback(work->m_context);
+    }
+}
+
+WorkQueue& work_queue()
+{
+    static WorkQueue g_work_queue;
+    return g_work_queue;
+}
+
+void work_queue_worker()
+{
+    work_queue().run_worker();
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "interrupt_disabler.hpp"
+#include "wait.hpp"
+
+#include <pine/types.hpp>
+
+/*
+ * Work deferred out of an IRQ handler (its bottom half), so that the handler
+ * only has to quiet the device. It is run by the kernel worker task, with
+ * interrupts enabled and the kernel lock held. The worker runs before any
+ * other task, so the work still runs as soon as the IRQ returns, but the
+ * timer and other IRQs can interrupt it.
+ *
+ * Work is intrusive; the owner keeps it alive while queued. Queuing it again
+ * before it runs does nothing, so it runs once for however many IRQs came in.
+ */
+class Work {
+public:
+    using Callback = void (*)(void* context);
+
+    Work(Callback callback, void* context)
+        : m_callback(callback)
+        , m_context(context) {};
+    Work(const Work&) = delete;
+    Work& operator=(const Work&) = delete;
+
+    bool is_queued() const { return m_is_queued; }
+
+private:
+    friend class WorkQueue;
+
+    Callback m_callback;
+    void* m_context;
+    Work* m_next = nullptr;
+    bool m_is_queued = false;
+};
+
+/*
+ * Work waiting for the worker task, in the order it was queued.
+ */
+class WorkQueue {
+public:
+    WorkQueue() = default;
+    WorkQueue(const WorkQueue&) = delete;
+    WorkQueue& operator=(const WorkQueue&) = delete;
+
+    // Wakes the worker, if it is waiting
+    void queue(InterruptsDisabledTag, Work&);
+
+    // The body of the worker task; see work_queue_worker()
+    [[noreturn]] void run_worker();
+
+private:
+    Work* take_front();
+
+    Work* m_head = nullptr;
+    Work* m_tail = nullptr;
+    WaitQueue m_worker;
+};
+
+WorkQueue& work_queue();
+
+extern "C" {
+// Where the worker task starts; created along with the task manager
+[[noreturn]] void work_queue_worker();
+}
@@ -17,4 +17,19 @@ void __aeabi_memcpy4(void* to, const void* __restrict__ from, size_t size)
     memcpy(to, from, size);
 }
 
+void __aeabi_memmove(void* to, const void* from, size_t size)
+{
+    memmove(to, from, size);
+}
+
+void __aeabi_memmove4(void* to, const void* from, size_t size)
+{
+    memmove(to, from, size);
+}
+
+void __aeabi_memmove8(void* to, const void* from, size_t size)
+{
+    memmove(to, from, size);
+}
+
 }
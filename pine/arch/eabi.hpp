@@ -6,5 +6,8 @@ extern "C" {
 void __aeabi_memclr4(void* dest, size_t size);
 void __aeabi_memcpy4(void* to, const void* __restrict__ from, size_t size);
 void __aeabi_memclr8(void* dest, size_t size);
+void __aeabi_memmove(void* to, const void* from, size_t size);
+void __aeabi_memmove4(void* to, const void* from, size_t size);
+void __aeabi_memmove8(void* to, const void* from, size_t size);
 
 }
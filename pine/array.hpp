@@ -1,6 +1,7 @@
 #pragma once
 
 #include <pine/iter.hpp>
+#include <pine/twomath.hpp>
 #include <pine/types.hpp>
 #include <pine/utility.hpp>
 
@@ -59,25 +60,39 @@ public:
     BitMap() = default;
     [[nodiscard]] bool bit(size_t index) const
     {
-        return word(index) & ((size_t)1 << index);
+        return word(index) & bit_mask(index);
     }
     void mark_bit(size_t index, bool value)
     {
-        word(index) = (word(index) & ~((size_t)value << index)) | ((size_t)value << index);
+        word(index) = (word(index) & ~bit_mask(index)) | ((size_t)value << (index % c_word_size));
     }
     void set_bit(size_t index)
     {
-        word(index) = word(index) ^ ((size_t)1 << index);
+        word(index) = word(index) | bit_mask(index);
     }
     void clear_bit(size_t index)
     {
-        word(index) = word(index) & ~((size_t)1 << index);
+        word(index) = word(index) & ~bit_mask(index);
     }
-    size_t& word(size_t index) & { return m_bitmap[index / NumBits]; }
-    const size_t& word(size_t index) const & { return m_bitmap[index / NumBits]; }
+    /*
+     * Returns the index of the first clear bit, or NumBits if all are set.
+     * Checks a word at a time.
+     */
+    [[nodiscard]] size_t find_first_zero() const
+    {
+        for (size_t i = 0; i < m_bitmap.length(); i++) {
+            if (m_bitmap[i] != ~(size_t)0)
+                return min(i * c_word_size + countr_zero(~m_bitmap[i]), NumBits);
+        }
+        return NumBits;
+    }
+    size_t& word(size_t index) & { return m_bitmap[index / c_word_size]; }
+    const size_t& word(size_t index) const & { return m_bitmap[index / c_word_size]; }
 
 private:
     static constexpr size_t c_word_size = (sizeof(size_t)*CHAR_BIT);  // I know, I know... close enough
+    static size_t bit_mask(size_t index) { return (size_t)1 << (index % c_word_size); }
+
     Array<size_t, divide_up(NumBits, c_word_size)> m_bitmap;
 };
 
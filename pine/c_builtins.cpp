@@ -1,34 +1,304 @@
 #include "c_builtins.hpp"
 
-extern "C" {
+// Otherwise GCC happily recognizes the byte and word loops below as memset or
+// memcpy and "optimizes" them into calls to themselves
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize("no-tree-loop-distribute-patterns")
+#endif
+
+namespace {
+
+// Words may alias anything we are asked to copy
+typedef size_t __attribute__((__may_alias__)) Word;
+
+constexpr size_t c_word_size = sizeof(Word);
+// Bytes moved per iteration of the unrolled loops; one cache line on aarch64
+constexpr size_t c_block_size = 8 * c_word_size;
+
+#ifdef AARCH64
+// Bytes zeroed by a DC ZVA; zero until enable_cache_block_zeroing() is called
+size_t g_zva_block_size = 0;
+#endif
+
+inline bool is_word_aligned(const void* ptr)
+{
+    return (reinterpret_cast<PtrData>(ptr) & (c_word_size - 1)) == 0;
+}
+
+inline bool is_mutually_word_aligned(const void* first, const void* second)
+{
+    return ((reinterpret_cast<PtrData>(first) ^ reinterpret_cast<PtrData>(second)) & (c_word_size - 1)) == 0;
+}
+
+inline Word repeat_byte(unsigned char c)
+{
+    return static_cast<Word>(-1) / 0xff * c;
+}
+
+/*
+ * Copies as many whole blocks as possible from and to word aligned pointers,
+ * returning the number of bytes copied.
+ */
+size_t copy_blocks(unsigned char* to, const unsigned char* from, size_t size)
+{
+    size_t num_blocks = size / c_block_size;
+    if (num_blocks == 0)
+        return 0;
+
+#ifdef AARCH64
+    asm volatile(
+        "1:\n"
+        "ldp x8, x9, [%[from]], #16\n"
+        "ldp x10, x11, [%[from]], #16\n"
+        "ldp x12, x13, [%[from]], #16\n"
+        "ldp x14, x15, [%[from]], #16\n"
+        "stp x8, x9, [%[to]], #16\n"
+        "stp x10, x11, [%[to]], #16\n"
+        "stp x12, x13, [%[to]], #16\n"
+        "stp x14, x15, [%[to]], #16\n"
+        "subs %[n], %[n], #1\n"
+        "b.ne 1b\n"
+        : [to] "+r"(to), [from] "+r"(from), [n] "+r"(num_blocks)
+        :
+        : "x8", "x9", "x10", "x11", "x12", "x13", "x14", "x15", "cc", "memory");
+#elif AARCH32
+    // r7, r9 and r11 may be reserved (frame pointer, platform register)
+    asm volatile(
+        "1:\n"
+        "ldmia %[from]!, {r3, r4, r5, r6}\n"
+        "stmia %[to]!, {r3, r4, r5, r6}\n"
+        "ldmia %[from]!, {r3, r4, r5, r6}\n"
+        "stmia %[to]!, {r3, r4, r5, r6}\n"
+        "subs %[n], %[n], #1\n"
+        "bne 1b\n"
+        : [to] "+r"(to), [from] "+r"(from), [n] "+r"(num_blocks)
+        :
+        : "r3", "r4", "r5", "r6", "cc", "memory");
+#else
+    auto* to_word = reinterpret_cast<Word*>(to);
+    auto* from_word = reinterpret_cast<const Word*>(from);
+    for (; num_blocks > 0; num_blocks--) {
+        for (size_t i = 0; i < 8; i++)
+            to_word[i] = from_word[i];
+        to_word += 8;
+        from_word += 8;
+    }
+#endif
+
+    return size - size % c_block_size;
+}
+
+/*
+ * Sets as many whole blocks as possible to the given word from a word aligned
+ * pointer, returning the number of bytes set.
+ */
+size_t set_blocks(unsigned char* to, Word word, size_t size)
+{
+    size_t num_blocks = size / c_block_size;
+    if (num_blocks == 0)
+        return 0;
+
+#ifdef AARCH64
+    asm volatile(
+        "1:\n"
+        "stp %[word], %[word], [%[to]], #16\n"
+        "stp %[word], %[word], [%[to]], #16\n"
+        "stp %[word], %[word], [%[to]], #16\n"
+        "stp %[word], %[word], [%[to]], #16\n"
+        "subs %[n], %[n], #1\n"
+        "b.ne 1b\n"
+        : [to] "+r"(to), [n] "+r"(num_blocks)
+        : [word] "r"(word)
+        : "cc", "memory");
+#elif AARCH32
+    asm volatile(
+        "mov r3, %[word]\n"
+        "mov r4, %[word]\n"
+        "mov r5, %[word]\n"
+        "mov r6, %[word]\n"
+        "1:\n"
+        "stmia %[to]!, {r3, r4, r5, r6}\n"
+        "stmia %[to]!, {r3, r4, r5, r6}\n"
+        "subs %[n], %[n], #1\n"
+        "bne 1b\n"
+        : [to] "+r"(to), [n] "+r"(num_blocks)
+        : [word] "r"(word)
+        : "r3", "r4", "r5", "r6", "cc", "memory");
+#else
+    auto* to_word = reinterpret_cast<Word*>(to);
+    for (; num_blocks > 0; num_blocks--) {
+        for (size_t i = 0; i < 8; i++)
+            to_word[i] = word;
+        to_word += 8;
+    }
+#endif
+
+    return size - size % c_block_size;
+}
 
-void bzero(void* target, size_t size)
+#ifdef AARCH64
+/*
+ * Zeroes whole DC ZVA blocks from a word aligned pointer, returning the number
+ * of bytes zeroed. This avoids reading in the lines we are about to overwrite.
+ */
+size_t zero_cache_blocks(unsigned char* to, size_t size)
 {
-    unsigned char* _target = (unsigned char*)target;
+    size_t block_size = g_zva_block_size;
+    // Not worth aligning to a block unless we zero a few of them
+    if (block_size == 0 || size < 4 * block_size)
+        return 0;
+
+    size_t head = -reinterpret_cast<PtrData>(to) & (block_size - 1);
+    auto* to_word = reinterpret_cast<Word*>(to);
+    for (size_t i = 0; i < head / c_word_size; i++)
+        to_word[i] = 0;
+
+    auto* block = to + head;
+    size_t num_blocks = (size - head) / block_size;
+    for (size_t i = 0; i < num_blocks; i++) {
+        asm volatile("dc zva, %0" ::"r"(block)
+                     : "memory");
+        block += block_size;
+    }
+
+    return head + num_blocks * block_size;
+}
+#endif
+
+/*
+ * Copies from low to high addresses, so it is also safe for overlapping
+ * regions when to is below from.
+ */
+void copy_forward(unsigned char* to, const unsigned char* from, size_t size)
+{
+    if (size >= c_word_size && is_mutually_word_aligned(to, from)) {
+        while (!is_word_aligned(to)) {
+            *to++ = *from++;
+            size--;
+        }
+
+        // The block copy loads a whole block before storing any of it, so
+        // this remains safe for overlap
+        size_t copied = copy_blocks(to, from, size);
+        to += copied;
+        from += copied;
+        size -= copied;
+
+        for (; size >= c_word_size; size -= c_word_size) {
+            *reinterpret_cast<Word*>(to) = *reinterpret_cast<const Word*>(from);
+            to += c_word_size;
+            from += c_word_size;
+        }
+    }
+
     while (size > 0) {
-        *_target++ = 0;
+        *to++ = *from++;
         size--;
     }
 }
 
-void* memcpy(void* __restrict__ to, const void* __restrict__ from, size_t size)
+/*
+ * Copies from high to low addresses, for overlapping regions where to is
+ * above from.
+ */
+void copy_backward(unsigned char* to, const unsigned char* from, size_t size)
 {
-    unsigned char* _to = (unsigned char*)to;
-    unsigned char* _from = (unsigned char*)from;
+    to += size;
+    from += size;
+
+    if (size >= c_word_size && is_mutually_word_aligned(to, from)) {
+        while (!is_word_aligned(to)) {
+            *--to = *--from;
+            size--;
+        }
+
+        for (; size >= c_word_size; size -= c_word_size) {
+            to -= c_word_size;
+            from -= c_word_size;
+            *reinterpret_cast<Word*>(to) = *reinterpret_cast<const Word*>(from);
+        }
+    }
+
     while (size > 0) {
-        *_to = *_from;
-        _to++;
-        _from++;
+        *--to = *--from;
         size--;
     }
+}
+
+}
+
+namespace pine {
+
+void enable_cache_block_zeroing() noexcept
+{
+#ifdef AARCH64
+    // See D13.2.35 in ARMv8 Reference Manual
+    u64 dczid;
+    asm volatile("mrs %0, dczid_el0"
+                 : "=r"(dczid));
+    bool is_prohibited = dczid & (1 << 4);
+    if (!is_prohibited)
+        g_zva_block_size = static_cast<size_t>(4) << (dczid & 0xf);
+#endif
+}
+
+}
+
+extern "C" {
+
+void bzero(void* target, size_t size) noexcept
+{
+    memset(target, 0, size);
+}
+
+void* memcpy(void* __restrict__ to, const void* __restrict__ from, size_t size) noexcept
+{
+    copy_forward(static_cast<unsigned char*>(to), static_cast<const unsigned char*>(from), size);
+    return to;
+}
+
+void* memmove(void* to, const void* from, size_t size) noexcept
+{
+    auto* _to = static_cast<unsigned char*>(to);
+    auto* _from = static_cast<const unsigned char*>(from);
+    if (_to <= _from || _to >= _from + size)
+        copy_forward(_to, _from, size);
+    else
+        copy_backward(_to, _from, size);
 
     return to;
 }
 
-void* memset(void* to, int c, size_t size)
+void* memset(void* to, int c, size_t size) noexcept
 {
-    unsigned char* _to = (unsigned char*)to;
-    unsigned char c_ = (unsigned char)c;
+    auto* _to = static_cast<unsigned char*>(to);
+    auto c_ = static_cast<unsigned char>(c);
+
+    if (size >= c_word_size) {
+        while (!is_word_aligned(_to)) {
+            *_to++ = c_;
+            size--;
+        }
+
+        size_t set = 0;
+#ifdef AARCH64
+        if (c_ == 0)
+            set = zero_cache_blocks(_to, size);
+#endif
+        _to += set;
+        size -= set;
+
+        Word word = repeat_byte(c_);
+        set = set_blocks(_to, word, size);
+        _to += set;
+        size -= set;
+
+        for (; size >= c_word_size; size -= c_word_size) {
+            *reinterpret_cast<Word*>(_to) = word;
+            _to += c_word_size;
+        }
+    }
+
     while (size > 0) {
         *_to++ = c_;
         size--;
@@ -16,8 +16,20 @@
 
 extern "C" {
 
-void bzero(void* target, size_t size);
-void* memcpy(void* __restrict__ to, const void* __restrict__ from, size_t size);
-void* memset(void* to, int c, size_t size);
+void bzero(void* target, size_t size) noexcept;
+void* memcpy(void* __restrict__ to, const void* __restrict__ from, size_t size) noexcept;
+void* memmove(void* to, const void* from, size_t size) noexcept;
+void* memset(void* to, int c, size_t size) noexcept;
+
+}
+
+namespace pine {
+
+/*
+ * Lets bzero() and memset() zero large buffers a cache block at a time (DC ZVA
+ * on aarch64; a no-op elsewhere). Only call this once the MMU and caches are
+ * on: DC ZVA faults on Device memory, which is all memory before that.
+ */
+void enable_cache_block_zeroing() noexcept;
 
 }
@@ -3,58 +3,149 @@
 #include "math.hpp"
 #include "types.hpp"
 
-namespace pine {
+// Otherwise GCC may recognize the byte loops below as strlen() and turn them
+// into calls to a function that doesn't exist in the kernel
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize("no-tree-loop-distribute-patterns")
+#endif
 
-size_t strcopy(char* __restrict__ to, const char* from)
+namespace {
+
+// Words may alias the characters we read them from
+typedef size_t __attribute__((__may_alias__)) Word;
+
+constexpr size_t c_word_size = sizeof(Word);
+constexpr Word c_low_bits = static_cast<Word>(-1) / 0xff;  // 0x0101...01
+constexpr Word c_high_bits = c_low_bits << 7;               // 0x8080...80
+
+/*
+ * Whether any byte in the word is zero. Subtracting one from each byte only
+ * borrows into the high bit of a byte that was zero (or had its high bit set
+ * already, which ~word masks out).
+ */
+inline bool has_zero_byte(Word word)
+{
+    return ((word - c_low_bits) & ~word & c_high_bits) != 0;
+}
+
+/*
+ * Aligned words never straddle a page, so reading whole words from an aligned
+ * pointer can't fault past the terminator even if the rest of the word does
+ * not belong to the string.
+ */
+inline bool is_word_aligned(const void* ptr)
+{
+    return (reinterpret_cast<PtrData>(ptr) & (c_word_size - 1)) == 0;
+}
+
+inline bool is_mutually_word_aligned(const void* first, const void* second)
+{
+    return ((reinterpret_cast<PtrData>(first) ^ reinterpret_cast<PtrData>(second)) & (c_word_size - 1)) == 0;
+}
+
+/*
+ * Copies at most max_length characters and a terminator, returning the number
+ * of characters copied.
+ */
+size_t copy_string(char* __restrict__ to, const char* from, size_t max_length)
 {
     size_t copied = 0;
-    while (*from != '\0') {
-        *to = *from;
-        to++;
-        from++;
+    if (is_mutually_word_aligned(to, from)) {
+        while (!is_word_aligned(from) && copied < max_length && *from != '\0') {
+            *to++ = *from++;
+            copied++;
+        }
+
+        if (is_word_aligned(from)) {
+            // Whole words are only copied when they have no terminator, so
+            // nothing is written past where the byte loop would have
+            while (max_length - copied >= c_word_size) {
+                Word word = *reinterpret_cast<const Word*>(from);
+                if (has_zero_byte(word))
+                    break;
+
+                *reinterpret_cast<Word*>(to) = word;
+                to += c_word_size;
+                from += c_word_size;
+                copied += c_word_size;
+            }
+        }
+    }
+
+    while (copied < max_length && *from != '\0') {
+        *to++ = *from++;
         copied++;
     }
     *to = '\0';
     return copied;
 }
 
+}
+
+namespace pine {
+
+size_t strcopy(char* __restrict__ to, const char* from)
+{
+    return copy_string(to, from, static_cast<size_t>(-1));
+}
+
 size_t strbufcopy(char* __restrict__ buf, size_t bufsize, const char* from)
 {
     if (bufsize == 0)
         return 0;
 
-    size_t copied = 0;
-    while (*from != '\0' && copied + 1 < bufsize) { // + '\0'
-        *buf = *from;
-        buf++;
-        from++;
-        copied++;
-    }
-    *buf = '\0';
-    return copied;
+    return copy_string(buf, from, bufsize - 1);  // - '\0'
 }
 
 size_t strlen(const char* string)
 {
-    size_t offset = 0;
-    while (string[offset] != '\0') {
-        offset++;
+    const char* pos = string;
+    while (!is_word_aligned(pos)) {
+        if (*pos == '\0')
+            return static_cast<size_t>(pos - string);
+        pos++;
     }
-    return offset;
+
+    while (!has_zero_byte(*reinterpret_cast<const Word*>(pos)))
+        pos += c_word_size;
+
+    while (*pos != '\0')
+        pos++;
+
+    return static_cast<size_t>(pos - string);
 }
 
 int strcmp(const char* first, const char* second)
 {
-    size_t offset = 0;
-    while (first[offset] != '\0' && second[offset] != '\0') {
-        int diff = (unsigned char)first[offset] - (unsigned char)second[offset];
-        if (diff > 0)
-            return 1;
-        if (diff < 0)
-            return -1;
-        offset++;
+    if (is_mutually_word_aligned(first, second)) {
+        while (!is_word_aligned(first)) {
+            if (*first == '\0' || *first != *second)
+                break;
+            first++;
+            second++;
+        }
+
+        // Skip over equal words, stopping at (and comparing bytewise) the
+        // word with a difference or the terminator
+        if (is_word_aligned(first)) {
+            while (true) {
+                Word first_word = *reinterpret_cast<const Word*>(first);
+                if (first_word != *reinterpret_cast<const Word*>(second) || has_zero_byte(first_word))
+                    break;
+                first += c_word_size;
+                second += c_word_size;
+            }
+        }
+    }
+
+    while (*first != '\0' && *first == *second) {
+        first++;
+        second++;
     }
-    return first[offset] != second[offset];
+
+    auto first_char = static_cast<unsigned char>(*first);
+    auto second_char = static_cast<unsigned char>(*second);
+    return (first_char > second_char) - (first_char < second_char);
 }
 
 }
@@ -4,5 +4,7 @@ enum Errno {
     EBADF,
     EFBIG,
     EINVAL,
-    ENOMEM
+    ENOMEM,
+    EBUSY,
+    EFAULT
 };
@@ -134,6 +134,27 @@ public:
             m_tail = prev ? prev : next;
     }
 
+    /*
+     * Unlinks the node without destroying it, so it can be added to another
+     * list.
+     */
+    void detach(Node* node_ptr)
+    {
+        m_length--;
+        auto prev = exchange(node_ptr->m_prev, nullptr);
+        auto next = exchange(node_ptr->m_next, nullptr);
+
+        if (prev)
+            prev->m_next = next;
+        if (next)
+            next->m_prev = prev;
+
+        if (node_ptr == m_head)
+            m_head = next;
+        if (node_ptr == m_tail)
+            m_tail = prev;
+    }
+
     [[nodiscard]] size_t length() const { return m_length; }
 
     using Iter = PtrIter<ManualLinkedList<Content>, Node*>;
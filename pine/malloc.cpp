@@ -117,6 +117,193 @@ size_t IntrusiveFreeList::free(Allocation alloc)
 }
 
 
+Pair<unsigned, unsigned> TLSFAllocator::bin_indexes(size_t size)
+{
+    if (size < c_small_block_size)
+        return { 0, static_cast<unsigned>(size / (c_small_block_size / c_sl_count)) };
+
+    auto fl = fls(size);
+    auto sl = static_cast<unsigned>((size >> (fl - c_sl_log2)) ^ c_sl_count);
+    return { fl - (c_fl_shift - 1), sl };
+}
+
+void TLSFAllocator::set_size(Block* block, size_t size)
+{
+    block->size_and_flags = size | (block->size_and_flags & ~c_size_mask);
+}
+
+void TLSFAllocator::mark_free(Block* block, bool free)
+{
+    // The next block always exists, since regions end with a sentinel
+    auto* next_block = next_physical(block);
+    if (free) {
+        block->size_and_flags |= c_free_bit;
+        next_block->size_and_flags |= c_prev_free_bit;
+        next_block->prev_physical = block;
+    }
+    else {
+        block->size_and_flags &= ~c_free_bit;
+        next_block->size_and_flags &= ~c_prev_free_bit;
+    }
+}
+
+Allocation TLSFAllocator::allocate(size_t requested_size)
+{
+    if (requested_size > c_max_block_size / 2)
+        return {};
+
+    auto size = adjust_request_size(requested_size);
+    auto* block = find_free_block(round_up_block_size(size));
+    if (!block)
+        return {};
+
+    remove_block(block);
+    split_block(block, size);
+    mark_free(block, false);
+    return { payload(block), block_size(block) };
+}
+
+void TLSFAllocator::add(void* ptr, size_t size)
+{
+    auto start = align_up_two(reinterpret_cast<PtrData>(ptr), Alignment);
+    auto end = align_down_two(reinterpret_cast<PtrData>(ptr) + size, Alignment);
+    if (end <= start || end - start < c_region_overhead + c_min_block_size)
+        return;
+
+    auto block_size = min(end - start - 2 * c_header_size, c_max_block_size & ~(Alignment - 1));
+    auto* block = new (reinterpret_cast<Block*>(start)) Block { nullptr, block_size, nullptr, nullptr };
+
+    // Zero sized, never free, so that we never coalesce past the region. Only
+    // the header fits; the free list pointers would be past the end
+    auto* sentinel = next_physical(block);
+    sentinel->prev_physical = block;
+    sentinel->size_and_flags = 0;
+
+    mark_free(block, true);
+    insert_block(block);
+    ++m_num_regions;
+}
+
+size_t TLSFAllocator::free(Allocation alloc)
+{
+    // FIXME: We should assert that the pointer belongs to us and is aligned:
+    auto* block = from_payload(alloc.ptr);
+    size_t size_freed = block_size(block);
+
+    if (is_prev_free(block)) {
+        auto* prev_block = block->prev_physical;
+        remove_block(prev_block);
+        block = merge_with_next(prev_block);
+    }
+
+    auto* next_block = next_physical(block);
+    if (is_free(next_block)) {
+        remove_block(next_block);
+        block = merge_with_next(block);
+    }
+
+    mark_free(block, true);
+    insert_block(block);
+
+    // Only the first block of a region has no previous block, and regions
+    // end with an empty sentinel
+    if (!block->prev_physical && block_size(next_physical(block)) == 0)
+        m_reclaimable_block = block;
+
+    return size_freed;
+}
+
+Allocation TLSFAllocator::reclaim()
+{
+    auto* block = exchange(m_reclaimable_block, nullptr);
+    if (!block || m_num_regions <= 1)
+        return {};
+
+    // The block may have since been allocated (and split) again
+    if (!is_free(block) || block_size(next_physical(block)) != 0)
+        return {};
+
+    remove_block(block);
+    --m_num_regions;
+    return { block, c_header_size + block_size(block) + c_header_size };
+}
+
+TLSFAllocator::Block* TLSFAllocator::find_free_block(size_t size)
+{
+    auto [fl, sl] = bin_indexes(size);
+    if (fl >= c_fl_count)
+        return nullptr;
+
+    // Anything in a larger second level bin of this first level, otherwise
+    // the smallest bin of a larger first level
+    u32 sl_map = m_sl_bitmaps[fl] & (~0u << sl);
+    if (!sl_map) {
+        u32 fl_map = fl + 1 < c_fl_count ? m_fl_bitmap & (~0u << (fl + 1)) : 0;
+        if (!fl_map)
+            return nullptr;
+
+        fl = countr_zero(fl_map);
+        sl_map = m_sl_bitmaps[fl];
+    }
+
+    return m_free_blocks[fl][countr_zero(sl_map)];
+}
+
+TLSFAllocator::Block* TLSFAllocator::split_block(Block* block, size_t size)
+{
+    auto curr_size = block_size(block);
+    if (curr_size < size + c_header_size + c_min_block_size)
+        return nullptr;  // remainder would be too small to ever be useful
+
+    set_size(block, size);
+    auto* remainder = new (next_physical(block)) Block { block, curr_size - size - c_header_size, nullptr, nullptr };
+    mark_free(remainder, true);
+    insert_block(remainder);
+    return remainder;
+}
+
+TLSFAllocator::Block* TLSFAllocator::merge_with_next(Block* block)
+{
+    auto* next_block = next_physical(block);
+    set_size(block, block_size(block) + c_header_size + block_size(next_block));
+    next_physical(block)->prev_physical = block;
+    return block;
+}
+
+void TLSFAllocator::insert_block(Block* block)
+{
+    auto [fl, sl] = bin_indexes(block_size(block));
+    auto*& head = m_free_blocks[fl][sl];
+
+    block->prev_free = nullptr;
+    block->next_free = head;
+    if (head)
+        head->prev_free = block;
+    head = block;
+
+    m_fl_bitmap |= 1u << fl;
+    m_sl_bitmaps[fl] |= 1u << sl;
+}
+
+void TLSFAllocator::remove_block(Block* block)
+{
+    auto [fl, sl] = bin_indexes(block_size(block));
+    auto*& head = m_free_blocks[fl][sl];
+
+    if (block->prev_free)
+        block->prev_free->next_free = block->next_free;
+    if (block->next_free)
+        block->next_free->prev_free = block->prev_free;
+    if (head == block)
+        head = block->next_free;
+
+    if (!head) {
+        m_sl_bitmaps[fl] &= ~(1u << sl);
+        if (!m_sl_bitmaps[fl])
+            m_fl_bitmap &= ~(1u << fl);
+    }
+}
+
 Allocation FixedAllocation::allocate(size_t amount)
 {
     if (!m_has_memory || amount > m_size)
@@ -153,12 +340,21 @@ void HighWatermarkAllocator::add(void* ptr, size_t size)
 
 BrokeredAllocation PageAllocatorBackend::allocate(size_t num_pages, PageAlignmentLevel page_alignment)
 {
-    auto* node = find_free_pages(num_pages, page_alignment);
-    if (!node)
+    // Blocks are aligned to their own length, so asking for a larger block
+    // is how we get a larger alignment
+    auto end_depth = depth_from_page_length(align_up_to_power(num_pages));
+    auto min_depth = max(end_depth, depth_from_page_length(static_cast<size_t>(page_alignment)));
+
+    auto depth = find_free_depth(min_depth);
+    if (depth == max_depth)
         return {};
 
-    auto [region, num_splits] = remove_and_trim_pages(node, num_pages);
-    return { region.ptr(), region.size(), num_splits * sizeof(Node) };
+    auto* node = m_free_trees[depth].first();
+    auto region = node->region;
+    remove_node(depth, node);
+
+    auto [final_region, cost] = trim_aligned_region(region, depth, end_depth);
+    return { final_region.ptr(), final_region.size(), cost };
 }
 
 void PageAllocatorBackend::init(PageRegion allocating_range, PageRegion scratch_pages)
@@ -169,12 +365,23 @@ void PageAllocatorBackend::init(PageRegion allocating_range, PageRegion scratch_
 
 BrokeredAllocation PageAllocatorBackend::reserve_region(PageRegion region)
 {
-    auto* node = find_free_region(region);
-    if (!node)
-        return {};
+    AllocationCost cost = 0;
+    auto remaining_region = region;
+    while (remaining_region) {
+        auto [block, next_region] = remaining_region.split_left(page_length_from_depth(first_block_depth(remaining_region)));
+
+        auto* node = find_free_region(block);
+        if (!node) {
+            // Give back the blocks we've already taken
+            free_region({ region.offset, remaining_region.offset - region.offset });
+            return {};
+        }
+
+        cost += remove_and_trim_region(node, block).second;
+        remaining_region = next_region;
+    }
 
-    auto [final_region, num_splits] = remove_and_trim_region(node, region);
-    return { final_region.ptr(), final_region.size(), num_splits * sizeof(Node) };
+    return { region.ptr(), region.size(), cost };
 }
 
 void PageAllocatorBackend::add(PageRegion pages)
@@ -184,10 +391,35 @@ void PageAllocatorBackend::add(PageRegion pages)
 
 AllocationCost PageAllocatorBackend::free_region(PageRegion region)
 {
-    if (!region)
-        return 0;
+    // Break the region up into aligned blocks, so that any region can be
+    // given back, not just those we handed out
+    AllocationCost cost = 0;
+    while (region) {
+        auto depth = first_block_depth(region);
+        auto [block, next_region] = region.split_left(page_length_from_depth(depth));
+
+        cost += free_block(block, depth);
+        region = next_region;
+    }
+
+    return cost;
+}
+
+AllocationCost PageAllocatorBackend::free_block(PageRegion block, unsigned depth)
+{
+    while (depth + 1 < max_depth) {
+        auto* buddy_node = find_block(depth, block.offset ^ page_length_from_depth(depth));
+        if (!buddy_node)
+            break;
+
+        auto buddy = buddy_node->region;
+        remove_node(depth, buddy_node);
+
+        ++depth;
+        block = { min(block.offset, buddy.offset), page_length_from_depth(depth) };
+    }
 
-    auto [depth, node] = create_node(region);
+    auto [_, node] = create_node(block);
     if (!node)
         return 0;  // ASSERT false? this should be guaranteed by the broker
 
@@ -201,43 +433,45 @@ void PageAllocatorBackend::free(Allocation allocation)
     free_region(region);
 }
 
-ManualLinkedList<PageRegion>::Node* PageAllocatorBackend::find_free_pages(size_t num_pages, PageAlignmentLevel page_alignment)
+unsigned PageAllocatorBackend::find_free_depth(unsigned min_depth) const
 {
-    unsigned depth = depth_from_page_length(num_pages);
+    if (min_depth >= max_depth)
+        return max_depth;
 
-    while (depth != max_depth) {
-        auto begin = m_free_lists[depth].begin();
-        auto end = m_free_lists[depth].end();
-        auto it = find_if(begin, end, [&](const Node* node) {
-            return node->contents().fits(num_pages)
-                && node->contents().aligned_to(static_cast<unsigned>(page_alignment));
-        });
-        if (it != end)
-            return *it;
+    auto free_depths = m_free_depths & ~(page_length_from_depth(min_depth) - 1);
+    if (!free_depths)
+        return max_depth;
 
-        ++depth;
-    }
-
-    return nullptr;
+    return countr_zero(free_depths);
 }
 
-ManualLinkedList<PageRegion>::Node* PageAllocatorBackend::find_free_region(PageRegion region)
+PageAllocatorBackend::Node* PageAllocatorBackend::find_free_region(PageRegion region)
 {
-    unsigned depth = depth_from_page_length(region.length);
+    // Blocks are aligned to their length, so only one at each depth can
+    // contain the region
+    unsigned depth = find_free_depth(depth_from_page_length(region.length));
 
     while (depth != max_depth) {
-        auto begin = m_free_lists[depth].begin();
-        auto end = m_free_lists[depth].end();
-        auto it = find_if(begin, end, [&](const auto& node) { return node->contents().contains(region); });
-        if (it != end)
-            return *it;
+        auto* node = find_block(depth, align_down_two(region.offset, page_length_from_depth(depth)));
+        if (node && node->region.contains(region))
+            return node;
 
-        ++depth;
+        depth = find_free_depth(depth + 1);
     }
 
     return nullptr;
 }
 
+PageAllocatorBackend::Node* PageAllocatorBackend::find_block(unsigned depth, size_t offset) const
+{
+    return m_free_trees[depth].find([&](const Node& node) {
+        if (node.region.offset == offset)
+            return 0;
+
+        return node.region.offset < offset ? -1 : 1;
+    });
+}
+
 Pair<PageRegion, AllocationCost> PageAllocatorBackend::trim_aligned_region(PageRegion curr_region, unsigned curr_depth, unsigned end_depth)
 {
     unsigned start_depth = curr_depth;
@@ -256,35 +490,20 @@ Pair<PageRegion, AllocationCost> PageAllocatorBackend::trim_aligned_region(PageR
     return { curr_region, (start_depth - curr_depth) * IntrusiveFreeList::max_overhead_per_allocation() };
 }
 
-Pair<PageRegion, AllocationCost> PageAllocatorBackend::remove_and_trim_pages(ManualLinkedList<PageRegion>::Node* node, size_t min_pages)
+Pair<PageRegion, AllocationCost> PageAllocatorBackend::remove_and_trim_region(Node* node, PageRegion min_region)
 {
-    auto curr_region = node->contents();
-    auto curr_depth = depth_from_page_length(curr_region.length);
-
-    remove_node(curr_depth, node);
-
-    auto num_pages_aligned = align_up_to_power(min_pages);
-    auto min_depth = depth_from_page_length(num_pages_aligned);
-
-    return trim_aligned_region(curr_region, curr_depth, min_depth);
-}
-
-Pair<PageRegion, AllocationCost> PageAllocatorBackend::remove_and_trim_region(ManualLinkedList<PageRegion>::Node* node, PageRegion min_region)
-{
-    auto curr_region = node->contents();
+    auto curr_region = node->region;
     auto curr_depth = depth_from_page_length(curr_region.length);
+    auto start_depth = curr_depth;
 
     remove_node(curr_depth, node);
 
     auto end_depth = depth_from_page_length(min_region.length);
     while (curr_depth != end_depth) {
+        // Both halves are aligned blocks, so one of them must contain min_region
         auto [reserved_region, remainder_region] = curr_region.halve();
-        if (!reserved_region.contains(min_region)) {
-            if (!remainder_region.contains(min_region))
-                break;
-
+        if (!reserved_region.contains(min_region))
             pine::swap(remainder_region, reserved_region);
-        }
 
         --curr_depth;
         auto [_, node] = create_node(remainder_region);
@@ -295,7 +514,7 @@ Pair<PageRegion, AllocationCost> PageAllocatorBackend::remove_and_trim_region(Ma
         curr_region = reserved_region;
     }
 
-    return { curr_region, (end_depth - curr_depth) * IntrusiveFreeList::max_overhead_per_allocation() };
+    return { curr_region, (start_depth - curr_depth) * IntrusiveFreeList::max_overhead_per_allocation() };
 }
 
 Pair<unsigned, PageAllocatorBackend::Node*> PageAllocatorBackend::create_node(PageRegion region)
@@ -308,18 +527,19 @@ Pair<unsigned, PageAllocatorBackend::Node*> PageAllocatorBackend::create_node(Pa
     return { depth, new (static_cast<Node*>(allocation.ptr)) Node(region) };
 }
 
-void PageAllocatorBackend::remove_node(unsigned depth, ManualLinkedList<PageRegion>::Node* node)
+void PageAllocatorBackend::remove_node(unsigned depth, Node* node)
 {
-    m_free_lists[depth].remove(node);
+    m_free_trees[depth].remove(*node);
     m_node_allocator.free(Allocation { static_cast<void*>(node), sizeof(Node) });
+
+    if (m_free_trees[depth].is_empty())
+        m_free_depths &= ~page_length_from_depth(depth);
 }
 
 void PageAllocatorBackend::insert_node(unsigned depth, Node* node)
 {
-    auto begin = m_free_lists[depth].begin();
-    auto end = m_free_lists[depth].end();
-    auto insertion_pt = lower_bound(begin, end, node->contents(), ManualLinkedList<PageRegion>::Greater{});
-    m_free_lists[depth].insert_after(*insertion_pt, *node);
+    m_free_trees[depth].insert(*node);
+    m_free_depths |= page_length_from_depth(depth);
 }
 
 void print_with(Printer& printer, const PageBroker& page_broker)
@@ -333,10 +553,14 @@ void print_with(Printer& printer, const PageBroker& page_broker)
 void print_with(Printer& printer, const PageAllocatorBackend& alloc)
 {
     print_with(printer, "PageAllocator {\n");
-    for (const auto& region_list : alloc.m_free_lists) {
-        print_with(printer, "\t");
-        print_with(printer, region_list);
-        print_with(printer, ",\n");
+    for (const auto& free_tree : alloc.m_free_trees) {
+        print_with(printer, "\t[");
+        for (auto* node = free_tree.first(); node; node = PageAllocatorBackend::FreeTree::next(*node)) {
+            print_with(printer, node->region);
+            if (PageAllocatorBackend::FreeTree::next(*node))
+                print_with(printer, " <-> ");
+        }
+        print_with(printer, "],\n");
     }
 
     print_with(printer, "}");
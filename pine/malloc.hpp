@@ -3,6 +3,7 @@
 #include "c_builtins.hpp"
 #include "linked_list.hpp"
 #include "maybe.hpp"
+#include "rb_tree.hpp"
 #include "twomath.hpp"
 #include "types.hpp"
 #include "page.hpp"
@@ -63,6 +64,111 @@ private:
     ManualLinkedList<Header> m_free_list;
 };
 
+/*
+ * A two-level segregated fit (TLSF) allocator.
+ *
+ * Free blocks are binned by size, first by power of two and then linearly
+ * into c_sl_count subdivisions of that power. A bitmap per level records the
+ * non-empty bins, so finding a fitting block is two bit scans. Each block
+ * header points to the physically previous block and flags whether it is
+ * free (boundary tags), so blocks coalesce with both neighbors on free
+ * without searching. Both allocate and free are O(1).
+ */
+class TLSFAllocator {
+    struct Block {
+        Block* prev_physical;
+        size_t size_and_flags;  // payload size; see c_free_bit, c_prev_free_bit
+        // Only valid while free; overlaps the start of the payload
+        Block* next_free;
+        Block* prev_free;
+    };
+
+    static constexpr size_t c_header_size = align_up_two(offsetof(Block, next_free), Alignment);
+    static constexpr size_t c_min_block_size = align_up_two(sizeof(Block) - c_header_size, Alignment);
+
+    static constexpr size_t c_free_bit = 1;
+    static constexpr size_t c_prev_free_bit = 2;
+    static constexpr size_t c_size_mask = ~(c_free_bit | c_prev_free_bit);
+    static_assert(Alignment > (c_free_bit | c_prev_free_bit));
+
+    static constexpr unsigned c_align_log2 = countr_zero(Alignment);
+    static constexpr unsigned c_sl_log2 = 4;
+    static constexpr unsigned c_sl_count = 1u << c_sl_log2;
+    // Blocks below c_small_block_size all live in the first level, spaced by Alignment
+    static constexpr unsigned c_fl_shift = c_sl_log2 + c_align_log2;
+    static constexpr size_t c_small_block_size = (size_t)1u << c_fl_shift;
+    static constexpr unsigned c_fl_max = sizeof(size_t) >= 8 ? 32 : 30;
+    static constexpr unsigned c_fl_count = c_fl_max - c_fl_shift + 1;
+    static constexpr size_t c_max_block_size = ((size_t)1u << c_fl_max) - 1;
+    static_assert(c_sl_count <= sizeof(u32) * CHAR_BIT && c_fl_count <= sizeof(u32) * CHAR_BIT);
+
+    // The first block header and the end sentinel header
+    static constexpr size_t c_region_overhead = 2 * c_header_size + Alignment;
+
+public:
+    TLSFAllocator() = default;
+
+    static constexpr size_t preferred_size(size_t requested_size)
+    {
+        return align_up_two(round_up_block_size(adjust_request_size(requested_size)) + c_region_overhead, PageSize);
+    }
+
+    Allocation allocate(size_t);
+    void add(void*, size_t);
+    size_t free(Allocation);
+
+    /*
+     * Removes the most recently freed region given to add(), if all of it is
+     * free again, so that it can be given back to where it came from. The
+     * last region is always kept so that we do not thrash.
+     */
+    Allocation reclaim();
+
+private:
+    static constexpr size_t adjust_request_size(size_t requested_size)
+    {
+        return max(align_up_two(requested_size, Alignment), c_min_block_size);
+    }
+    // Rounds up to the next bin so that any block found in it will fit
+    static constexpr size_t round_up_block_size(size_t size)
+    {
+        if (size < c_small_block_size)
+            return size;
+
+        auto round = ((size_t)1u << (fls(size) - c_sl_log2)) - 1;
+        return size + round;
+    }
+    static constexpr unsigned fls(size_t size)
+    {
+        return sizeof(size_t) * CHAR_BIT - 1 - countl_zero(size);
+    }
+    static Pair<unsigned, unsigned> bin_indexes(size_t size);
+
+    static size_t block_size(const Block* block) { return block->size_and_flags & c_size_mask; }
+    static bool is_free(const Block* block) { return block->size_and_flags & c_free_bit; }
+    static bool is_prev_free(const Block* block) { return block->size_and_flags & c_prev_free_bit; }
+    static void* payload(Block* block) { return reinterpret_cast<u8*>(block) + c_header_size; }
+    static Block* from_payload(void* ptr) { return reinterpret_cast<Block*>(static_cast<u8*>(ptr) - c_header_size); }
+    static Block* next_physical(Block* block)
+    {
+        return reinterpret_cast<Block*>(static_cast<u8*>(payload(block)) + block_size(block));
+    }
+    static void set_size(Block* block, size_t size);
+    static void mark_free(Block* block, bool free);
+
+    Block* find_free_block(size_t size);
+    Block* split_block(Block* block, size_t size);
+    Block* merge_with_next(Block* block);
+    void insert_block(Block* block);
+    void remove_block(Block* block);
+
+    u32 m_fl_bitmap = 0;
+    Array<u32, c_fl_count> m_sl_bitmaps {};
+    Array<Array<Block*, c_sl_count>, c_fl_count> m_free_blocks {};
+    size_t m_num_regions = 0;
+    Block* m_reclaimable_block = nullptr;  // may be stale; see reclaim()
+};
+
 /*
  * Allocates memory from the FallbackAllocator and manages it with the
  * Allocator.
@@ -96,7 +202,15 @@ public:
     }
     size_t free(Allocation alloc)
     {
-        return m_allocator.free(alloc);
+        auto size_freed = m_allocator.free(alloc);
+
+        // Give back memory to the fallback when the allocator no longer uses
+        // it (this assumes anything given to add() came from the fallback too)
+        if constexpr (requires(Allocator allocator) { allocator.reclaim(); }) {
+            while (auto reclaimed = m_allocator.reclaim())
+                m_fallback_allocator->free(reclaimed);
+        }
+        return size_freed;
     }
 
 private:
@@ -139,144 +253,264 @@ private:
     bool m_has_memory;
 };
 
+/*
+ * Allocates fixed size Values out of pages.
+ *
+ * Each page starts with a header holding a bitmap of the Values in use, so a
+ * Value's header is found by aligning its address down. Pages are kept on
+ * partial, full and empty lists; allocations come from partial pages first so
+ * that empty pages can be reclaimed by whoever added them.
+ */
 template <typename Value>
-struct SlabAllocator {
-    static constexpr unsigned c_bits_per_bitmap = (PageSize * CHAR_BIT) - (PageSize % sizeof(Value));
-    static constexpr unsigned c_slabs_per_page = PageSize / sizeof(Value);
+class SlabAllocator {
+    static constexpr size_t c_max_slabs_per_page = PageSize / sizeof(Value);
+
+    using SlabBitMap = BitMap<c_max_slabs_per_page>;
+    struct SlabHeader {
+        SlabBitMap used {};
+        size_t num_used = 0;
+    };
+    using SlabPage = typename ManualLinkedList<SlabHeader>::Node;
+
+    static constexpr size_t c_slabs_offset = align_up_two(sizeof(SlabPage), max(alignof(Value), static_cast<size_t>(Alignment)));
+    static constexpr size_t c_slabs_per_page = (PageSize - c_slabs_offset) / sizeof(Value);
+    static_assert(c_slabs_per_page > 0, "Value does not fit in a page alongside the slab header");
 
 public:
     static constexpr size_t preferred_size(size_t requested_size)
     {
-        return align_up_two(requested_size, PageSize) + PageSize;
+        return align_up_two(requested_size, PageSize);
     }
 
     pine::Allocation allocate()
     {
-        auto [found, bitmap_page_index, index_in_bitmap_page] = try_find_free_bit();
-        if (!found)
+        auto& list = m_partial_pages.length() > 0 ? m_partial_pages : m_empty_pages;
+        if (list.length() == 0)
             return {};
 
-        auto& bitmap = (*next(m_bitmaps.begin(), bitmap_page_index))->contents();
-        bitmap.set_bit(index_in_bitmap_page);
-
-        auto [slab_page_index, index_in_slab_page] = calculate_slab_indexes(bitmap_page_index, index_in_bitmap_page);
-        auto slab_page = (*next(m_slab_pages.begin(), slab_page_index))->contents();
+        auto* page = *list.begin();
+        auto& header = page->contents();
+        auto index = header.used.find_first_zero();
+        header.used.set_bit(index);
+        ++header.num_used;
+        move_to_list(page, list);
 
-        auto* slab_page_ptr = reinterpret_cast<Value*>(slab_page);
-        return { slab_page_ptr + index_in_slab_page, sizeof(Value) };
+        return { slab_ptr(page, index), sizeof(Value) };
     }
     void add(void* ptr, size_t size)
     {
-        constexpr unsigned c_chunk_size = max(align_up_two(sizeof(BitMapNode), PageSize), align_up_two(sizeof(SlabNode), PageSize));
-
-        auto remove_page_from_variables = [&](void*& _ptr, size_t& _size) {
-            _size -= c_chunk_size;
-            _ptr = reinterpret_cast<void*>(reinterpret_cast<PtrData>(ptr) + c_chunk_size);
-        };
-
-        while (size >= c_chunk_size) {
-            if (m_bitmaps.length() * c_bits_per_bitmap - num_slabs() < c_slabs_per_page) {
-                auto bitmap_node_alloc = m_free_pages.allocate(sizeof(BitMapNode));
-                if (!bitmap_node_alloc) {
-                    m_free_pages.add(ptr, c_chunk_size);
-                    remove_page_from_variables(ptr, size);
-                    bitmap_node_alloc = m_free_pages.allocate(sizeof(BitMapNode));
-                    if (!bitmap_node_alloc)  // FIXME: ASSERT bitmap_node_alloc
-                        break;
-                }
-                auto bitmap_node = new (bitmap_node_alloc.ptr) BitMapNode();
-                m_bitmaps.append(*bitmap_node);
-            }
-
-            if (size < c_chunk_size)
-                break;
-
-            auto slab_node_alloc = m_free_pages.allocate(sizeof(SlabNode));
-            if (!slab_node_alloc) {
-                m_free_pages.add(ptr, c_chunk_size);
-                remove_page_from_variables(ptr, size);
-                slab_node_alloc = m_free_pages.allocate(sizeof(SlabNode));
-                if (!slab_node_alloc)  // FIXME: ASSERT slab_node_alloc
-                    break;
-            }
-            auto slab_node = new (slab_node_alloc.ptr) SlabNode(reinterpret_cast<PtrData>(ptr));
-            remove_page_from_variables(ptr, size);
-            m_slab_pages.append(*slab_node);
+        auto start = align_up_two(reinterpret_cast<PtrData>(ptr), PageSize);
+        auto end = reinterpret_cast<PtrData>(ptr) + size;
+        for (; start + PageSize <= end; start += PageSize) {
+            auto* page = new (reinterpret_cast<SlabPage*>(start)) SlabPage();
+            m_empty_pages.append(*page);
         }
-
     }
     size_t free(Allocation alloc)
     {
-        PtrData slab_ptr_data = reinterpret_cast<PtrData>(alloc.ptr);
-
-        auto [slab_page_index, index_in_slab_page] = find_associated_slab_page(slab_ptr_data);
-        auto [bitmap_page_index, index_in_bitmap_page] = calculate_bitmap_indexes(slab_page_index, index_in_slab_page);
-
-        auto& bitmap = (*next(m_bitmaps.begin(), bitmap_page_index))->contents();
-        bitmap.clear_bit(index_in_bitmap_page);
+        auto slab_ptr_data = reinterpret_cast<PtrData>(alloc.ptr);
+        auto* page = reinterpret_cast<SlabPage*>(align_down_two(slab_ptr_data, PageSize));
+        auto& header = page->contents();
+        auto& list = list_for(header);
+
+        auto index = (slab_ptr_data - reinterpret_cast<PtrData>(slab_ptr(page, 0))) / sizeof(Value);
+        header.used.clear_bit(index);
+        --header.num_used;
+        move_to_list(page, list);
         return sizeof(Value);
     }
 
-private:
-    size_t num_slabs() const { return m_slab_pages.length() * c_slabs_per_page; }
-    Triple<bool, size_t, size_t> try_find_free_bit()
+    /*
+     * Removes an empty page, if there is one, so that it can be given back to
+     * where it came from.
+     */
+    pine::Allocation reclaim()
     {
-       size_t page_index = 0;
-        for (auto& bitmap_node : m_bitmaps) {
-            SlabBitMap &bitmap = bitmap_node->contents();
+        if (m_empty_pages.length() == 0)
+            return {};
 
-            size_t i = 0;
-            for (; i < c_bits_per_bitmap && calculate_index_from_bitmap_indexes(page_index, i) < num_slabs(); i++)
-                if (!bitmap.bit(i))
-                    return {true, page_index, i };
+        auto* page = *m_empty_pages.begin();
+        m_empty_pages.remove(page);
+        return { static_cast<void*>(page), PageSize };
+    }
 
-            // Try next bitmap
-            ++page_index;
-        }
-        return { false, 0, 0 };
+    [[nodiscard]] size_t num_empty_pages() const { return m_empty_pages.length(); }
+    [[nodiscard]] size_t num_pages() const
+    {
+        return m_partial_pages.length() + m_full_pages.length() + m_empty_pages.length();
+    }
+    static constexpr size_t slabs_per_page() { return c_slabs_per_page; }
+
+private:
+    static Value* slab_ptr(SlabPage* page, size_t index)
+    {
+        auto slabs_start = reinterpret_cast<PtrData>(page) + c_slabs_offset;
+        return reinterpret_cast<Value*>(slabs_start) + index;
     }
-    Pair<size_t, size_t> find_associated_slab_page(PtrData slab)
+    ManualLinkedList<SlabHeader>& list_for(const SlabHeader& header)
     {
-        auto slab_page = align_down_two(slab, PageSize);
+        if (header.num_used == 0)
+            return m_empty_pages;
+        if (header.num_used == c_slabs_per_page)
+            return m_full_pages;
+        return m_partial_pages;
+    }
+    void move_to_list(SlabPage* page, ManualLinkedList<SlabHeader>& curr_list)
+    {
+        auto& new_list = list_for(page->contents());
+        if (&new_list == &curr_list)
+            return;
 
-        size_t slab_page_index = 0;
-        for (auto& slab_page_node : m_slab_pages) {
-            if (slab_page_node->contents() == slab_page)
-                break;
+        curr_list.detach(page);
+        new_list.append(*page);
+    }
 
-            ++slab_page_index;
-        }
+    ManualLinkedList<SlabHeader> m_partial_pages {};
+    ManualLinkedList<SlabHeader> m_full_pages {};
+    ManualLinkedList<SlabHeader> m_empty_pages {};
+};
 
-        return { slab_page_index, (slab - slab_page) / sizeof(Value) };
-    }
-    size_t calculate_index_from_bitmap_indexes(size_t bitmap_page_index, size_t index_in_bitmap_page) const
+/*
+ * Type erased allocator, so that the owner of a base class can give an object
+ * back to the cache of its derived class.
+ */
+class ObjectAllocator {
+public:
+    virtual Allocation allocate(size_t) = 0;
+    virtual size_t free(Allocation) = 0;
+
+protected:
+    ~ObjectAllocator() = default;
+};
+
+struct ObjectCacheStats {
+    size_t num_allocations = 0;
+    size_t num_magazine_hits = 0;  // allocations served by recently freed objects
+    size_t num_failed = 0;
+    size_t num_frees = 0;
+    size_t num_pages = 0;
+
+    [[nodiscard]] size_t num_in_use() const { return num_allocations - num_frees; }
+};
+
+/*
+ * A cache of Value sized objects (a kmem_cache), carved out of pages that are
+ * pulled from the FallbackAllocator and handed to a SlabAllocator. Slabs are
+ * whole pages, so the FallbackAllocator should hand out aligned pages (i.e.
+ * be a page allocator); pages are taken from it one at a time.
+ *
+ * Recently freed objects are kept in a small magazine and handed out first,
+ * skipping the slab bookkeeping and reusing memory that is likely still in
+ * the data cache. The optional hooks are run on the raw object as it leaves
+ * the cache and as it comes back (e.g. to zero or poison it).
+ *
+ * Pages are never given back to the FallbackAllocator.
+ */
+template <class Value, class FallbackAllocator>
+class ObjectCache final : public ObjectAllocator {
+    static constexpr size_t c_magazine_size = 8;
+    static constexpr size_t c_pages_per_grow = 4;
+
+public:
+    using Hook = void (*)(void*);
+
+    explicit ObjectCache(FallbackAllocator* fallback_allocator, size_t num_reserved = 0, Hook constructor = nullptr, Hook destructor = nullptr)
+        : m_fallback_allocator(fallback_allocator)
+        , m_constructor(constructor)
+        , m_destructor(destructor)
     {
-        return (bitmap_page_index * c_bits_per_bitmap) + index_in_bitmap_page;
+        reserve(num_reserved);
     }
-    size_t calculate_index_from_slab_indexes(size_t slab_page_index, size_t index_in_slab_page) const
+    ObjectCache(const ObjectCache&) = delete;
+    ObjectCache& operator=(const ObjectCache&) = delete;
+
+    Allocation allocate(size_t requested_size = sizeof(Value)) override
     {
-        return (slab_page_index * c_slabs_per_page) + index_in_slab_page;
+        if (requested_size > sizeof(Value)) {
+            ++m_stats.num_failed;
+            return {};
+        }
+
+        void* ptr;
+        if (m_magazine_length > 0) {
+            ptr = m_magazine[--m_magazine_length];
+            ++m_stats.num_magazine_hits;
+        }
+        else {
+            auto allocation = m_slab_allocator.allocate();
+            if (!allocation && grow())
+                allocation = m_slab_allocator.allocate();
+            if (!allocation) {
+                ++m_stats.num_failed;
+                return {};
+            }
+            ptr = allocation.ptr;
+        }
+
+        ++m_stats.num_allocations;
+        if (m_constructor)
+            m_constructor(ptr);
+        return { ptr, sizeof(Value) };
     }
-    Pair<size_t, size_t> calculate_slab_indexes(size_t bitmap_page_index, size_t index_in_bitmap_page) const
+    size_t free(Allocation alloc) override
     {
-        size_t index = calculate_index_from_bitmap_indexes(bitmap_page_index, index_in_bitmap_page);
-        return { index / c_slabs_per_page, index % c_slabs_per_page };
+        if (m_destructor)
+            m_destructor(alloc.ptr);
+
+        ++m_stats.num_frees;
+        if (m_magazine_length < c_magazine_size) {
+            m_magazine[m_magazine_length++] = alloc.ptr;
+            return sizeof(Value);
+        }
+
+        return m_slab_allocator.free(alloc);
     }
-    Pair<size_t, size_t> calculate_bitmap_indexes(size_t slab_page_index, size_t index_in_slab_page) const
+
+    /*
+     * Grows the cache until it can hold num_objects without going to the
+     * FallbackAllocator. Returns whether that succeeded.
+     */
+    bool reserve(size_t num_objects)
     {
-        size_t index = calculate_index_from_slab_indexes(slab_page_index, index_in_slab_page);
-        return { index / c_bits_per_bitmap, index % c_bits_per_bitmap };
+        while (m_slab_allocator.num_pages() * m_slab_allocator.slabs_per_page() < num_objects) {
+            if (!grow())
+                return false;
+        }
+        return true;
     }
 
-    static_assert(PageSize >= sizeof(Value));
+    [[nodiscard]] const ObjectCacheStats& stats() const { return m_stats; }
+    static constexpr size_t objects_per_page() { return SlabAllocator<Value>::slabs_per_page(); }
 
-    using SlabBitMap = BitMap<c_bits_per_bitmap>;
-    using BitMapNode = typename ManualLinkedList<SlabBitMap>::Node;
-    using SlabNode = typename ManualLinkedList<PtrData>::Node;
+private:
+    bool grow()
+    {
+        auto num_pages = m_slab_allocator.num_pages();
+        for (size_t i = 0; i < c_pages_per_grow; i++) {
+            auto allocation = m_fallback_allocator->allocate(PageSize);
+            if (!allocation)
+                break;
+
+            // Unaligned memory may not hold a whole page
+            auto num_pages_before = m_slab_allocator.num_pages();
+            m_slab_allocator.add(allocation.ptr, allocation.size);
+            if (m_slab_allocator.num_pages() == num_pages_before) {
+                m_fallback_allocator->free(allocation);
+                break;
+            }
+        }
 
-    ManualLinkedList<SlabBitMap> m_bitmaps {};
-    ManualLinkedList<PtrData> m_slab_pages {};
-    IntrusiveFreeList m_free_pages {};
+        m_stats.num_pages = m_slab_allocator.num_pages();
+        return m_slab_allocator.num_pages() > num_pages;
+    }
+
+    FallbackAllocator* m_fallback_allocator;
+    SlabAllocator<Value> m_slab_allocator {};
+    Array<void*, c_magazine_size> m_magazine {};
+    size_t m_magazine_length = 0;
+    Hook m_constructor;
+    Hook m_destructor;
+    ObjectCacheStats m_stats {};
 };
 
 using FixedHeapAllocator = FallbackAllocatorBinder<FixedAllocation, HighWatermarkAllocator>;
@@ -301,6 +535,20 @@ enum class PageAlignmentLevel : unsigned {
 };
 
 
+/*
+ * A binary buddy allocator over pages.
+ *
+ * Free memory is kept as naturally aligned power-of-two blocks, one set per
+ * depth (log2 of the block length in pages). Freed blocks are merged with
+ * their buddy whenever it is also free, and a bitmap of non-empty depths lets
+ * us find the smallest suitable block without walking the sets.
+ *
+ * Each set is a tree ordered by offset, so finding a buddy (or the block a
+ * reserved region is in) takes O(log n) in the free blocks of that depth.
+ * Neither a bitmap over the pages nor nodes kept in the free pages would do:
+ * the range can be most of the address space, and the pages may not be
+ * mapped at all.
+ */
 class PageAllocatorBackend {
 public:
     PageAllocatorBackend() = default;
@@ -335,23 +583,48 @@ private:
     {
         return (size_t)1u << depth;
     }
+    // The depth of the largest aligned block that starts the region
+    static unsigned first_block_depth(PageRegion region)
+    {
+        auto depth = depth_from_page_length(region.length);
+        if (region.offset == 0)
+            return depth;
+
+        return min(depth, countr_zero(region.offset));
+    }
 
-    using Node = ManualLinkedList<PageRegion>::Node;
+    struct Node {
+        explicit Node(PageRegion region)
+            : region(region)
+        {
+        }
+
+        PageRegion region;
+        RBTreeLink<Node> link;
+    };
+    struct NodeTraits {
+        static RBTreeLink<Node>& link(Node& node) { return node.link; }
+        static bool less(const Node& first, const Node& second) { return first.region.offset < second.region.offset; }
+    };
+    using FreeTree = RBTree<Node, NodeTraits>;
 
     static constexpr unsigned max_depth = (sizeof(size_t) * CHAR_BIT) - bit_width(PageSize) + 2;
+    static_assert(max_depth <= sizeof(size_t) * CHAR_BIT);
 
-    Node* find_free_pages(size_t num_pages, PageAlignmentLevel page_alignment);
+    unsigned find_free_depth(unsigned min_depth) const;
     Node* find_free_region(PageRegion);
-    Pair<PageRegion, AllocationCost> remove_and_trim_pages(Node* node, size_t min_pages);
+    Node* find_block(unsigned depth, size_t offset) const;
     Pair<PageRegion, AllocationCost> remove_and_trim_region(Node* node, PageRegion min_region);
     Pair<PageRegion, AllocationCost> trim_aligned_region(PageRegion curr_region, unsigned curr_depth, unsigned end_depth);
     AllocationCost free_region(PageRegion);
+    AllocationCost free_block(PageRegion block, unsigned depth);
     Pair<unsigned, Node*> create_node(PageRegion);
     void remove_node(unsigned depth, Node* node);
     void insert_node(unsigned depth, Node* node);
 
     SlabAllocator<Node> m_node_allocator {};
-    Array<ManualLinkedList<PageRegion>, max_depth> m_free_lists {};  // 0 is PageSize
+    Array<FreeTree, max_depth> m_free_trees {};  // 0 is PageSize
+    size_t m_free_depths = 0;  // bit n is set when m_free_trees[n] is non-empty
 };
 
 /*
@@ -1,5 +1,6 @@
 #pragma once
 #include "metaprogramming.hpp"
+#include "types.hpp"
 
 namespace pine {
 
@@ -54,4 +55,36 @@ constexpr const SizeType& min(const SizeType& first, const SizeType& second)
     return (first < second) ? first : second;
 }
 
+/*
+ * 64-bit by 32-bit division that shifts and subtracts a bit at a time; see
+ * divmod().
+ */
+constexpr Pair<u64, u32> divmod_bitwise(u64 numerator, u32 denominator)
+{
+    u64 quotient = 0;
+    u64 remainder = 0;
+    for (int bit = 63; bit >= 0; bit--) {
+        remainder = (remainder << 1) | ((numerator >> bit) & 1);
+        if (remainder >= denominator) {
+            remainder -= denominator;
+            quotient |= static_cast<u64>(1) << bit;
+        }
+    }
+    return { quotient, static_cast<u32>(remainder) };
+}
+
+/*
+ * Divides a 64-bit number by a 32-bit one, returning the quotient and
+ * remainder. 32-bit ARM has no instruction for this and we don't link the
+ * library call (__aeabi_uldivmod) compilers emit for it, so there we divide
+ * bitwise instead.
+ */
+constexpr Pair<u64, u32> divmod(u64 numerator, u32 denominator)
+{
+    if constexpr (sizeof(PtrData) >= sizeof(u64))
+        return { numerator / denominator, static_cast<u32>(numerator % denominator) };
+    else
+        return divmod_bitwise(numerator, denominator);
+}
+
 }
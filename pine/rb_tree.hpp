@@ -0,0 +1,335 @@
+#pragma once
+
+#include "types.hpp"
+
+namespace pine {
+
+/*
+ * Embedded in every element of an RBTree; see below.
+ */
+template <typename Value>
+struct RBTreeLink {
+    Value* parent = nullptr;
+    Value* left = nullptr;
+    Value* right = nullptr;
+    bool is_red = false;
+    bool is_linked = false;
+};
+
+/*
+ * An intrusive red-black tree. Elements embed an RBTreeLink, so inserting and
+ * removing never allocates and both are O(log n). Traits gives the link of a
+ * Value (static RBTreeLink<Value>& link(Value&)) and orders them (static bool
+ * less(const Value&, const Value&)); equal elements are kept in the order
+ * they were inserted.
+ *
+ * The first (least) element is cached, so it can be found in constant time.
+ */
+template <typename Value, typename Traits>
+class RBTree {
+public:
+    RBTree() = default;
+    RBTree(const RBTree&) = delete;
+    RBTree& operator=(const RBTree&) = delete;
+
+    bool is_empty() const { return !m_root; }
+    size_t size() const { return m_size; }
+    Value* first() const { return m_first; }
+
+    static bool is_linked(const Value& value) { return link(value).is_linked; }
+
+    static Value* next(const Value& value)
+    {
+        if (auto* right = link(value).right)
+            return leftmost(*right);
+
+        auto* child = &value;
+        auto* parent = link(value).parent;
+        while (parent && link(*parent).right == child) {
+            child = parent;
+            parent = link(*parent).parent;
+        }
+        return parent;
+    }
+
+    /*
+     * Finds an element by where it is ordered: compare(value) is negative if
+     * value is before the one looked for, positive if after and 0 if it is
+     * the one. O(log n).
+     */
+    template <typename Compare>
+    Value* find(Compare compare) const
+    {
+        auto* value = m_root;
+        while (value) {
+            auto order = compare(static_cast<const Value&>(*value));
+            if (order == 0)
+                return value;
+
+            value = order < 0 ? link(*value).right : link(*value).left;
+        }
+        return nullptr;
+    }
+
+    Value* last() const
+    {
+        auto* value = m_root;
+        while (value && link(*value).right)
+            value = link(*value).right;
+
+        return value;
+    }
+
+    void insert(Value& value)
+    {
+        auto& value_link = link(value);
+        value_link = RBTreeLink<Value> {};
+        value_link.is_red = true;
+        value_link.is_linked = true;
+
+        Value* parent = nullptr;
+        Value** child = &m_root;
+        bool is_first = true;
+        while (*child) {
+            parent = *child;
+            if (Traits::less(value, *parent)) {
+                child = &link(*parent).left;
+            }
+            else {
+                child = &link(*parent).right;
+                is_first = false;
+            }
+        }
+
+        value_link.parent = parent;
+        *child = &value;
+        if (is_first)
+            m_first = &value;
+        m_size++;
+
+        fix_after_insert(value);
+    }
+
+    void remove(Value& value)
+    {
+        if (m_first == &value)
+            m_first = next(value);
+
+        // See 13.4 in Introduction to Algorithms (CLRS), with null leaves, so
+        // we keep track of the parent of the node that moved up
+        auto& value_link = link(value);
+        bool removed_red = value_link.is_red;
+        Value* moved_up;
+        Value* moved_up_parent;
+
+        if (!value_link.left) {
+            moved_up = value_link.right;
+            moved_up_parent = value_link.parent;
+            transplant(value, moved_up);
+        }
+        else if (!value_link.right) {
+            moved_up = value_link.left;
+            moved_up_parent = value_link.parent;
+            transplant(value, moved_up);
+        }
+        else {
+            // Replace it with its successor, which has no left child
+            auto& successor = *leftmost(*value_link.right);
+            auto& successor_link = link(successor);
+            removed_red = successor_link.is_red;
+            moved_up = successor_link.right;
+
+            if (successor_link.parent == &value) {
+                moved_up_parent = &successor;
+            }
+            else {
+                moved_up_parent = successor_link.parent;
+                transplant(successor, moved_up);
+                successor_link.right = value_link.right;
+                link(*successor_link.right).parent = &successor;
+            }
+
+            transplant(value, &successor);
+            successor_link.left = value_link.left;
+            link(*successor_link.left).parent = &successor;
+            successor_link.is_red = value_link.is_red;
+        }
+
+        value_link = RBTreeLink<Value> {};
+        m_size--;
+
+        if (!removed_red)
+            fix_after_remove(moved_up, moved_up_parent);
+    }
+
+private:
+    static RBTreeLink<Value>& link(Value& value) { return Traits::link(value); }
+    static const RBTreeLink<Value>& link(const Value& value) { return Traits::link(const_cast<Value&>(value)); }
+    static bool is_red(const Value* value) { return value && link(*value).is_red; }
+
+    static Value* leftmost(Value& value)
+    {
+        auto* leftmost = &value;
+        while (link(*leftmost).left)
+            leftmost = link(*leftmost).left;
+
+        return leftmost;
+    }
+
+    // Puts replacement where value is in value's parent
+    void transplant(Value& value, Value* replacement)
+    {
+        auto* parent = link(value).parent;
+        if (!parent)
+            m_root = replacement;
+        else if (link(*parent).left == &value)
+            link(*parent).left = replacement;
+        else
+            link(*parent).right = replacement;
+
+        if (replacement)
+            link(*replacement).parent = parent;
+    }
+
+    void rotate_left(Value& value)
+    {
+        auto& right = *link(value).right;
+        link(value).right = link(right).left;
+        if (auto* moved = link(right).left)
+            link(*moved).parent = &value;
+
+        transplant(value, &right);
+        link(right).left = &value;
+        link(value).parent = &right;
+    }
+
+    void rotate_right(Value& value)
+    {
+        auto& left = *link(value).left;
+        link(value).left = link(left).right;
+        if (auto* moved = link(left).right)
+            link(*moved).parent = &value;
+
+        transplant(value, &left);
+        link(left).right = &value;
+        link(value).parent = &left;
+    }
+
+    void fix_after_insert(Value& inserted)
+    {
+        // See 13.3 in CLRS; the parent being red means it isn't the root, so
+        // there is a grandparent
+        auto* value = &inserted;
+        while (is_red(link(*value).parent)) {
+            auto* parent = link(*value).parent;
+            auto* grandparent = link(*parent).parent;
+
+            if (parent == link(*grandparent).left) {
+                auto* uncle = link(*grandparent).right;
+                if (is_red(uncle)) {
+                    link(*parent).is_red = false;
+                    link(*uncle).is_red = false;
+                    link(*grandparent).is_red = true;
+                    value = grandparent;
+                    continue;
+                }
+                if (value == link(*parent).right) {
+                    value = parent;
+                    rotate_left(*value);
+                    parent = link(*value).parent;
+                }
+                link(*parent).is_red = false;
+                link(*grandparent).is_red = true;
+                rotate_right(*grandparent);
+            }
+            else {
+                auto* uncle = link(*grandparent).left;
+                if (is_red(uncle)) {
+                    link(*parent).is_red = false;
+                    link(*uncle).is_red = false;
+                    link(*grandparent).is_red = true;
+                    value = grandparent;
+                    continue;
+                }
+                if (value == link(*parent).left) {
+                    value = parent;
+                    rotate_right(*value);
+                    parent = link(*value).parent;
+                }
+                link(*parent).is_red = false;
+                link(*grandparent).is_red = true;
+                rotate_left(*grandparent);
+            }
+        }
+
+        link(*m_root).is_red = false;
+    }
+
+    void fix_after_remove(Value* value, Value* parent)
+    {
+        // See 13.4 in CLRS; value is short a black node on its path, and
+        // its sibling can't be null since the other side is not
+        while (value != m_root && !is_red(value)) {
+            if (value == link(*parent).left) {
+                auto* sibling = link(*parent).right;
+                if (is_red(sibling)) {
+                    link(*sibling).is_red = false;
+                    link(*parent).is_red = true;
+                    rotate_left(*parent);
+                    sibling = link(*parent).right;
+                }
+                if (!is_red(link(*sibling).left) && !is_red(link(*sibling).right)) {
+                    link(*sibling).is_red = true;
+                    value = parent;
+                    parent = link(*value).parent;
+                    continue;
+                }
+                if (!is_red(link(*sibling).right)) {
+                    link(*link(*sibling).left).is_red = false;
+                    link(*sibling).is_red = true;
+                    rotate_right(*sibling);
+                    sibling = link(*parent).right;
+                }
+                link(*sibling).is_red = link(*parent).is_red;
+                link(*parent).is_red = false;
+                link(*link(*sibling).right).is_red = false;
+                rotate_left(*parent);
+            }
+            else {
+                auto* sibling = link(*parent).left;
+                if (is_red(sibling)) {
+                    link(*sibling).is_red = false;
+                    link(*parent).is_red = true;
+                    rotate_right(*parent);
+                    sibling = link(*parent).left;
+                }
+                if (!is_red(link(*sibling).left) && !is_red(link(*sibling).right)) {
+                    link(*sibling).is_red = true;
+                    value = parent;
+                    parent = link(*value).parent;
+                    continue;
+                }
+                if (!is_red(link(*sibling).left)) {
+                    link(*link(*sibling).right).is_red = false;
+                    link(*sibling).is_red = true;
+                    rotate_left(*sibling);
+                    sibling = link(*parent).left;
+                }
+                link(*sibling).is_red = link(*parent).is_red;
+                link(*parent).is_red = false;
+                link(*link(*sibling).left).is_red = false;
+                rotate_right(*parent);
+            }
+            value = m_root;
+        }
+
+        if (value)
+            link(*value).is_red = false;
+    }
+
+    Value* m_root = nullptr;
+    Value* m_first = nullptr;
+    size_t m_size = 0;
+};
+
+}
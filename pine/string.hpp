@@ -20,12 +20,12 @@ public:
     }
     static Maybe<String> try_create(Allocator& allocator, const char* from, size_t length)
     {
-        auto [ptr, _] = allocator.allocate(length);
+        auto [ptr, _] = allocator.allocate(length + 1);  // + '\0'
         if (!ptr)
             return {};
 
         auto* dest = static_cast<char*>(ptr);
-        strcopy(dest, from);
+        strbufcopy(dest, length + 1, from);
         return String(allocator, dest, length);
     }
     ~String()
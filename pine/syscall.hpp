@@ -8,16 +8,58 @@ enum class PrivilegeLevel {
 
 enum class Syscall {
     Yield = 0,
-    Sleep,
+    Sleep,  // milliseconds
     Open,
     Read,
     Write,
     Close,
     Dup,
     Sbrk,
-    Uptime,
-    CPUTime,
+    Uptime,  // milliseconds
+    CPUTime,  // milliseconds
+    ClockGetTime,
+    Nice,  // returns the new nice value
+    SetSchedParams,
+    GetSchedParams,
     Exit,
+    Fork,  // returns the new task's id, or 0 in the new task
+    LockStats,  // prints the kernel's lock statistics to the console
+};
+
+/*
+ * Scheduling classes, from the one that runs last to the one that runs
+ * first; a task only runs when no task of a higher class can.
+ */
+enum class SchedPolicy {
+    Fair,      // shares the CPU with the others by nice value
+    RealTime,  // by static priority
+    Deadline,  // earliest deadline first, given enough time each period
+};
+
+/*
+ * For the SetSchedParams and GetSchedParams syscalls.
+ */
+struct SchedParams {
+    SchedPolicy policy;
+    u32 priority;  // RealTime: 0 to 31, higher runs first
+    // Deadline: it runs for runtime_ns every period_ns, with the end of each
+    // period as its deadline; between 1ms and 4s
+    u64 runtime_ns;
+    u64 period_ns;
+    u32 deadline_misses;  // Deadline: periods that ended before runtime_ns ran; get only
+};
+
+enum class Clock {
+    Monotonic,    // Time since boot
+    TaskCPUTime,  // Time the calling task has spent running
+};
+
+/*
+ * Our struct timespec.
+ */
+struct TimeSpec {
+    u64 seconds;
+    u32 nanoseconds;
 };
 
 enum class FileMode {
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cassert>
+#include <climits>
+
+#include <pine/array.hpp>
+
+using namespace pine;
+
+void bitmap_set_and_clear()
+{
+    constexpr size_t num_bits = sizeof(size_t) * CHAR_BIT * 2 + 3;
+    BitMap<num_bits> bitmap {};
+    for (size_t i = 0; i < num_bits; i++)
+        assert(!bitmap.bit(i));
+
+    // Bits past the first word must not alias into it
+    size_t indexes[] = { 0, 1, sizeof(size_t) * CHAR_BIT - 1, sizeof(size_t) * CHAR_BIT, num_bits - 1 };
+    for (auto index : indexes) {
+        bitmap.set_bit(index);
+        assert(bitmap.bit(index));
+        bitmap.set_bit(index);  // setting twice leaves it set
+        assert(bitmap.bit(index));
+    }
+    for (size_t i = 0; i < num_bits; i++) {
+        bool is_set = false;
+        for (auto index : indexes)
+            is_set |= index == i;
+        assert(bitmap.bit(i) == is_set);
+    }
+
+    for (auto index : indexes) {
+        bitmap.clear_bit(index);
+        assert(!bitmap.bit(index));
+    }
+
+    bitmap.mark_bit(5, true);
+    assert(bitmap.bit(5));
+    bitmap.mark_bit(5, false);
+    assert(!bitmap.bit(5));
+}
+
+void bitmap_find_first_zero()
+{
+    constexpr size_t num_bits = sizeof(size_t) * CHAR_BIT * 2 + 3;
+    BitMap<num_bits> bitmap {};
+    assert(bitmap.find_first_zero() == 0);
+
+    for (size_t i = 0; i < num_bits; i++) {
+        assert(bitmap.find_first_zero() == i);
+        bitmap.set_bit(i);
+    }
+    assert(bitmap.find_first_zero() == num_bits);
+
+    bitmap.clear_bit(sizeof(size_t) * CHAR_BIT + 7);
+    assert(bitmap.find_first_zero() == sizeof(size_t) * CHAR_BIT + 7);
+    bitmap.clear_bit(3);
+    assert(bitmap.find_first_zero() == 3);
+}
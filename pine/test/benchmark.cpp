@@ -0,0 +1,90 @@
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <sys/mman.h>
+#include <vector>
+
+#include <pine/malloc.hpp>
+#include <pine/alien/print.hpp>  // Need access to our print() ADL implementations (analogus to std::cout)
+
+/*
+ * Host benchmarks for pine's allocators. Unlike the tests, these only report
+ * numbers; run with `make benchmark`.
+ */
+
+using namespace pine;
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t heap_size = 32 * MiB;
+
+/*
+ * Replays the same random trace of allocations and frees against the
+ * allocator, keeping roughly num_live allocations alive, and prints the
+ * average time per operation.
+ */
+template <class Allocator>
+static void benchmark_trace(const char* name, unsigned num_live, size_t max_size)
+{
+    void* heap = mmap(nullptr, heap_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (heap == MAP_FAILED)
+        std::abort();
+
+    // Scoped, since allocators may walk their free lists when destroyed
+    {
+        Allocator allocator;
+        allocator.add(heap, heap_size);
+
+        std::mt19937 generator(1234);
+        std::uniform_int_distribution<size_t> size_distribution(8, max_size);
+        std::vector<Allocation> live;
+        live.reserve(num_live);
+
+        // Warm up into a fragmented steady state before timing anything
+        for (unsigned i = 0; i < num_live; i++) {
+            auto allocation = allocator.allocate(size_distribution(generator));
+            if (allocation)
+                live.push_back(allocation);
+            if (!live.empty() && generator() % 2 == 0) {
+                auto index = generator() % live.size();
+                allocator.free(live[index]);
+                live[index] = live.back();
+                live.pop_back();
+            }
+        }
+
+        constexpr unsigned num_ops = 200000;
+        unsigned num_failed = 0;
+        auto start = Clock::now();
+        for (unsigned i = 0; i < num_ops; i++) {
+            if (live.size() < num_live && (live.empty() || generator() % 2 == 0)) {
+                auto allocation = allocator.allocate(size_distribution(generator));
+                if (allocation)
+                    live.push_back(allocation);
+                else
+                    ++num_failed;
+            }
+            else {
+                auto index = generator() % live.size();
+                allocator.free(live[index]);
+                live[index] = live.back();
+                live.pop_back();
+            }
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+        auto ns_per_op = static_cast<unsigned long>(elapsed / num_ops);
+        alien::println(name, "live:", num_live, "max size:", max_size, "->", ns_per_op, "ns/op, failed:", num_failed);
+    }
+    munmap(heap, heap_size);
+}
+
+int main()
+{
+    alien::println("Allocator trace benchmarks");
+    for (unsigned num_live : { 64u, 512u, 4096u }) {
+        for (size_t max_size : { 256ul, 4096ul }) {
+            benchmark_trace<IntrusiveFreeList>("IntrusiveFreeList", num_live, max_size);
+            benchmark_trace<TLSFAllocator>("TLSFAllocator    ", num_live, max_size);
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cassert>
+
+#include <pine/c_builtins.hpp>
+
+/*
+ * Our memcpy() and friends replace libc's in this binary, so expected results
+ * are built up a byte at a time instead (through volatile, so the compiler
+ * can't turn those loops back into calls to what we are testing).
+ */
+
+constexpr size_t c_builtins_buffer_size = 512;
+constexpr size_t c_builtins_max_offset = 2 * sizeof(size_t);
+
+inline void fill_pattern(unsigned char* buffer, size_t size, unsigned seed)
+{
+    for (size_t i = 0; i < size; i++)
+        buffer[i] = static_cast<unsigned char>(i * 7 + seed);
+}
+
+inline void set_byte(unsigned char* buffer, size_t index, unsigned char value)
+{
+    static_cast<volatile unsigned char*>(buffer)[index] = value;
+}
+
+inline void assert_same(const unsigned char* first, const unsigned char* second, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        assert(first[i] == second[i]);
+}
+
+void c_builtins_memcpy()
+{
+    alignas(64) unsigned char from[c_builtins_buffer_size];
+    alignas(64) unsigned char to[c_builtins_buffer_size];
+    alignas(64) unsigned char expected[c_builtins_buffer_size];
+    fill_pattern(from, sizeof(from), 3);
+
+    // Cover mismatched alignments, head/tail bytes and whole blocks
+    for (size_t to_offset = 0; to_offset < c_builtins_max_offset; to_offset++) {
+        for (size_t from_offset = 0; from_offset < c_builtins_max_offset; from_offset++) {
+            for (size_t size = 0; size + c_builtins_max_offset <= c_builtins_buffer_size; size += size < 80 ? 1 : 37) {
+                fill_pattern(to, sizeof(to), 101);
+                fill_pattern(expected, sizeof(expected), 101);
+                for (size_t i = 0; i < size; i++)
+                    set_byte(expected, to_offset + i, from[from_offset + i]);
+
+                assert(memcpy(to + to_offset, from + from_offset, size) == to + to_offset);
+                assert_same(to, expected, sizeof(to));
+            }
+        }
+    }
+}
+
+void c_builtins_memset_and_bzero()
+{
+    alignas(64) unsigned char to[c_builtins_buffer_size];
+    alignas(64) unsigned char expected[c_builtins_buffer_size];
+
+    for (size_t offset = 0; offset < c_builtins_max_offset; offset++) {
+        for (size_t size = 0; size + offset <= c_builtins_buffer_size; size += size < 80 ? 1 : 29) {
+            int values[] = { 0, 0xa5, -1, 0x1ff };
+            for (int c : values) {
+                fill_pattern(to, sizeof(to), 11);
+                fill_pattern(expected, sizeof(expected), 11);
+                for (size_t i = 0; i < size; i++)
+                    set_byte(expected, offset + i, static_cast<unsigned char>(c));
+
+                assert(memset(to + offset, c, size) == to + offset);
+                assert_same(to, expected, sizeof(to));
+            }
+
+            fill_pattern(to, sizeof(to), 13);
+            fill_pattern(expected, sizeof(expected), 13);
+            for (size_t i = 0; i < size; i++)
+                set_byte(expected, offset + i, 0);
+
+            bzero(to + offset, size);
+            assert_same(to, expected, sizeof(to));
+        }
+    }
+}
+
+void c_builtins_memmove_overlapping()
+{
+    alignas(64) unsigned char buffer[c_builtins_buffer_size];
+    alignas(64) unsigned char expected[c_builtins_buffer_size];
+    alignas(64) unsigned char scratch[c_builtins_buffer_size];
+
+    // Both directions, overlapping by less than and more than a block
+    constexpr size_t max_distance = 80;
+    for (size_t to_offset = 0; to_offset <= max_distance; to_offset += to_offset < 20 ? 1 : 13) {
+        for (size_t from_offset = 0; from_offset <= max_distance; from_offset += from_offset < 20 ? 1 : 11) {
+            for (size_t size = 0; size + max_distance <= c_builtins_buffer_size; size += size < 40 ? 1 : 61) {
+                fill_pattern(buffer, sizeof(buffer), 5);
+                fill_pattern(expected, sizeof(expected), 5);
+                for (size_t i = 0; i < size; i++)
+                    set_byte(scratch, i, expected[from_offset + i]);
+                for (size_t i = 0; i < size; i++)
+                    set_byte(expected, to_offset + i, scratch[i]);
+
+                assert(memmove(buffer + to_offset, buffer + from_offset, size) == buffer + to_offset);
+                assert_same(buffer, expected, sizeof(buffer));
+            }
+        }
+    }
+}
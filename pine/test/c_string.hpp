@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <pine/c_string.hpp>
+
+constexpr size_t c_string_buffer_size = 256;
+
+inline int sign(int num)
+{
+    return (num > 0) - (num < 0);
+}
+
+/*
+ * Fills in a string of the given length at buffer + offset, choosing from a
+ * few characters (some with the high bit set) so that random strings often
+ * share prefixes.
+ */
+inline void random_string(char* buffer, size_t offset, size_t length)
+{
+    const char alphabet[] = { 'a', 'b', '\x7f', '\x80', '\xff' };
+    for (size_t i = 0; i < length; i++)
+        buffer[offset + i] = alphabet[rand() % static_cast<int>(sizeof(alphabet))];
+    buffer[offset + length] = '\0';
+}
+
+void c_string_fuzz_strlen_and_strcmp()
+{
+    srand(0x5eed);
+    alignas(16) char first[c_string_buffer_size];
+    alignas(16) char second[c_string_buffer_size];
+
+    for (int round = 0; round < 20000; round++) {
+        size_t first_offset = static_cast<size_t>(rand() % 16);
+        size_t second_offset = static_cast<size_t>(rand() % 16);
+        size_t length = static_cast<size_t>(rand() % 64);
+        random_string(first, first_offset, length);
+        assert(pine::strlen(first + first_offset) == std::strlen(first + first_offset));
+
+        // Mostly equal prefixes, so the word loop runs before a difference
+        if (rand() % 2 == 0) {
+            size_t second_length = static_cast<size_t>(rand() % 64);
+            random_string(second, second_offset, second_length);
+        } else {
+            std::memmove(second + second_offset, first + first_offset, length + 1);
+            if (length > 0 && rand() % 2 == 0)
+                second[second_offset + static_cast<size_t>(rand()) % length] = 'b';
+            if (rand() % 4 == 0)
+                second[second_offset + static_cast<size_t>(rand()) % (length + 1)] = '\0';
+        }
+
+        const char* first_string = first + first_offset;
+        const char* second_string = second + second_offset;
+        assert(pine::strcmp(first_string, second_string) == sign(std::strcmp(first_string, second_string)));
+        assert(pine::strcmp(second_string, first_string) == sign(std::strcmp(second_string, first_string)));
+        assert(pine::strcmp(first_string, first_string) == 0);
+    }
+}
+
+void c_string_fuzz_strcopy_and_strbufcopy()
+{
+    srand(0xc0b7);
+    alignas(16) char from[c_string_buffer_size];
+    alignas(16) char to[c_string_buffer_size];
+    alignas(16) char expected[c_string_buffer_size];
+
+    for (int round = 0; round < 20000; round++) {
+        size_t from_offset = static_cast<size_t>(rand() % 16);
+        size_t to_offset = static_cast<size_t>(rand() % 16);
+        size_t length = static_cast<size_t>(rand() % 64);
+        random_string(from, from_offset, length);
+        const char* string = from + from_offset;
+
+        std::memset(to, '#', sizeof(to));
+        std::memset(expected, '#', sizeof(expected));
+        std::strcpy(expected + to_offset, string);
+        assert(pine::strcopy(to + to_offset, string) == length);
+        assert(std::memcmp(to, expected, sizeof(to)) == 0);
+
+        // Neither overflows the buffer nor writes past the terminator
+        size_t bufsize = static_cast<size_t>(rand() % 72);
+        size_t expected_copied = bufsize == 0 ? 0 : (length < bufsize ? length : bufsize - 1);
+        std::memset(to, '#', sizeof(to));
+        std::memset(expected, '#', sizeof(expected));
+        if (bufsize > 0) {
+            std::memcpy(expected + to_offset, string, expected_copied);
+            expected[to_offset + expected_copied] = '\0';
+        }
+        assert(pine::strbufcopy(to + to_offset, bufsize, string) == expected_copied);
+        assert(std::memcmp(to, expected, sizeof(to)) == 0);
+    }
+}
+
+void c_string_reads_stop_at_page_boundary()
+{
+    // Strings ending right before an inaccessible page; reading whole words
+    // past the terminator would fault
+    auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    auto* pages = static_cast<char*>(mmap(nullptr, 2 * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    assert(pages != MAP_FAILED);
+    assert(mprotect(pages + page_size, page_size, PROT_NONE) == 0);
+
+    char buf[64];
+    for (size_t length = 0; length < 40; length++) {
+        char* string = pages + page_size - length - 1;
+        std::memset(string, 'x', length);
+        string[length] = '\0';
+
+        assert(pine::strlen(string) == length);
+        assert(pine::strcmp(string, string) == 0);
+        assert(pine::strbufcopy(buf, sizeof(buf), string) == length);
+        assert(pine::strcmp(buf, string) == 0);
+    }
+
+    munmap(pages, 2 * page_size);
+}
@@ -192,3 +192,45 @@ void manual_linked_list_remove()
     list.remove(*list.begin());
     assert(list.length() == 0);
 }
+
+void manual_linked_list_detach()
+{
+    using Node = pine::ManualLinkedList<int>::Node;
+    pine::ManualLinkedList<int> list;
+    pine::ManualLinkedList<int> other_list;
+    for (int i = 1; i <= 3; i++) {
+        auto node_ptr = new (alien::malloc<Node>()) Node(i);
+        list.append(*node_ptr);
+    }
+
+    // Middle
+    auto* node = *next(list.begin(), 1);
+    list.detach(node);
+    assert(list.length() == 2);
+    assert(node->contents() == 2);
+    assert(node->prev() == nullptr && node->next() == nullptr);
+    assert((*list.begin())->next() == *--list.end());
+
+    other_list.append(*node);
+    assert(other_list.length() == 1);
+    assert((*other_list.begin())->contents() == 2);
+
+    // Tail, then head
+    node = *--list.end();
+    list.detach(node);
+    assert(list.length() == 1);
+    assert((*--list.end())->contents() == 1);
+    other_list.append(*node);
+
+    node = *list.begin();
+    list.detach(node);
+    assert(list.length() == 0);
+    assert(list.begin() == list.end());
+    other_list.append(*node);
+
+    assert(other_list.length() == 3);
+    int expected[3] = { 2, 3, 1 };
+    int i = 0;
+    for (auto* other_node : other_list)
+        assert(other_node->contents() == expected[i++]);
+}
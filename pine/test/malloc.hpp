@@ -9,6 +9,8 @@
 #include <vector>
 #include <random>
 #include <algorithm>
+#include <chrono>
+#include <limits>
 
 #include <pine/units.hpp>
 #include <pine/limits.hpp>
@@ -158,3 +160,578 @@ void page_allocator_backend_create()
     }
     free_scratch_page(ptr, size);
 }
+
+void page_allocator_backend_coalesce()
+{
+    auto [ptr, size] = allocate_scratch_page(4);
+    {  // Make sure allocator is destructed before we free the scratch page!
+        constexpr unsigned num_pages = 16;
+        PageRegion region { 1u << 16, num_pages };
+        PageAllocatorBackend allocator;
+        allocator.init(region, PageRegion::from_ptr(ptr, size));
+
+        std::vector<PageRegion> allocated_regions;
+        for (unsigned i = 0; i < num_pages; i++) {
+            auto allocation = allocator.allocate(1);
+            assert(allocation.size == PageSize);
+            allocated_regions.push_back(PageRegion::from_ptr(allocation.ptr, allocation.size));
+        }
+        assert(allocator.allocate(1).size == 0);
+
+        // Buddies are freed apart from each other; each should still be merged
+        std::mt19937 generator(1);
+        std::shuffle(allocated_regions.begin(), allocated_regions.end(), generator);
+        for (auto& allocated_region : allocated_regions)
+            allocator.free({ allocated_region.ptr(), allocated_region.size() });
+
+        auto allocation = allocator.allocate(num_pages);
+        assert(allocation.size == region.size());
+        assert(allocation.ptr == region.ptr());
+    }
+    free_scratch_page(ptr, size);
+}
+
+void page_allocator_backend_alignment()
+{
+    auto [ptr, size] = allocate_scratch_page(4);
+    {  // Make sure allocator is destructed before we free the scratch page!
+        // Start out of alignment, so the first section aligned page is far away
+        PageRegion region { 1, 1u << 12 };
+        PageAllocatorBackend allocator;
+        allocator.init(region, PageRegion::from_ptr(ptr, size));
+
+        auto page_allocation = allocator.allocate(1);
+        assert(page_allocation.size == PageSize);
+
+        for (unsigned i = 0; i < 4; i++) {
+            auto allocation = allocator.allocate(1, PageAlignmentLevel::Section);
+            assert(allocation.size == PageSize);
+            assert(is_pointer_aligned_two(allocation.ptr, SectionSize));
+            assert(region.contains(PageRegion::from_ptr(allocation.ptr, allocation.size)));
+        }
+    }
+    free_scratch_page(ptr, size);
+}
+
+void page_allocator_backend_reserve_region()
+{
+    auto [ptr, size] = allocate_scratch_page(4);
+    {  // Make sure allocator is destructed before we free the scratch page!
+        constexpr unsigned num_pages = 16;
+        PageRegion region { 1u << 16, num_pages };
+        PageAllocatorBackend allocator;
+        allocator.init(region, PageRegion::from_ptr(ptr, size));
+
+        // Not aligned and crosses the middle of the region
+        PageRegion reserved_region { region.offset + 3, 10 };
+        auto reservation = allocator.reserve_region(reserved_region);
+        assert(reservation.ptr == reserved_region.ptr());
+        assert(reservation.size == reserved_region.size());
+
+        // Already taken
+        assert(allocator.reserve_region({ region.offset + 12, 2 }).size == 0);
+        assert(allocator.allocate(8).size == 0);
+
+        std::vector<Allocation> allocations;
+        for (unsigned i = 0; i < num_pages - reserved_region.length; i++) {
+            auto allocation = allocator.allocate(1);
+            assert(allocation.size == PageSize);
+            assert(!reserved_region.contains(PageRegion::from_ptr(allocation.ptr, allocation.size)));
+            allocations.push_back(allocation.as_allocation());
+        }
+        assert(allocator.allocate(1).size == 0);
+
+        allocator.free(reservation.as_allocation());
+        for (auto& allocation : allocations)
+            allocator.free(allocation);
+
+        auto allocation = allocator.allocate(num_pages);
+        assert(allocation.size == region.size());
+    }
+    free_scratch_page(ptr, size);
+}
+
+void page_allocator_backend_random_trace()
+{
+    // Only a few scratch pages for nodes; if free blocks were not merged, the
+    // fragments would eventually exhaust them
+    auto [ptr, size] = allocate_scratch_page(4);
+    {  // Make sure allocator is destructed before we free the scratch page!
+        constexpr unsigned num_pages = 1u << 14;
+        constexpr unsigned max_allocation_pages = 64;
+        constexpr unsigned max_live_allocations = 64;
+        PageRegion region { 1u << 16, num_pages };
+        PageAllocatorBackend allocator;
+        allocator.init(region, PageRegion::from_ptr(ptr, size));
+
+        std::mt19937 generator(42);
+        std::uniform_int_distribution<unsigned> num_pages_distribution(1, max_allocation_pages);
+        std::vector<PageRegion> live_regions;
+
+        for (unsigned round = 0; round < 16; round++) {
+            for (unsigned op = 0; op < 4096; op++) {
+                bool should_allocate = live_regions.size() < max_live_allocations && generator() % 2 == 0;
+                if (should_allocate || live_regions.empty()) {
+                    // At most a quarter is live, so this must always succeed
+                    auto requested_pages = num_pages_distribution(generator);
+                    auto allocation = allocator.allocate(requested_pages);
+                    assert(allocation.size == align_up_to_power(requested_pages) * PageSize);
+
+                    auto allocated_region = PageRegion::from_ptr(allocation.ptr, allocation.size);
+                    assert(region.contains(allocated_region));
+                    assert(allocated_region.aligned_to(allocated_region.length));
+                    for (auto& live_region : live_regions) {
+                        bool overlaps = allocated_region.offset < live_region.end_offset()
+                            && live_region.offset < allocated_region.end_offset();
+                        assert(!overlaps);
+                    }
+                    live_regions.push_back(allocated_region);
+                }
+                else {
+                    auto index = generator() % live_regions.size();
+                    allocator.free({ live_regions[index].ptr(), live_regions[index].size() });
+                    live_regions.erase(live_regions.begin() + index);
+                }
+            }
+
+            for (auto& live_region : live_regions)
+                allocator.free({ live_region.ptr(), live_region.size() });
+            live_regions.clear();
+
+            // Everything should have merged back into the original block
+            auto allocation = allocator.allocate(num_pages);
+            assert(allocation.size == region.size());
+            allocator.free(allocation.as_allocation());
+        }
+    }
+    free_scratch_page(ptr, size);
+}
+
+/*
+ * The best time, over a few runs, to allocate and free a page while
+ * num_fragments free pages sit at depth 0 with no free buddy to merge with.
+ */
+static double page_allocator_backend_ns_per_op(unsigned num_fragments)
+{
+    using Clock = std::chrono::steady_clock;
+    constexpr unsigned num_ops = 4096;
+    constexpr unsigned num_runs = 5;
+
+    auto [ptr, size] = allocate_scratch_page(static_cast<unsigned>(num_fragments * 128 / host_page_size + 4));
+    double best_ns = std::numeric_limits<double>::max();
+    {  // Make sure allocator is destructed before we free the scratch page!
+        PageRegion region { 1u << 20, 2 * num_fragments };
+        PageAllocatorBackend allocator;
+        allocator.init(region, PageRegion::from_ptr(ptr, size));
+
+        // Take every page, then give back every other one
+        std::vector<Allocation> allocations;
+        for (unsigned i = 0; i < region.length; i++) {
+            auto allocation = allocator.allocate(1);
+            assert(allocation.size == PageSize);
+            allocations.push_back(allocation.as_allocation());
+        }
+        for (unsigned i = 0; i < region.length; i += 2)
+            allocator.free(allocations[i]);
+
+        for (unsigned run = 0; run < num_runs; run++) {
+            auto start = Clock::now();
+            for (unsigned op = 0; op < num_ops; op++) {
+                auto allocation = allocator.allocate(1);
+                assert(allocation.size == PageSize);
+                allocator.free(allocation.as_allocation());
+            }
+            auto elapsed_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+            best_ns = std::min(best_ns, elapsed_ns / num_ops);
+        }
+    }
+    free_scratch_page(ptr, size);
+    return best_ns;
+}
+
+void page_allocator_backend_bounded_cost()
+{
+    // Finding the buddy of a freed page should take about log2 of the free
+    // blocks at its depth; if it walked them, 64x the fragments would take
+    // about 64x as long
+    auto few_fragments_ns = page_allocator_backend_ns_per_op(1u << 8);
+    auto many_fragments_ns = page_allocator_backend_ns_per_op(1u << 14);
+    assert(many_fragments_ns < few_fragments_ns * 8);
+}
+
+struct alignas(64) SlabTestValue {
+    char contents[192];
+};
+
+void slab_allocator_fill_and_reclaim()
+{
+    constexpr unsigned num_pages = 3;
+    auto [ptr, size] = allocate_scratch_page(num_pages);
+    {  // Make sure allocator is destructed before we free the scratch page!
+        SlabAllocator<SlabTestValue> allocator;
+        allocator.add(ptr, size);
+        assert(allocator.num_empty_pages() == num_pages);
+
+        std::vector<void*> slabs;
+        for (;;) {
+            auto allocation = allocator.allocate();
+            if (!allocation)
+                break;
+
+            assert(allocation.size == sizeof(SlabTestValue));
+            assert(is_pointer_aligned_two(allocation.ptr, alignof(SlabTestValue)));
+            assert(static_cast<char*>(allocation.ptr) >= ptr);
+            assert(static_cast<char*>(allocation.ptr) + sizeof(SlabTestValue) <= ptr + size);
+            memset(allocation.ptr, 0xff, sizeof(SlabTestValue));  // must not clobber any headers
+            slabs.push_back(allocation.ptr);
+        }
+        assert(slabs.size() >= num_pages * (PageSize / sizeof(SlabTestValue) - 1));
+        assert(allocator.num_empty_pages() == 0);
+
+        std::sort(slabs.begin(), slabs.end());
+        assert(std::adjacent_find(slabs.begin(), slabs.end()) == slabs.end());
+
+        // The most recently freed hole is handed back out
+        auto* freed = slabs[slabs.size() / 2];
+        allocator.free({ freed, sizeof(SlabTestValue) });
+        auto allocation = allocator.allocate();
+        assert(allocation.ptr == freed);
+        assert(!allocator.allocate());
+
+        for (auto* slab : slabs)
+            allocator.free({ slab, sizeof(SlabTestValue) });
+        assert(allocator.num_empty_pages() == num_pages);
+
+        for (unsigned i = 0; i < num_pages; i++) {
+            auto reclaimed = allocator.reclaim();
+            assert(reclaimed.size == PageSize);
+            assert(is_pointer_aligned_two(reclaimed.ptr, PageSize));
+        }
+        assert(!allocator.reclaim());
+        assert(!allocator.allocate());
+    }
+    free_scratch_page(ptr, size);
+}
+
+void slab_allocator_prefers_partial_pages()
+{
+    constexpr unsigned num_pages = 2;
+    auto [ptr, size] = allocate_scratch_page(num_pages);
+    {  // Make sure allocator is destructed before we free the scratch page!
+        SlabAllocator<SlabTestValue> allocator;
+        allocator.add(ptr, size);
+
+        auto first = allocator.allocate();
+        auto second = allocator.allocate();
+        assert(first && second);
+        assert(allocator.num_empty_pages() == num_pages - 1);
+
+        // Churn within a page should never dip into the empty page
+        for (unsigned i = 0; i < 64; i++) {
+            allocator.free(second);
+            second = allocator.allocate();
+            assert(second);
+            assert(allocator.num_empty_pages() == num_pages - 1);
+        }
+
+        allocator.free(first);
+        allocator.free(second);
+        assert(allocator.num_empty_pages() == num_pages);
+    }
+    free_scratch_page(ptr, size);
+}
+
+void object_cache_reuses_recent_objects()
+{
+    constexpr unsigned num_pages = 8;
+    auto [ptr, size] = allocate_scratch_page(num_pages);
+    {
+        FixedAllocation fixed_allocation(reinterpret_cast<PtrData>(ptr), size);
+        ObjectCache<SlabTestValue, FixedAllocation> cache(&fixed_allocation, 1);
+        assert(cache.stats().num_pages > 0);
+        assert(!cache.allocate(sizeof(SlabTestValue) + 1));
+
+        std::vector<void*> objects;
+        for (unsigned i = 0; i < 32; i++) {
+            auto allocation = cache.allocate();
+            assert(allocation);
+            assert(is_pointer_aligned_two(allocation.ptr, alignof(SlabTestValue)));
+            memset(allocation.ptr, 0xff, sizeof(SlabTestValue));
+            objects.push_back(allocation.ptr);
+        }
+        assert(cache.stats().num_magazine_hits == 0);
+
+        // The last freed object is the first handed back out
+        cache.free({ objects[3], sizeof(SlabTestValue) });
+        cache.free({ objects[7], sizeof(SlabTestValue) });
+        assert(cache.allocate().ptr == objects[7]);
+        assert(cache.allocate().ptr == objects[3]);
+        assert(cache.stats().num_magazine_hits == 2);
+
+        // Overflowing the magazine goes back to the slabs
+        for (auto* object : objects)
+            cache.free({ object, sizeof(SlabTestValue) });
+        assert(cache.stats().num_in_use() == 0);
+        for (unsigned i = 0; i < 32; i++)
+            assert(cache.allocate());
+        assert(cache.stats().num_magazine_hits == 2 + 8);
+        assert(cache.stats().num_failed == 1);
+    }
+    free_scratch_page(ptr, size);
+}
+
+// Hands out the scratch pages one at a time, like the kernel's page allocator
+struct ScratchPageAllocator {
+    char* next;
+    char* end;
+
+    Allocation allocate(size_t size)
+    {
+        if (size > PageSize || next == end)
+            return {};
+
+        auto* page = next;
+        next += PageSize;
+        return { page, PageSize };
+    }
+    void free(Allocation) {}
+};
+
+void object_cache_hooks_and_growth()
+{
+    auto [ptr, size] = allocate_scratch_page(32);
+    {
+        ScratchPageAllocator page_allocator { ptr, ptr + size };
+
+        static unsigned num_constructed = 0;
+        static unsigned num_destroyed = 0;
+        auto construct = [](void* object) {
+            memset(object, 0, sizeof(SlabTestValue));
+            ++num_constructed;
+        };
+        auto destroy = [](void*) { ++num_destroyed; };
+        ObjectCache<SlabTestValue, ScratchPageAllocator> cache(&page_allocator, 0, construct, destroy);
+        assert(cache.stats().num_pages == 0);
+
+        // Grows past a single page on demand, from the fallback allocator
+        auto num_objects = 3 * cache.objects_per_page();
+        std::vector<Allocation> allocations;
+        for (size_t i = 0; i < num_objects; i++) {
+            auto allocation = cache.allocate();
+            assert(allocation);
+            for (size_t byte = 0; byte < sizeof(SlabTestValue); byte++)
+                assert(static_cast<u8*>(allocation.ptr)[byte] == 0);
+            memset(allocation.ptr, 0xff, sizeof(SlabTestValue));
+            allocations.push_back(allocation);
+        }
+        // Page-aligned pages are used whole
+        assert(cache.stats().num_pages >= 3);
+        assert(cache.stats().num_pages == static_cast<size_t>(page_allocator.next - ptr) / PageSize);
+        assert(num_constructed == num_objects);
+
+        for (auto& allocation : allocations)
+            cache.free(allocation);
+        assert(num_destroyed == num_objects);
+        assert(cache.stats().num_frees == num_objects);
+
+        // Reserving what we already have does not grow
+        auto num_pages = cache.stats().num_pages;
+        assert(cache.reserve(num_objects));
+        assert(cache.stats().num_pages == num_pages);
+    }
+    free_scratch_page(ptr, size);
+}
+
+void tlsf_allocate_and_free()
+{
+    constexpr unsigned num_pages = 16;
+    auto [ptr, size] = allocate_scratch_page(num_pages);
+    {
+        TLSFAllocator allocator;
+        allocator.add(ptr, size);
+
+        struct Live {
+            u8* ptr;
+            size_t size;
+            u8 pattern;
+        };
+        std::vector<Live> live;
+        std::mt19937 generator(7);
+        std::uniform_int_distribution<size_t> size_distribution(1, 2048);
+
+        for (unsigned op = 0; op < 20000; op++) {
+            if (live.empty() || generator() % 3 != 0) {
+                auto requested_size = size_distribution(generator);
+                auto allocation = allocator.allocate(requested_size);
+                if (!allocation)
+                    continue;  // full; frees will make room
+
+                assert(allocation.size >= requested_size);
+                assert(is_pointer_aligned_two(allocation.ptr, Alignment));
+                auto* alloc_ptr = static_cast<u8*>(allocation.ptr);
+                assert(alloc_ptr >= (u8*)ptr && alloc_ptr + allocation.size <= (u8*)ptr + size);
+
+                auto pattern = static_cast<u8>(generator());
+                memset(alloc_ptr, pattern, allocation.size);
+                live.push_back({ alloc_ptr, allocation.size, pattern });
+            }
+            else {
+                auto index = generator() % live.size();
+                auto entry = live[index];
+                // Nobody else wrote over us (overlapping allocations or headers)
+                for (size_t i = 0; i < entry.size; i++)
+                    assert(entry.ptr[i] == entry.pattern);
+
+                assert(allocator.free({ entry.ptr, entry.size }) == entry.size);
+                live.erase(live.begin() + index);
+            }
+        }
+
+        for (auto& entry : live)
+            allocator.free({ entry.ptr, entry.size });
+
+        // Everything should have coalesced back into one block
+        auto allocation = allocator.allocate(size * 3 / 4);
+        assert(allocation);
+        allocator.free(allocation);
+    }
+    free_scratch_page(ptr, size);
+}
+
+void tlsf_exhaust()
+{
+    auto [ptr, size] = allocate_scratch_page(1);
+    {
+        TLSFAllocator allocator;
+        assert(!allocator.allocate(16));
+        allocator.add(ptr, size);
+
+        std::vector<Allocation> allocations;
+        for (;;) {
+            auto allocation = allocator.allocate(48);
+            if (!allocation)
+                break;
+            allocations.push_back(allocation);
+        }
+        assert(allocations.size() > 16);
+        assert(!allocator.allocate(48));
+
+        // Free every other one, away from the end; none of those holes can
+        // be merged
+        for (size_t i = 1; i + 1 < allocations.size(); i += 2)
+            allocator.free(allocations[i]);
+        assert(!allocator.allocate(allocations[1].size * 2));
+        for (size_t i = 1; i + 1 < allocations.size(); i += 2) {
+            allocations[i] = allocator.allocate(48);
+            assert(allocations[i]);
+        }
+        assert(!allocator.allocate(48));
+
+        for (auto& allocation : allocations)
+            allocator.free(allocation);
+        assert(allocator.allocate(size / 2));
+        assert(!allocator.allocate(size));
+    }
+    free_scratch_page(ptr, size);
+}
+
+void tlsf_stays_within_region()
+{
+    auto [ptr, size] = allocate_scratch_page(1);
+    {
+        // Only give the allocator the first half; the rest must not be touched
+        auto* bytes = reinterpret_cast<u8*>(ptr);
+        memset(bytes, 0xaa, size);
+        TLSFAllocator allocator;
+        allocator.add(bytes, size / 2);
+
+        auto allocation = allocator.allocate(64);
+        assert(allocation);
+        memset(allocation.ptr, 0, allocation.size);
+        allocator.free(allocation);
+
+        for (size_t i = size / 2; i < size; i++)
+            assert(bytes[i] == 0xaa);
+    }
+    free_scratch_page(ptr, size);
+}
+
+void tlsf_reclaim()
+{
+    auto [ptr, size] = allocate_scratch_page(8);
+    {
+        auto region_size = size / 2;
+        TLSFAllocator allocator;
+        allocator.add(ptr, region_size);
+        auto allocation = allocator.allocate(64);
+        allocator.free(allocation);
+        assert(!allocator.reclaim());  // the last region is kept
+
+        allocator.add(ptr + region_size, region_size);
+        allocation = allocator.allocate(region_size / 2);
+        assert(allocation);
+        assert(!allocator.reclaim());  // still in use
+        allocator.free(allocation);
+
+        auto reclaimed = allocator.reclaim();
+        assert(reclaimed.ptr == ptr || reclaimed.ptr == ptr + region_size);
+        assert(reclaimed.size == region_size);
+        assert(!allocator.reclaim());
+
+        // We only allocate out of the remaining region from now on
+        auto* remaining_ptr = reclaimed.ptr == ptr ? ptr + region_size : ptr;
+        allocation = allocator.allocate(region_size / 2);
+        assert(allocation.ptr > remaining_ptr && allocation.ptr < remaining_ptr + region_size);
+        allocator.free(allocation);
+        assert(!allocator.reclaim());
+    }
+    free_scratch_page(ptr, size);
+}
+
+void tlsf_with_fallback()
+{
+    constexpr unsigned num_pages = 64;
+    auto [ptr, size] = allocate_scratch_page(num_pages);
+    {
+        FixedAllocation fixed_allocation(reinterpret_cast<PtrData>(ptr), size);
+        FallbackAllocatorBinder<FixedAllocation, TLSFAllocator> allocator(&fixed_allocation);
+
+        // The first allocation has to pull in memory from the fallback
+        auto allocation = allocator.allocate(size / 2);
+        assert(allocation);
+        assert(allocation.size >= size / 2);
+        assert(allocator.free(allocation) == allocation.size);
+
+        for (size_t requested_size = 1; requested_size < size / 4; requested_size *= 3) {
+            allocation = allocator.allocate(requested_size);
+            assert(allocation);
+            allocator.free(allocation);
+        }
+    }
+    free_scratch_page(ptr, size);
+}
+
+void tlsf_with_fallback_gives_back_regions()
+{
+    constexpr unsigned num_pages = 64;
+    auto [ptr, size] = allocate_scratch_page(num_pages);
+    {
+        TLSFAllocator fallback;
+        fallback.add(ptr, size);
+        FallbackAllocatorBinder<TLSFAllocator, TLSFAllocator> allocator(&fallback);
+
+        // Each of these needs its own region from the fallback
+        auto first = allocator.allocate(20 * PageSize);
+        auto second = allocator.allocate(20 * PageSize);
+        assert(first && second);
+        assert(!fallback.allocate(30 * PageSize));
+
+        // The second region merges back with the rest of the fallback
+        allocator.free(second);
+        auto allocation = fallback.allocate(30 * PageSize);
+        assert(allocation);
+        fallback.free(allocation);
+        allocator.free(first);
+    }
+    free_scratch_page(ptr, size);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#include <pine/math.hpp>
+
+void divmod_u64()
+{
+    u64 numerators[] = { 0, 1, 999'999'999, 1'000'000'000, 0xffff'ffff, 0x1'0000'0000, 123'456'789'012'345, UINT64_MAX };
+    u32 denominators[] = { 1, 2, 7, 1000, 1'000'000, 1'000'000'000, 0xffff'ffff };
+    for (auto numerator : numerators) {
+        for (auto denominator : denominators) {
+            auto [quotient, remainder] = pine::divmod(numerator, denominator);
+            assert(quotient == numerator / denominator);
+            assert(remainder == numerator % denominator);
+
+            auto [bitwise_quotient, bitwise_remainder] = pine::divmod_bitwise(numerator, denominator);
+            assert(bitwise_quotient == quotient);
+            assert(bitwise_remainder == remainder);
+        }
+    }
+
+    static_assert(pine::divmod_bitwise(123'456'789'012'345, 1'000'000).first == 123'456'789);
+    static_assert(pine::divmod_bitwise(123'456'789'012'345, 1'000'000).second == 12'345);
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <pine/rb_tree.hpp>
+
+#include <cassert>
+#include <cstdlib>
+
+struct RBTreeItem {
+    int key = 0;
+    int order = 0;  // when it was inserted
+    pine::RBTreeLink<RBTreeItem> link;
+};
+
+struct RBTreeItemTraits {
+    static pine::RBTreeLink<RBTreeItem>& link(RBTreeItem& item) { return item.link; }
+    static bool less(const RBTreeItem& first, const RBTreeItem& second) { return first.key < second.key; }
+};
+
+using ItemTree = pine::RBTree<RBTreeItem, RBTreeItemTraits>;
+
+/*
+ * Checks the red-black properties below item, returning its black height.
+ */
+inline int rb_tree_black_height(const RBTreeItem* item)
+{
+    if (!item)
+        return 1;
+
+    auto& link = item->link;
+    assert(link.is_linked);
+    if (link.is_red) {
+        assert(!link.left || !link.left->link.is_red);
+        assert(!link.right || !link.right->link.is_red);
+    }
+    if (link.left)
+        assert(link.left->link.parent == item && link.left->key <= item->key);
+    if (link.right)
+        assert(link.right->link.parent == item && link.right->key >= item->key);
+
+    int left_height = rb_tree_black_height(link.left);
+    assert(left_height == rb_tree_black_height(link.right));
+    return left_height + (link.is_red ? 0 : 1);
+}
+
+/*
+ * Checks the tree is balanced, sorted and stable (equal keys in insertion
+ * order), and holds expected_size items.
+ */
+inline void rb_tree_check(const ItemTree& tree, size_t expected_size)
+{
+    assert(tree.size() == expected_size);
+    assert(tree.is_empty() == (expected_size == 0));
+    if (tree.is_empty()) {
+        assert(!tree.first() && !tree.last());
+        return;
+    }
+
+    auto* root = tree.first();
+    while (root->link.parent)
+        root = root->link.parent;
+    assert(!root->link.is_red);
+    rb_tree_black_height(root);
+
+    size_t count = 0;
+    const RBTreeItem* prev = nullptr;
+    for (auto* item = tree.first(); item; item = ItemTree::next(*item)) {
+        if (prev)
+            assert(prev->key < item->key || (prev->key == item->key && prev->order < item->order));
+        prev = item;
+        count++;
+    }
+    assert(count == expected_size);
+    assert(prev == tree.last());
+}
+
+void rb_tree_insert_and_remove_first()
+{
+    constexpr int num_items = 64;
+    RBTreeItem items[num_items];
+    ItemTree tree;
+    rb_tree_check(tree, 0);
+
+    // Descending, then ascending keys: the worst cases for an unbalanced tree
+    for (int i = 0; i < num_items; i++) {
+        items[i].key = i < num_items / 2 ? num_items - i : i;
+        items[i].order = i;
+        tree.insert(items[i]);
+        rb_tree_check(tree, static_cast<size_t>(i + 1));
+    }
+
+    int prev_key = 0;
+    for (int i = num_items; i > 0; i--) {
+        auto* first = tree.first();
+        assert(first->key >= prev_key);
+        prev_key = first->key;
+
+        tree.remove(*first);
+        assert(!ItemTree::is_linked(*first));
+        rb_tree_check(tree, static_cast<size_t>(i - 1));
+    }
+}
+
+void rb_tree_random_trace()
+{
+    constexpr int num_items = 200;
+    RBTreeItem items[num_items];
+    ItemTree tree;
+    size_t size = 0;
+
+    srand(0x7ee5);
+    for (int round = 0; round < 20000; round++) {
+        auto& item = items[rand() % num_items];
+        if (ItemTree::is_linked(item)) {
+            tree.remove(item);
+            size--;
+        }
+        else {
+            // Few keys, so many are equal
+            item.key = rand() % 16;
+            item.order = round;
+            tree.insert(item);
+            size++;
+        }
+
+        if (round % 64 == 0)
+            rb_tree_check(tree, size);
+    }
+    rb_tree_check(tree, size);
+}
+
+void rb_tree_find()
+{
+    constexpr int num_items = 64;
+    RBTreeItem items[num_items];
+    ItemTree tree;
+
+    // Every other key, so that the odd ones are missing
+    for (int i = 0; i < num_items; i++) {
+        items[i].key = 2 * ((i * 37) % num_items);
+        tree.insert(items[i]);
+    }
+
+    for (int key = -1; key <= 2 * num_items; key++) {
+        auto* found = tree.find([&](const RBTreeItem& item) { return item.key - key; });
+        if (key >= 0 && key < 2 * num_items && key % 2 == 0)
+            assert(found && found->key == key);
+        else
+            assert(!found);
+    }
+}
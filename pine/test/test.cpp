@@ -1,8 +1,13 @@
 #include "algorithm.hpp"
+#include "array.hpp"
+#include "c_builtins.hpp"
+#include "c_string.hpp"
 #include "forward_container.hpp"
 #include "linked_list.hpp"
 #include "malloc.hpp"
+#include "math.hpp"
 #include "maybe.hpp"
+#include "rb_tree.hpp"
 #include "twomath.hpp"
 #include "vector.hpp"
 
@@ -28,6 +33,12 @@ int main()
     manual_linked_list_insert();
     manual_linked_list_append();
     manual_linked_list_remove();
+    manual_linked_list_detach();
+
+    alien::errorln("Testing RBTree");
+    rb_tree_insert_and_remove_first();
+    rb_tree_random_trace();
+    rb_tree_find();
 
     alien::errorln("Testing alignment");
     align_down_two();
@@ -35,9 +46,18 @@ int main()
     is_aligned_two();
     alignment_up_two();
     bit_width();
+    countr_zero();
+    countl_zero();
     align_down_to_power();
     align_up_to_power();
 
+    alien::errorln("Testing math");
+    divmod_u64();
+
+    alien::errorln("Testing BitMap");
+    bitmap_set_and_clear();
+    bitmap_find_first_zero();
+
     alien::errorln("Testing Maybe<>");
     maybe_basic();
     maybe_copy_assignment();
@@ -48,8 +68,39 @@ int main()
     alien::errorln("Testing FreeList");
     free_list_re_add();
 
+    alien::errorln("Testing TLSFAllocator");
+    tlsf_allocate_and_free();
+    tlsf_exhaust();
+    tlsf_stays_within_region();
+    tlsf_reclaim();
+    tlsf_with_fallback();
+    tlsf_with_fallback_gives_back_regions();
+
+    alien::errorln("Testing SlabAllocator");
+    slab_allocator_fill_and_reclaim();
+    slab_allocator_prefers_partial_pages();
+
+    alien::errorln("Testing ObjectCache");
+    object_cache_reuses_recent_objects();
+    object_cache_hooks_and_growth();
+
     alien::errorln("Testing PageAllocator");
     page_allocator_backend_create();
+    page_allocator_backend_coalesce();
+    page_allocator_backend_alignment();
+    page_allocator_backend_reserve_region();
+    page_allocator_backend_random_trace();
+    page_allocator_backend_bounded_cost();
+
+    alien::errorln("Testing C builtins");
+    c_builtins_memcpy();
+    c_builtins_memset_and_bzero();
+    c_builtins_memmove_overlapping();
+
+    alien::errorln("Testing C strings");
+    c_string_fuzz_strlen_and_strcmp();
+    c_string_fuzz_strcopy_and_strbufcopy();
+    c_string_reads_stop_at_page_boundary();
 
     alien::errorln("Testing Algorithms");
     algorithm_find();
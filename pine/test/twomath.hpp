@@ -199,6 +199,40 @@ void bit_width()
     assert(bit_width(ULONG_MAX) == sizeof(unsigned long) * CHAR_BIT);
 }
 
+void countr_zero()
+{
+    assert(countr_zero(0u) == sizeof(unsigned) * CHAR_BIT);
+    assert(countr_zero(1u) == 0);
+    assert(countr_zero(2u) == 1);
+    assert(countr_zero(3u) == 0);
+    assert(countr_zero(4u) == 2);
+    assert(countr_zero(12u) == 2);
+    assert(countr_zero(16u) == 4);
+    assert(countr_zero(24u) == 3);
+    assert(countr_zero(1u << 31) == 31);
+    assert(countr_zero(0ul) == sizeof(unsigned long) * CHAR_BIT);
+    assert(countr_zero(1ul << (sizeof(unsigned long) * CHAR_BIT - 1)) == sizeof(unsigned long) * CHAR_BIT - 1);
+    assert(countr_zero(static_cast<u8>(0)) == CHAR_BIT);
+    assert(countr_zero(static_cast<u8>(0x80)) == 7);
+}
+
+void countl_zero()
+{
+    constexpr unsigned width = sizeof(unsigned) * CHAR_BIT;
+    assert(countl_zero(0u) == width);
+    assert(countl_zero(1u) == width - 1);
+    assert(countl_zero(2u) == width - 2);
+    assert(countl_zero(3u) == width - 2);
+    assert(countl_zero(255u) == width - 8);
+    assert(countl_zero(256u) == width - 9);
+    assert(countl_zero(UINT_MAX) == 0);
+    assert(countl_zero(ULONG_MAX) == 0);
+    assert(countl_zero(1ul) == sizeof(unsigned long) * CHAR_BIT - 1);
+    assert(countl_zero(static_cast<u8>(0)) == CHAR_BIT);
+    assert(countl_zero(static_cast<u8>(1)) == CHAR_BIT - 1);
+    assert(countl_zero(static_cast<u16>(0x80)) == 8);
+}
+
 void align_down_to_power()
 {
     assert(align_down_to_power(17u) == 16);
@@ -90,6 +90,45 @@ constexpr UInt bit_width(UInt value)
     return static_cast<UInt>(width);
 }
 
+/*
+ * Returns the number of trailing zero bits; the index of the lowest set bit.
+ *
+ * Compiles down to RBIT + CLZ on ARM, rather than a loop like bit_width().
+ */
+template <typename UInt>
+constexpr unsigned countr_zero(UInt value)
+{
+    static_assert(is_unsigned<UInt>);
+    if (value == 0)
+        return sizeof(UInt) * CHAR_BIT;
+
+    if constexpr (sizeof(UInt) <= sizeof(unsigned))
+        return static_cast<unsigned>(__builtin_ctz(value));
+    else if constexpr (sizeof(UInt) <= sizeof(unsigned long))
+        return static_cast<unsigned>(__builtin_ctzl(value));
+    else
+        return static_cast<unsigned>(__builtin_ctzll(value));
+}
+
+/*
+ * Returns the number of leading zero bits; CLZ on ARM.
+ */
+template <typename UInt>
+constexpr unsigned countl_zero(UInt value)
+{
+    static_assert(is_unsigned<UInt>);
+    constexpr auto width = static_cast<unsigned>(sizeof(UInt) * CHAR_BIT);
+    if (value == 0)
+        return width;
+
+    if constexpr (sizeof(UInt) <= sizeof(unsigned))
+        return static_cast<unsigned>(__builtin_clz(value)) - (static_cast<unsigned>(sizeof(unsigned) * CHAR_BIT) - width);
+    else if constexpr (sizeof(UInt) <= sizeof(unsigned long))
+        return static_cast<unsigned>(__builtin_clzl(value)) - (static_cast<unsigned>(sizeof(unsigned long) * CHAR_BIT) - width);
+    else
+        return static_cast<unsigned>(__builtin_clzll(value)) - (static_cast<unsigned>(sizeof(unsigned long long) * CHAR_BIT) - width);
+}
+
 template <typename UInt>
 constexpr UInt align_down_to_power(UInt value)
 {
@@ -7,5 +7,8 @@ constexpr unsigned MiB = 1048576;
 constexpr unsigned GiB = 1073741824;
 constexpr unsigned Alignment = alignof(max_align_t);
 
-#define SYS_HZ 8
+// Ticks per second; a power of two, which builds can raise with -DSYS_HZ_BITS=n
+#ifndef SYS_HZ_BITS
 #define SYS_HZ_BITS 3
+#endif
+#define SYS_HZ (1 << SYS_HZ_BITS)
@@ -51,9 +51,33 @@ void yield()
     syscall0(Syscall::Yield);
 }
 
+int nice(int increment)
+{
+    auto arg1 = from_signed_cast<PtrData>(increment);
+    auto result = syscall1(Syscall::Nice, arg1);
+    return to_signed_cast<int>(result);
+}
+
+int set_sched_params(const SchedParams* params)
+{
+    auto result = syscall1(Syscall::SetSchedParams, reinterpret_cast<PtrData>(params));
+    return to_signed_cast<int>(result);
+}
+
+int get_sched_params(SchedParams* params)
+{
+    auto result = syscall1(Syscall::GetSchedParams, reinterpret_cast<PtrData>(params));
+    return to_signed_cast<int>(result);
+}
+
 void sleep(u32 secs)
 {
-    syscall1(Syscall::Sleep, secs);
+    msleep(secs * 1000);
+}
+
+void msleep(u32 ms)
+{
+    syscall1(Syscall::Sleep, ms);
 }
 
 u32 uptime()
@@ -66,6 +90,18 @@ u32 cputime()
     return static_cast<u32>(syscall0(Syscall::CPUTime));
 }
 
+int clock_gettime(Clock clock, TimeSpec* time)
+{
+    auto result = syscall2(Syscall::ClockGetTime, static_cast<PtrData>(clock), reinterpret_cast<PtrData>(time));
+    return to_signed_cast<int>(result);
+}
+
+int lockstats()
+{
+    auto result = syscall0(Syscall::LockStats);
+    return to_signed_cast<int>(result);
+}
+
 int printf(const char* fmt, ...)
 {
     va_list args;
@@ -152,3 +188,9 @@ void exit(int code)
 {
     syscall1(Syscall::Exit, pine::bit_cast<PtrData>(static_cast<ptrdiff_t>(code)));
 }
+
+int fork()
+{
+    auto result = syscall0(Syscall::Fork);
+    return to_signed_cast<int>(result);
+}
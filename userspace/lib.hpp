@@ -33,12 +33,29 @@ int dup(int fd);
 
 void yield();
 
+// Returns the new nice value; higher is a smaller share of the CPU
+int nice(int increment);
+
+// Both return 0 on success; see SchedParams
+int set_sched_params(const SchedParams* params);
+
+int get_sched_params(SchedParams* params);
+
 void sleep(u32 secs);
 
+void msleep(u32 ms);
+
+// Both in milliseconds
 u32 uptime();
 
 u32 cputime();
 
+int clock_gettime(Clock clock, TimeSpec* time);
+
+// Has the kernel print its lock statistics to the console; returns 0, or
+// negative if it wasn't built with LOCK_STATS=1
+int lockstats();
+
 int printf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
 
 struct HeapExtender {
@@ -73,6 +90,10 @@ MallocStats memstats();
 
 void exit(int code);
 
+// Returns the new task's id in the task that called it and 0 in the new
+// task, which starts out with a copy of its memory; negative on error
+int fork();
+
 // We don't use this in any capacity, but compilers will insert calls to it
 inline int atexit(void (*)()) { return 0; };
 
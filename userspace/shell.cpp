@@ -20,13 +20,41 @@ static void builtin_memstat()
            malloc_stats.num_frees);
 }
 
+static unsigned to_ms(TimeSpec time)
+{
+    return static_cast<unsigned>(time.seconds * 1000 + time.nanoseconds / 1'000'000);
+}
+
 static void builtin_uptime()
 {
-    unsigned uptime_jiffies = uptime();
-    unsigned uptime_seconds = uptime_jiffies >> SYS_HZ_BITS;
-    unsigned cputime_jiffies = cputime();
-    unsigned cpu_usage = cputime_jiffies * 100u / pine::max(uptime_jiffies, static_cast<decltype(cputime_jiffies)>(1));
-    printf("up %us, usage: %u%% (%u / %u jiffies)\n", uptime_seconds, cpu_usage, cputime_jiffies, uptime_jiffies);
+    TimeSpec uptime_spec {};
+    TimeSpec cputime_spec {};
+    if (clock_gettime(Clock::Monotonic, &uptime_spec) != 0 || clock_gettime(Clock::TaskCPUTime, &cputime_spec) != 0) {
+        printf("Could not get the time\n");
+        return;
+    }
+
+    unsigned uptime_ms = to_ms(uptime_spec);
+    unsigned cputime_ms = to_ms(cputime_spec);
+    auto cpu_usage = static_cast<unsigned>(pine::divmod(static_cast<u64>(cputime_ms) * 100u, pine::max(uptime_ms, 1u)).first);
+    printf("up %us, usage: %u%% (%u / %u ms)\n", static_cast<unsigned>(uptime_spec.seconds), cpu_usage, cputime_ms, uptime_ms);
+}
+
+static void builtin_fork()
+{
+    int task_id = fork();
+    if (task_id < 0) {
+        printf("Could not fork: %d\n", task_id);
+        return;
+    }
+    if (task_id == 0) {
+        // The copy of the shell; its memory is the shell's until it writes
+        printf("Hello from the forked shell!\n");
+        exit(0);
+    }
+
+    printf("Forked task %d.\n", task_id);
+    yield();  // let it say hello before the prompt
 }
 
 static void setup_uart_as_stdio()
@@ -97,6 +125,15 @@ void shell()
             sleep(2);
             continue;
         }
+        if (command == "fork") {
+            builtin_fork();
+            continue;
+        }
+        if (command == "lockstats") {
+            if (lockstats() < 0)
+                printf("Lock stats are only kept when built with LOCK_STATS=1.\n");
+            continue;
+        }
         if (command == "help") {
             printf("The following commands are available to you:\n");
             printf("  - memstat\tProvides statistics on the amount of memory used by this task.\n");
@@ -104,12 +141,13 @@ void shell()
             printf("  - yield\tYields to the spin task. The spin task simply spins until it is preempted. You should see control return to this task shortly.\n");
             printf("  - sleep\tPuts this task to sleep for 2 seconds.\n");
             printf("  - spin\tSpins in a loop for a couple seconds.\n");
+            printf("  - fork\tForks this task; the copy says hello and exits.\n");
+            printf("  - lockstats\tPrints how contended the kernel's locks have been to the console.\n");
             printf("  - exit\tSays goodbye. Please hit Ctrl-C to actually exit.\n");
             printf("\n");
             printf("Known Bugs (because we're honest around here!):\n");
             printf("  - You may encounter periods of a second or more of unresponsiveness. This is a known issue related to emulation and the design the system timer peripheral.\n");
             printf("  - 'sleep' can sleep for more than 2 seconds. Related to the above issue.\n");
-            printf("  - Time slowly drifts away from real time.\n");
             continue;
         }
         printf("Unknown command '%s'. Use 'help'.\n", command.data());